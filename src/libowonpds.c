@@ -31,21 +31,9 @@
 #include <sys/types.h>
 
 #include "endian_portable.h"
+#include "libowonpds_helper.h"
+#include "libowonpds_internal.h"
 
-#define USB_VID 0x5345
-#define USB_PID 0x1234
-
-#define USB_CONFIG 1
-#define USB_INTERFACE 0
-
-#define WRITE_ENDPOINT	0x03
-#define READ_ENDPOINT  0x81
-
-#define TIMEOUT 2000
-
-#define CMD_START "START"
-
-#define HEADER_SIZE 12
 #define HEADER_TYPE 8
 
 #define FILE_HEADER_SIZE 10
@@ -67,6 +55,9 @@
 #define CH_SENS 27
 #define CH_ATTEN 31
 
+#define BM_OFFSET 10
+#define BM_HEIGHT 22
+
 #define ID_VECTOR "SPB"
 #define ID_BITMAP "BM"
 
@@ -116,164 +107,565 @@ uint32_t power10(const uint32_t exponent){
 	return(power);
 }
 
-// Scale little endian vector data to volts
-void scale_vector(OWON_CHANNEL_T *channel, const unsigned char *data) {
+// Get a buffer of at least length bytes, reusing it if already large enough
+// A zero size marks a buffer not owned by the scope (a mapped file)
+void *reserve(void *buffer, size_t *size, const size_t length) {
 
-	uint32_t length = channel->samples;
-	channel->vector = malloc(sizeof(double) * length);
+	if (buffer && *size >= length)
+		return (buffer);
 
-	if (channel->vector) {
+	if (*size)
+		free(buffer);
+	buffer = malloc(length ? length : 1);
+	*size = buffer ? (length ? length : 1) : 0;
+
+	return (buffer);
+}
+
+// Copy little endian samples to host order
+void copy_samples(int16_t *samples, const unsigned char *data,
+		const uint32_t length) {
+
+	const uint16_t probe = 1;
+
+	if (*(const unsigned char *) &probe)
+		memcpy(samples, data, sizeof(int16_t) * length);
+	else {
+		uint32_t i;
+		for (i = 0; i < length; i++)
+			samples[i] = (int16_t) (data[i * 2] | data[i * 2 + 1] << 8);
+	}
+}
+
+// Copy host order samples to little endian
+void store_samples(unsigned char *data, const int16_t *samples,
+		const uint32_t length) {
+
+	const uint16_t probe = 1;
+
+	if (*(const unsigned char *) &probe)
+		memcpy(data, samples, sizeof(int16_t) * length);
+	else {
 		uint32_t i;
 		for (i = 0; i < length; i++) {
-			// Endian conversion
-			short value = (short) (data[i * 2] | (data[i * 2 + 1]) << 8);
-			value = le16toh(value);
-			channel->vector[i] = value * channel->sensitivity / SCALE_V;
+			data[i * 2] = (unsigned char) samples[i];
+			data[i * 2 + 1] = (unsigned char) ((uint16_t) samples[i] >> 8);
 		}
+	}
+}
+
+// Scale samples to volts
+bool scale_vector(OWON_CHANNEL_T *channel) {
+
+	uint32_t length = channel->samples;
+	channel->vector = reserve(channel->vector, &channel->vector_size,
+			sizeof(double) * length);
 
+	if (channel->vector) {
+		simd_kernels()->scale(channel->vector, channel->data, length,
+				channel->scale);
+		channel->converted = true;
 	} else
 		error("Failed to allocate vector memory");
+
+	return (channel->converted);
 }
 
-// Decode channel data
-void decode_channel(OWON_SCOPE_T *scope, unsigned char *data) {
+// Extract the samples of a channel block
+void decode_samples(OWON_SCOPE_T *scope, OWON_CHANNEL_T *channel,
+		const unsigned char *data) {
+
+	bool scale = !(scope->options & OWON_OPT_RAW);
+	uint64_t start = stats_time(scope);
+
+	channel->converted = false;
+	channel->measure.valid = false;
+	channel->data = reserve(channel->data, &channel->data_size,
+			sizeof(int16_t) * channel->samples);
+	if (channel->data && scale)
+		channel->vector = reserve(channel->vector, &channel->vector_size,
+				sizeof(double) * channel->samples);
+	stats_stage(scope, OWON_STAGE_ALLOC, start);
+
+	if (channel->data) {
+		copy_samples(channel->data, data, channel->samples);
+		if (scale) {
+			start = stats_time(scope);
+			scale_vector(channel);
+			stats_stage(scope, OWON_STAGE_SCALE, start);
+		}
+		if (scope->options & OWON_OPT_MEASURE) {
+			start = stats_time(scope);
+			measure_channel(channel);
+			stats_stage(scope, OWON_STAGE_MEASURE, start);
+		}
+	} else
+		error("Failed to allocate sample memory");
+}
+
+// Start decoding the channel blocks of a vector capture
+static bool begin_channels(OWON_SCOPE_T *scope, DECODER_T *decoder,
+		const unsigned char *data) {
 
 	memcpy(scope->name, &data[SCOPE_NAME], OWON_SCOPE_NAME_LEN);
 
 	// Check if data is matching vector type
-	if (data[SCOPE_TYPE] == 'V' || data[SCOPE_TYPE] == 'W'
-			|| data[SCOPE_TYPE] == 'X') {
-		scope->type = OWON_TYPE_VECTOR;
+	if (data[SCOPE_TYPE] != 'V' && data[SCOPE_TYPE] != 'W'
+			&& data[SCOPE_TYPE] != 'X') {
+		error("Unknown vector type");
+		return (false);
+	}
 
-		unsigned char *current = data + FILE_HEADER_SIZE;
-		unsigned channel_num = 0;
+	scope->type = OWON_TYPE_VECTOR;
+	scope->channel_count = 0;
+	decoder->current = FILE_HEADER_SIZE;
+	decoder->vector = true;
+	decoder->done = false;
 
-		// Loop over each channel block extracting data
+	return (true);
+}
+
+// Decode the channel blocks within the first available bytes of the
+// payload, those after are decoded by the next call
+static bool decode_blocks(OWON_SCOPE_T *scope, DECODER_T *decoder,
+		const unsigned char *data, const uint32_t available) {
+
+	const unsigned char *end = data + scope->file_length;
+
+	// Loop over each channel block extracting data
+	while (!decoder->done) {
+		const unsigned char *current = data + decoder->current;
+		size_t ready = available > decoder->current ?
+				available - decoder->current : 0;
 		OWON_CHANNEL_T *channel;
-		while ((unsigned)(current - data) < scope->file_length) {
-			uint32_t blockSize;
-			channel = &scope->channel[channel_num];
+		uint32_t blockSize;
+
+		if (current >= end || scope->channel_count >= OWON_MAX_CHANNELS) {
+			decoder->done = true;
+			break;
+		}
+		channel = &scope->channel[scope->channel_count];
+
+		if ((size_t) (end - current) < CHANNEL_HEADER_SIZE) {
+			error("Truncated channel header");
+			return (false);
+		}
+		if (ready < CHANNEL_HEADER_SIZE)
+			break;
+
+		memcpy(channel->name, &current[CH_NAME], OWON_CHANNEL_NAME_LEN);
 
-			memcpy(channel->name, &current[CH_NAME], OWON_CHANNEL_NAME_LEN);
+		blockSize = data_to_uint(&current[CH_BLOCK_LEN], 4);
+		channel->samples = data_to_uint(&current[CH_SAMPLE_LEN], 4);
+		if ((size_t) (end - current) < CHANNEL_HEADER_SIZE
+				+ (size_t) channel->samples * 2) {
+			error("Truncated channel data");
+			return (false);
+		}
+		if (ready < CHANNEL_HEADER_SIZE + (size_t) channel->samples * 2)
+			break;
 
-			blockSize = data_to_uint(&current[CH_BLOCK_LEN], 4);
-			channel->samples = data_to_uint(&current[CH_SAMPLE_LEN], 4);
+		uint32_t timebase_index = data_to_uint(&current[CH_TIMEBASE], 1);
+		uint32_t sensitivity_index = data_to_uint(&current[CH_SENS], 1);
+		if (timebase_index >= sizeof(TIMEBASE) / sizeof(TIMEBASE[0])
+				|| sensitivity_index
+						>= sizeof(SENSITIVITY) / sizeof(SENSITIVITY[0])) {
+			error("Unknown channel settings");
+			return (false);
+		}
 
-			uint32_t timebase_index = data_to_uint(&current[CH_TIMEBASE], 1);
-			channel->timebase = TIMEBASE[timebase_index] / 1000;
-			channel->sample_rate = channel->samples / channel->timebase
-					/ SCALE_T;
+		channel->timebase = TIMEBASE[timebase_index] / 1000;
+		channel->sample_rate = channel->samples / channel->timebase
+				/ SCALE_T;
 
-			uint32_t slow = data_to_uint(&current[CH_SLOW], 4);
-			channel->slow = slow / channel->sample_rate;
+		uint32_t slow = data_to_uint(&current[CH_SLOW], 4);
+		channel->slow = slow / channel->sample_rate;
 
-			uint32_t attenuation_index = data_to_uint(&current[CH_ATTEN], 4);
-			channel->attenuation = power10(attenuation_index);
+		uint32_t attenuation_index = data_to_uint(&current[CH_ATTEN], 4);
+		channel->attenuation = power10(attenuation_index);
 
-			uint32_t sensitivity_index = data_to_uint(&current[CH_SENS], 1);
-			double sensitivity = SENSITIVITY[sensitivity_index];
-			if (data[3] == 'W' || data[3] == 'X')
-				sensitivity -= 0.0000005;
-			channel->sensitivity = sensitivity * channel->attenuation;
+		double sensitivity = SENSITIVITY[sensitivity_index];
+		if (data[3] == 'W' || data[3] == 'X')
+			sensitivity -= 0.0000005;
+		channel->sensitivity = sensitivity * channel->attenuation;
 
-			int32_t offset_index = data_to_int(&current[CH_OFFSET], 4);
-			channel->offset = offset_index * channel->sensitivity / SCALE_V;
+		int32_t offset_index = data_to_int(&current[CH_OFFSET], 4);
+		channel->offset = offset_index * channel->sensitivity / SCALE_V;
+		channel->scale = channel->sensitivity / SCALE_V;
 
-			scale_vector(channel, current + CHANNEL_HEADER_SIZE);
+		decode_samples(scope, channel, current + CHANNEL_HEADER_SIZE);
 
-			current += blockSize + OWON_CHANNEL_NAME_LEN;
+		scope->channel_count++;
 
-			if (channel_num < OWON_MAX_CHANNELS)
-				channel_num++;
-			else
-				break;
+		if ((size_t) (end - current)
+				< (size_t) blockSize + OWON_CHANNEL_NAME_LEN) {
+			decoder->done = true;
+			break;
 		}
-		scope->channel_count = channel_num;
-	} else
-		error("Unknown vector type");
+		decoder->current += blockSize + OWON_CHANNEL_NAME_LEN;
+	}
+
+	return (true);
+}
+
+// Decode channel data
+bool decode_channel(OWON_SCOPE_T *scope, const unsigned char *data) {
+
+	DECODER_T decoder;
+
+	return (begin_channels(scope, &decoder, data)
+			&& decode_blocks(scope, &decoder, data, scope->file_length));
 }
 
-// Decode bitmap data
-void decode_bitmap(OWON_SCOPE_T *scope, unsigned char *data) {
+// Decode bitmap data, the pixels are used in place
+bool decode_bitmap(OWON_SCOPE_T *scope, const unsigned char *data) {
+
+	unsigned pixel_size = sizeof(char) * OWON_BITMAP_CHANNELS;
+	unsigned row_size = OWON_BITMAP_WIDTH * pixel_size;
+	uint32_t pixels = BITMAP_HEADER_SIZE;
+
+	if (scope->file_length >= BITMAP_HEADER_SIZE) {
+		uint32_t offset = data_to_uint(&data[BM_OFFSET], 4);
+		if (offset > BITMAP_HEADER_SIZE)
+			pixels = offset;
+	}
+	if (scope->file_length < pixels
+			|| scope->file_length - pixels
+					< (size_t) row_size * OWON_BITMAP_HEIGHT) {
+		error("Truncated bitmap data");
+		return (false);
+	}
 
+	// Rows are stored bottom-up unless the height is negative
 	scope->type = OWON_TYPE_BITMAP;
-	scope->bitmap = malloc(scope->file_length);
-	unsigned char *image = data + BITMAP_HEADER_SIZE;
-	if (scope->bitmap) {
-		unsigned i;
-		unsigned pixel_size = sizeof(char) * OWON_BITMAP_CHANNELS;
-		unsigned row_size = OWON_BITMAP_WIDTH * pixel_size;
-		// Vertical flip
-		for (i = 0; i < OWON_BITMAP_HEIGHT; i++) {
-			memcpy(&scope->bitmap[i * row_size],
-					&image[(OWON_BITMAP_HEIGHT - i) * row_size], row_size);
-		}
-		scope->bitmap_width = OWON_BITMAP_WIDTH;
-		scope->bitmap_height = OWON_BITMAP_HEIGHT;
-		scope->bitmap_channels = OWON_BITMAP_CHANNELS;
-	} else
-		error("Failed to allocate bitmap memory");
+	if (data_to_int(&data[BM_HEIGHT], 4) < 0) {
+		scope->bitmap = data + pixels;
+		scope->bitmap_stride = (int) row_size;
+	} else {
+		scope->bitmap = data + pixels
+				+ (size_t) row_size * (OWON_BITMAP_HEIGHT - 1);
+		scope->bitmap_stride = -(int) row_size;
+	}
+	scope->bitmap_width = OWON_BITMAP_WIDTH;
+	scope->bitmap_height = OWON_BITMAP_HEIGHT;
+	scope->bitmap_channels = OWON_BITMAP_CHANNELS;
+
+	return (true);
 }
 
 // Decode a file based on it's id
-bool decode_file(OWON_SCOPE_T *scope, unsigned char *data) {
+bool decode_file(OWON_SCOPE_T *scope, const unsigned char *data) {
 
-	if (strncmp(ID_VECTOR, (char *) data, sizeof(ID_VECTOR) - 1) == 0)
-		decode_channel(scope, data);
-	else if (strncmp(ID_BITMAP, (char *) data, sizeof(ID_BITMAP) - 1) == 0) {
-		decode_bitmap(scope, data);
-	} else
+	if (scope->file_length < FILE_HEADER_SIZE)
 		return (false);
 
-	return (true);
+	if (strncmp(ID_VECTOR, (const char *) data, sizeof(ID_VECTOR) - 1) == 0)
+		return (decode_channel(scope, data));
+	else if (strncmp(ID_BITMAP, (const char *) data, sizeof(ID_BITMAP) - 1)
+			== 0)
+		return (decode_bitmap(scope, data));
+
+	return (false);
 }
 
-// Open an Owon USB PDS device
-int open_device(OWON_SCOPE_T *scope, const unsigned index) {
+// Get the payload length from a capture header
+uint32_t header_file_length(const unsigned char *header) {
 
-	libusb_device **devices;
-	libusb_device *device = NULL;
-	struct libusb_device_descriptor descriptor;
-	int error_code = -1;
-	ssize_t total;
-	int i;
+	uint32_t fileLength = data_to_uint(&header[FILE_SIZE], 3);
+	if (header[FILE_TYPE] == 1)
+		fileLength += BITMAP_HEADER_SIZE;
+
+	return (fileLength);
+}
+
+// Find the samples of each channel in a raw vector capture, as
+// decode_channel() walks the blocks
+// Returns the number of channels, 0 for other captures
+unsigned find_samples(const unsigned char *raw, const size_t length,
+		uint32_t *offsets, uint32_t *samples) {
+
+	const unsigned char *data = raw + OWON_HEADER_SIZE;
+	const unsigned char *current, *end;
 	unsigned count = 0;
 
-	// Get devices
-	total = libusb_get_device_list(scope->context, &devices);
-	for (i = 0; i < total; i++) {
-		libusb_get_device_descriptor(devices[i], &descriptor);
+	if (length < OWON_HEADER_SIZE + FILE_HEADER_SIZE
+			|| length - OWON_HEADER_SIZE < header_file_length(raw)
+			|| strncmp(ID_VECTOR, (const char *) data, sizeof(ID_VECTOR) - 1)
+					!= 0
+			|| (data[SCOPE_TYPE] != 'V' && data[SCOPE_TYPE] != 'W'
+					&& data[SCOPE_TYPE] != 'X'))
+		return (0);
 
-		// Filter by id
-		if (descriptor.idVendor == USB_VID && descriptor.idProduct == USB_PID)
-			count++;
+	current = data + FILE_HEADER_SIZE;
+	end = data + header_file_length(raw);
+	while (current < end && count < OWON_MAX_CHANNELS) {
+		uint32_t block_size;
 
-		if (index == count - 1) {
-			device = devices[i];
+		if ((size_t) (end - current) < CHANNEL_HEADER_SIZE)
 			break;
-		}
+		block_size = data_to_uint(&current[CH_BLOCK_LEN], 4);
+		samples[count] = data_to_uint(&current[CH_SAMPLE_LEN], 4);
+		if ((size_t) (end - current) < CHANNEL_HEADER_SIZE
+				+ (size_t) samples[count] * 2)
+			break;
+		offsets[count] = (uint32_t) (current + CHANNEL_HEADER_SIZE - raw);
+		count++;
+
+		// Samples of the next block must follow these
+		if ((size_t) (end - current)
+				< (size_t) block_size + OWON_CHANNEL_NAME_LEN
+				|| (size_t) block_size + OWON_CHANNEL_NAME_LEN
+						< CHANNEL_HEADER_SIZE + (size_t) samples[count - 1] * 2)
+			break;
+		current += block_size + OWON_CHANNEL_NAME_LEN;
 	}
 
-	if (device) {
-		// Open the device
-		error_code = libusb_open(device, &scope->handle);
-		if (error_code == LIBUSB_SUCCESS)
-			error_code = libusb_set_configuration(scope->handle, USB_CONFIG);
-		if (error_code == LIBUSB_SUCCESS)
-			error_code = libusb_claim_interface(scope->handle,
-			USB_INTERFACE);
-		if (error_code == LIBUSB_SUCCESS) {
-			libusb_get_string_descriptor_ascii(scope->handle, 1,
-					scope->manufacturer, OWON_DESC_NAME_LEN);
-			libusb_get_string_descriptor_ascii(scope->handle, 2, scope->product,
-			OWON_DESC_NAME_LEN);
-		}
-	} else
-		error_code = LIBUSB_ERROR_NO_DEVICE;
+	return (count);
+}
+
+// Decode a raw capture as it arrives, called with the bytes received so
+// far and finally with the whole capture
+// Vector captures are decoded a channel block at a time, others once
+// complete
+int decode_partial(OWON_SCOPE_T *scope, DECODER_T *decoder,
+		const unsigned char *buffer, const size_t received, const bool final) {
+
+	const unsigned char *data = buffer + OWON_HEADER_SIZE;
+	uint32_t fileLength;
+	size_t available;
+
+	if (received < OWON_HEADER_SIZE) {
+		if (!final)
+			return (0);
+		error("Truncated header");
+		return (OWON_ERROR_FORMAT);
+	}
+
+	fileLength = header_file_length(buffer);
+	available = received - OWON_HEADER_SIZE;
+	if (available >= fileLength)
+		available = fileLength;
+	else if (final) {
+		scope->channel_count = 0;
+		error("Truncated capture");
+		return (OWON_ERROR_FORMAT);
+	}
+
+	bool vector = decoder->vector
+			|| (available >= FILE_HEADER_SIZE
+					&& strncmp(ID_VECTOR, (const char *) data,
+							sizeof(ID_VECTOR) - 1) == 0);
+	if (!final && !vector)
+		return (0);
+
+	// Decode time excludes the scaling, allocation and measuring within it
+	uint64_t start = stats_time(scope);
+	uint64_t nested = scope->stats.last[OWON_STAGE_SCALE]
+			+ scope->stats.last[OWON_STAGE_ALLOC]
+			+ scope->stats.last[OWON_STAGE_MEASURE];
+	bool decoded;
+
+	scope->file_length = fileLength;
+	if (vector)
+		decoded = (decoder->vector || begin_channels(scope, decoder, data))
+				&& decode_blocks(scope, decoder, data, (uint32_t) available);
+	else
+		decoded = decode_file(scope, data);
+	if (start) {
+		nested = scope->stats.last[OWON_STAGE_SCALE]
+				+ scope->stats.last[OWON_STAGE_ALLOC]
+				+ scope->stats.last[OWON_STAGE_MEASURE] - nested;
+		stats_add(scope, OWON_STAGE_DECODE, owon_time() - start - nested);
+	}
+	if (!decoded) {
+		scope->channel_count = 0;
+		error("Unknown format");
+		return (OWON_ERROR_FORMAT);
+	}
+
+	return (0);
+}
+
+// Decode a raw capture, a header followed by the payload
+int decode_raw(OWON_SCOPE_T *scope, const unsigned char *buffer,
+		const size_t length) {
+
+	DECODER_T decoder;
+
+	memset(&decoder, 0, sizeof(decoder));
+
+	return (decode_partial(scope, &decoder, buffer, length, true));
+}
+
+// Clear decoded data, keeping the buffers for the next capture
+void clear_decoded(OWON_SCOPE_T *scope) {
+
+	scope->channel_count = 0;
+	scope->bitmap = NULL;
+	scope->bitmap_width = 0;
+	scope->bitmap_height = 0;
+	scope->bitmap_channels = 0;
+	dedup_clear(scope);
+}
+
+// Scope opened, over USB or a link
+bool is_open(const OWON_SCOPE_T *scope) {
+
+	return (scope->handle || scope->link);
+}
+
+// Bulk transfer to or from the scope, as libusb_bulk_transfer()
+int transfer(OWON_SCOPE_T *scope, const unsigned char endpoint,
+		unsigned char *data, const int length, int *transferred,
+		const unsigned timeout) {
+
+	if (scope->link)
+		return (scope->link->transfer(scope->link, endpoint, data, length,
+				transferred, timeout));
+
+	return (libusb_bulk_transfer(scope->handle, endpoint, data, length,
+			transferred, timeout));
+}
+
+// Request a capture and read the header followed by the payload
+static int request_capture(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture,
+		DEDUP_T *dedup) {
+
+	int errorCode;
+	int transferred = 0;
+	unsigned char header[OWON_HEADER_SIZE];
+
+	if (!is_open(scope))
+		return (LIBUSB_ERROR_NO_DEVICE);
+
+	// Send start command
+	stats_begin(scope);
+	capture->timestamp = owon_time();
+	uint64_t start = stats_time(scope);
+	errorCode = transfer(scope, WRITE_ENDPOINT, (unsigned char *) CMD_START,
+			sizeof(CMD_START), &transferred, TIMEOUT);
+	stats_stage(scope, OWON_STAGE_START, start);
+	stats_transfer(scope, errorCode, transferred);
+	if (errorCode != LIBUSB_SUCCESS)
+		return (errorCode);
+
+	// Get header
+	start = stats_time(scope);
+	errorCode = transfer(scope, READ_ENDPOINT, header, sizeof(header),
+			&transferred, TIMEOUT);
+	stats_stage(scope, OWON_STAGE_HEADER, start);
+	stats_transfer(scope, errorCode, transferred);
+	if (errorCode != LIBUSB_SUCCESS)
+		return (errorCode);
+
+	uint32_t fileLength = header_file_length(header);
+
+	// Get data
+	start = stats_time(scope);
+	capture->raw_length = 0;
+	capture->raw = reserve(capture->raw, &capture->raw_size,
+			OWON_HEADER_SIZE + (size_t) fileLength);
+	stats_stage(scope, OWON_STAGE_ALLOC, start);
+	if (!capture->raw) {
+		error("Failed to allocate transfer memory");
+		return (LIBUSB_ERROR_NO_MEM);
+	}
+	memcpy(capture->raw, header, OWON_HEADER_SIZE);
+
+	return (read_payload(scope, capture, dedup, fileLength));
+}
+
+// Read a raw capture into capture, decoding the payload as it arrives
+int read_capture(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture) {
+
+	DEDUP_T dedup;
+	int errorCode;
+
+	// Captures are checked against the last read from the scope, and keep
+	// its channels if it was decoded into the same struct
+	dedup_begin(scope, capture, &dedup);
+	clear_decoded(capture);
+
+	errorCode = request_capture(scope, capture, &dedup);
+	dedup_end(capture, &dedup, errorCode == LIBUSB_SUCCESS);
+	if (errorCode == LIBUSB_SUCCESS)
+		capture->sequence = ++scope->sequence;
+
+	return (errorCode);
+}
+
+// Open and claim a device, kept in scope->device for owon_reconnect()
+int open_handle(OWON_SCOPE_T *scope, libusb_device *device) {
+
+	int config = 0;
+	int error_code;
+
+	libusb_ref_device(device);
+	if (scope->device)
+		libusb_unref_device(scope->device);
+	scope->device = device;
+	scope->bus = libusb_get_bus_number(device);
+	scope->port = libusb_get_port_number(device);
+
+	error_code = libusb_open(device, &scope->handle);
+	// Setting the configuration resets the device, skip if already active
+	if (error_code == LIBUSB_SUCCESS
+			&& (libusb_get_configuration(scope->handle, &config)
+					!= LIBUSB_SUCCESS || config != USB_CONFIG))
+		error_code = libusb_set_configuration(scope->handle, USB_CONFIG);
+	if (error_code == LIBUSB_SUCCESS)
+		error_code = libusb_claim_interface(scope->handle,
+		USB_INTERFACE);
 
 	return (error_code);
 }
 
+// Read the manufacturer, product and serial number (empty if none)
+void describe_handle(libusb_device_handle *handle,
+		unsigned char *manufacturer, unsigned char *product,
+		unsigned char *serial) {
+
+	struct libusb_device_descriptor descriptor;
+
+	libusb_get_string_descriptor_ascii(handle, 1, manufacturer,
+	OWON_DESC_NAME_LEN);
+	libusb_get_string_descriptor_ascii(handle, 2, product,
+	OWON_DESC_NAME_LEN);
+	serial[0] = '\0';
+	if (libusb_get_device_descriptor(libusb_get_device(handle), &descriptor)
+			== LIBUSB_SUCCESS && descriptor.iSerialNumber
+			&& libusb_get_string_descriptor_ascii(handle,
+					descriptor.iSerialNumber, serial, OWON_DESC_NAME_LEN) < 0)
+		serial[0] = '\0';
+}
+
+// Release and close the handle, keeping the device
+void release_handle(OWON_SCOPE_T *scope) {
+
+	if (scope->handle) {
+		libusb_release_interface(scope->handle, USB_INTERFACE);
+		libusb_close(scope->handle);
+		scope->handle = NULL;
+	}
+}
+
+// Release and close the device, leaving the context
+void close_device(OWON_SCOPE_T *scope) {
+
+	owon_stop_streaming(scope);
+	owon_unmap_bin(scope);
+	owon_free(scope);
+	release_handle(scope);
+	if (scope->device) {
+		libusb_unref_device(scope->device);
+		scope->device = NULL;
+	}
+	if (scope->link) {
+		scope->link->close(scope->link);
+		scope->link = NULL;
+	}
+}
+
 /**
  * Get the library version string
  *
@@ -288,7 +680,8 @@ LIBOWONPDS_EXPORT char *owon_version(){
 /**
  * Open communications with the scope
  *
- * Must be called before reading the scope
+ * Must be called before reading the scope, see owon_open_select() to
+ * choose a scope by its USB port or serial number.
  *
  * @param scope		Scope struct to be initialised
  * @param index		Device index
@@ -299,75 +692,119 @@ LIBOWONPDS_EXPORT char *owon_version(){
  */
 LIBOWONPDS_EXPORT int owon_open(OWON_SCOPE_T *scope, const unsigned index) {
 
-	int errorCode;
-
-	memset(scope, 0, sizeof(OWON_SCOPE_T));
+	OWON_SELECT_T select;
 
-	errorCode = libusb_init(&scope->context);
+	memset(&select, 0, sizeof(OWON_SELECT_T));
+	select.index = index;
 
-	if (errorCode == LIBUSB_SUCCESS)
-		errorCode = open_device(scope, index);
-
-	return (errorCode);
+	return (owon_open_select(scope, &select));
 }
 
 /**
  * Capture data from the device
  *
+ * The raw capture is kept in scope->raw and can be saved with
+ * owon_write_raw() for later replay through owon_decode_buffer().\n
+ * Buffers from the previous capture are reused, growing as needed,
+ * so repeated reads do not allocate once warmed up.
+ *
  * @param scope 	Initialised scope struct to read data to
  * @return
  * 				- 0 Success
+ * 				- >0 OWON_ERROR error
  * 				- <0 libusb error
  *
  */
 LIBOWONPDS_EXPORT int owon_read(OWON_SCOPE_T *scope) {
 
-	int errorCode = LIBUSB_SUCCESS;
-	int transferred = 0;
+	int errorCode;
 
-	owon_free(scope);
+	errorCode = read_capture(scope, scope);
+	if (errorCode == LIBUSB_SUCCESS)
+		stats_capture(scope, scope->timestamp);
 
-	if (scope->handle) {
-		// Send start command
-		errorCode = libusb_bulk_transfer(scope->handle, WRITE_ENDPOINT,
-				(unsigned char *) CMD_START, sizeof(CMD_START), &transferred,
-				TIMEOUT);
-		if (errorCode == LIBUSB_SUCCESS) {
-			// Get header
-			unsigned char header[HEADER_SIZE];
-			errorCode = libusb_bulk_transfer(scope->handle, READ_ENDPOINT,
-					header, sizeof(header), &transferred, TIMEOUT);
-
-			uint32_t fileLength = data_to_uint(&header[FILE_SIZE], 3);
-			if (header[FILE_TYPE] == 1)
-				fileLength += BITMAP_HEADER_SIZE;
-
-			// Get data
-			unsigned char *data = malloc(fileLength);
-			if (data) {
-				errorCode = libusb_bulk_transfer(scope->handle,
-				READ_ENDPOINT, data, (int)fileLength, &transferred,
-				TIMEOUT);
-				if (errorCode == LIBUSB_SUCCESS) {
-					scope->file_length = fileLength;
-					if (!decode_file(scope, data)) {
-						errorCode = OWON_ERROR_FORMAT;
-						error("Unknown format");
-					}
-				}
-				free(data);
-			} else
-				error("Failed to allocate transfer memory");
+	return (errorCode);
+}
+
+/**
+ * Decode a raw capture without a device
+ *
+ * A raw capture is the 12 byte header sent by the scope followed by
+ * the payload, as kept in scope->raw by owon_read().\n
+ * Buffers from any previous capture are reused. Bitmap captures are
+ * copied to scope->raw, the bitmap refers to it.
+ *
+ * @param scope 	Zero initialised or opened scope struct to decode to
+ * @param buffer	Raw capture
+ * @param length	Length of buffer
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_decode_buffer(OWON_SCOPE_T *scope,
+		const uint8_t *buffer, const size_t length) {
+
+	clear_decoded(scope);
+	stats_begin(scope);
+
+	// The bitmap is used in place, keep it with the scope
+	if (buffer != scope->raw && length > FILE_TYPE && buffer[FILE_TYPE] == 1) {
+		if (length > UINT32_MAX)
+			return (OWON_ERROR_FORMAT);
+		scope->raw_length = 0;
+		scope->raw = reserve(scope->raw, &scope->raw_size, length);
+		if (!scope->raw) {
+			error("Failed to allocate bitmap memory");
+			return (LIBUSB_ERROR_NO_MEM);
 		}
-	} else
-		errorCode = LIBUSB_ERROR_NO_DEVICE;
+		memcpy(scope->raw, buffer, length);
+		scope->raw_length = (uint32_t) length;
+		buffer = scope->raw;
+	}
 
-	return (errorCode);
+	return (decode_raw(scope, buffer, length));
+}
+
+/**
+ * Get the samples of a channel in volts
+ *
+ * Converts the samples on the first call after a capture made with
+ * OWON_OPT_RAW, otherwise returns the vector already converted.
+ *
+ * @param channel	Channel of a decoded capture
+ * @return Samples in volts, or NULL if out of memory
+ *
+ */
+LIBOWONPDS_EXPORT double *owon_get_vector(OWON_CHANNEL_T *channel) {
+
+	if (!channel->converted && channel->data)
+		scale_vector(channel);
+
+	return (channel->converted ? channel->vector : NULL);
+}
+
+/**
+ * Convert the samples of a channel to single precision volts
+ *
+ * @param channel	Channel of a decoded capture
+ * @param vector	Buffer of at least channel->samples floats
+ *
+ */
+LIBOWONPDS_EXPORT void owon_convert_float(const OWON_CHANNEL_T *channel,
+		float *vector) {
+
+	if (channel->data)
+		simd_kernels()->scale_float(vector, channel->data, channel->samples,
+				(float) channel->scale);
 }
 
 /**
  * Free capture data
  *
+ * Capture buffers are kept between reads, this releases them.
+ *
  * @param scope Scope struct to free captured data memory from
  *
  */
@@ -375,17 +812,25 @@ LIBOWONPDS_EXPORT void owon_free(OWON_SCOPE_T *scope) {
 
 	if (scope) {
 		unsigned i;
-		for (i = 0; i < scope->channel_count; i++) {
+		clear_decoded(scope);
+		for (i = 0; i < OWON_MAX_CHANNELS; i++) {
 			OWON_CHANNEL_T *channel;
 			channel = &scope->channel[i];
-			if (channel->vector) {
-				free(channel->vector);
-				channel->vector = NULL;
-			}
+			free(channel->vector);
+			channel->vector = NULL;
+			channel->vector_size = 0;
+			if (channel->data_size)
+				free(channel->data);
+			channel->data = NULL;
+			channel->data_size = 0;
+			channel->converted = false;
+			channel->measure.valid = false;
 		}
-		scope->channel_count = 0;
-		if (scope->bitmap)
-			free(scope->bitmap);
+		free(scope->raw);
+		scope->raw = NULL;
+		scope->raw_size = 0;
+		scope->raw_length = 0;
+		dedup_free(scope);
 	}
 }
 
@@ -398,12 +843,10 @@ LIBOWONPDS_EXPORT void owon_free(OWON_SCOPE_T *scope) {
 LIBOWONPDS_EXPORT void owon_close(OWON_SCOPE_T *scope) {
 
 	if (scope) {
-		owon_free(scope);
-		if (scope->handle) {
-			libusb_release_interface(scope->handle, USB_INTERFACE);
-			libusb_close(scope->handle);
+		close_device(scope);
+		if (scope->context) {
+			release_context(scope);
+			scope->context = NULL;
 		}
-		if (scope->context)
-			libusb_exit(scope->context);
 	}
 }
@@ -28,6 +28,8 @@
 #include "libowonpds_export.h"
 
 #include <libusb.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /*
@@ -55,6 +57,11 @@
  *		float32_t verticalStep?		47
  *		int16_t   data[]            51
  *
+ * Raw capture (owon_write_raw)
+ *		uint24_t  fileLength;       0
+ *		uint8_t   type;             8   (1 = bitmap, file has a further 54 bytes)
+ *		unsigned char payload[];    12
+ *
  */
 
 // Version from CMake
@@ -74,6 +81,7 @@
 
 // Fixed constants
 #define OWON_MAX_CHANNELS 	6 	/**< Maximum number of channels */
+#define OWON_MAX_DEVICES 	16 	/**< Maximum number of scopes in a group */
 
 #define OWON_DESC_NAME_LEN 50	/**< Maximum description length */
 #define OWON_SCOPE_NAME_LEN 6	/**< Maximum scope name length */
@@ -84,10 +92,59 @@
 #define OWON_BITMAP_DEPTH 8		/**< Bitmap depth (bits) */
 #define OWON_BITMAP_CHANNELS 3	/**< Colour channels */
 
+#define OWON_HEADER_SIZE 12		/**< Raw capture header size */
+
 
 // Error codes
 #define OWON_ERROR_FORMAT 1 /**< Data was in the wrong format */
 #define OWON_ERROR_PNG 2  	/**< Error creating PNG file */
+#define OWON_ERROR_END 3  	/**< No more captures */
+
+
+// Capture options
+#define OWON_OPT_RAW 0x01	/**< Keep samples as int16, convert to volts on request */
+#define OWON_OPT_STATS 0x02	/**< Collect timings and counters, see owon_get_stats() */
+#define OWON_OPT_MEASURE 0x04	/**< Measure each channel, see OWON_MEASURE_T */
+#define OWON_OPT_DEDUP 0x08	/**< Check captures for changes, keeping the channels of unchanged ones */
+
+
+// Capture stages timed with OWON_OPT_STATS
+#define OWON_STAGE_START 0		/**< START command write */
+#define OWON_STAGE_HEADER 1		/**< Header read */
+#define OWON_STAGE_PAYLOAD 2	/**< Payload read */
+#define OWON_STAGE_DECODE 3		/**< Decoding, less scaling and allocation */
+#define OWON_STAGE_SCALE 4		/**< Conversion to volts */
+#define OWON_STAGE_ALLOC 5		/**< Buffer allocation */
+#define OWON_STAGE_MEASURE 6	/**< Measurements (OWON_OPT_MEASURE) */
+#define OWON_STAGES 7			/**< Number of stages */
+
+#define OWON_HISTOGRAM_BINS 16	/**< Capture latency histogram bins */
+
+
+// Decimation pyramids
+#define OWON_PYRAMID_LEVELS 32	/**< Maximum pyramid levels */
+#define OWON_PYRAMID_MEAN 0x01	/**< Also keep sums for column means */
+
+
+// Spectrum windows
+#define OWON_WINDOW_RECT 0		/**< Rectangular (none) */
+#define OWON_WINDOW_HANN 1		/**< Hann */
+#define OWON_WINDOW_BLACKMAN 2	/**< Blackman */
+#define OWON_WINDOW_FLATTOP 3	/**< Flat top, for amplitudes */
+#define OWON_WINDOWS 4			/**< Number of windows */
+
+// Spectrum options
+#define OWON_SPECTRUM_AVERAGE 0x01	/**< Average with the previous spectra */
+#define OWON_SPECTRUM_PHASE 0x02	/**< Also find the phase */
+
+// Accumulated views
+#define OWON_ACCUM_MEAN 0		/**< Mean of the captures */
+#define OWON_ACCUM_AVERAGE 1	/**< Exponential average */
+#define OWON_ACCUM_MIN 2		/**< Minimum of each sample */
+#define OWON_ACCUM_MAX 3		/**< Maximum of each sample */
+#define OWON_ACCUM_PEAK 4		/**< Largest magnitude of each sample (peak hold) */
+#define OWON_ACCUM_VIEWS 5		/**< Number of views */
+#define OWON_ACCUM_ALPHA 0.0625	/**< Default weight of a capture in the exponential average */
 
 
 // Type of capture
@@ -95,6 +152,27 @@
 #define OWON_TYPE_BITMAP 1	/**< Bitmap */
 
 
+/**
+ * Channel measurements, see owon_measure()
+ *
+ * Edges are taken between 10% and 90% of the peak to peak level, with
+ * periods timed at 50%. Values that cannot be measured are NAN.
+ */
+typedef struct {
+	double min;								/**< Minimum level (v) */
+	double max;								/**< Maximum level (v) */
+	double vpp;								/**< Peak to peak level (v) */
+	double mean;							/**< Mean level (v) */
+	double rms;								/**< RMS level (v) */
+	double frequency;						/**< Frequency (Hz) */
+	double period;							/**< Mean period (s) */
+	double rise;							/**< Mean 10-90% rise time (s) */
+	double fall;							/**< Mean 90-10% fall time (s) */
+	double duty;							/**< Fraction of each period above 50% */
+	unsigned cycles;						/**< Complete periods measured */
+	bool valid;								/**< Measurements are of the current samples */
+} OWON_MEASURE_T;
+
 /**
  * Channel Data
  */
@@ -107,35 +185,228 @@ typedef struct {
 	double offset; 							/**< Offset (v) */
 	double sensitivity; 					/**< Sensitivity (v) */
 	unsigned int attenuation; 				/**< Attenuation factor */
-	double *vector; 						/**< Level (v) */
+	double *vector; 						/**< Level (v), see owon_get_vector() */
+	size_t vector_size;						/**< Allocated vector size (bytes) */
+	int16_t *data;							/**< Samples (host order) */
+	size_t data_size;						/**< Allocated samples size (bytes) */
+	double scale;							/**< Volts per sample step */
+	bool converted;							/**< Vector holds the samples in volts */
+	OWON_MEASURE_T measure;					/**< Measurements (OWON_OPT_MEASURE) */
 } OWON_CHANNEL_T;
 
+/**
+ * Capture timings and counters (OWON_OPT_STATS)
+ */
+typedef struct {
+	uint64_t last[OWON_STAGES];					/**< Time of each stage in the most recent capture (ns) */
+	uint64_t total[OWON_STAGES];				/**< Cumulative time of each stage (ns) */
+	uint64_t latency;							/**< Most recent capture, START to decoded (ns) */
+	uint64_t captures;							/**< Captures decoded */
+	uint64_t bytes;								/**< Bytes transferred */
+	uint64_t timeouts;							/**< Transfers timed out */
+	uint64_t errors;							/**< Other libusb errors */
+	uint64_t histogram[OWON_HISTOGRAM_BINS];	/**< Capture latencies, bin n < 2^n ms, the last bin holds the rest */
+} OWON_STATS_T;
+
+/**
+ * Simulated scope, see owon_open_sim()
+ *
+ * Faults are drawn for each capture: a timeout, a USB error or a
+ * truncated payload.
+ */
+typedef struct {
+	unsigned type;								/**< OWON_TYPE_VECTOR or OWON_TYPE_BITMAP */
+	char variant;								/**< Vector format, 'V', 'W' or 'X' */
+	unsigned channels;							/**< Channels, 1 to OWON_MAX_CHANNELS */
+	uint32_t samples;							/**< Samples of each channel */
+	unsigned latency;							/**< Time from START to the header (us) */
+	unsigned rate;								/**< Payload transfer rate (kB/s), 0 for unlimited */
+	double timeouts;							/**< Probability of a capture timing out */
+	double errors;								/**< Probability of a USB error */
+	double truncated;							/**< Probability of a truncated payload */
+	uint32_t seed;								/**< Random seed, different for each scope */
+} OWON_SIM_T;
+
+/** Initialiser for a simulated two channel scope, without delays or faults */
+#define OWON_SIM_DEFAULT { OWON_TYPE_VECTOR, 'V', 2, 10000, 0, 0, 0, 0, 0, 1 }
+
+/**
+ * Scope selection, see owon_open_select()
+ */
+typedef struct {
+	uint8_t bus;								/**< USB bus number, 0 for any */
+	uint8_t port;								/**< USB port number, 0 for any */
+	const char *serial;							/**< Serial number, NULL for any */
+	unsigned index;								/**< Index of the scopes matching */
+} OWON_SELECT_T;
+
 /**
  * Scope data
  */
 typedef struct {
 	unsigned char manufacturer[OWON_DESC_NAME_LEN + 1];	/**< Manufacturer */
 	unsigned char product[OWON_DESC_NAME_LEN + 1];		/**< Product */
+	unsigned char serial[OWON_DESC_NAME_LEN + 1];		/**< Serial number, empty if none */
+	uint8_t bus;										/**< USB bus number */
+	uint8_t port;										/**< USB port number */
 	char name[OWON_SCOPE_NAME_LEN + 1];					/**< Name */
 	unsigned type; 										/**< Capture type */
 	uint32_t file_length; 								/**< File length */
+	uint64_t timestamp;									/**< Capture time (ns, see owon_time()) */
+	uint64_t sequence;									/**< Captures read since opened, including this one */
+	uint32_t crc;										/**< CRC32C of the raw capture (OWON_OPT_DEDUP) */
+	bool unchanged;										/**< Same raw capture as the previous one read from the scope (OWON_OPT_DEDUP) */
 
 	unsigned channel_count; 							/**< Channels captured */
 	OWON_CHANNEL_T channel[OWON_MAX_CHANNELS]; 			/**< Channel data */
 	unsigned bitmap_width;								/**< Bitmap width */
 	unsigned bitmap_height;								/**< Bitmap height */
 	unsigned bitmap_channels;							/**< Bitmap colour channels */
-	unsigned char *bitmap; 								/**< Bitmap data */
+	const unsigned char *bitmap;						/**< Top row of the bitmap (BGR), held in raw */
+	int bitmap_stride;									/**< Bytes from one row to the next, negative if bottom-up */
+
+	unsigned char *raw; 								/**< Raw capture (header and payload) */
+	uint32_t raw_length; 								/**< Raw capture length */
+	size_t raw_size;									/**< Allocated raw capture size (bytes) */
+	void *map;											/**< Mapped capture file, see owon_map_bin() */
+	size_t map_length;									/**< Mapped capture file length */
+
+	unsigned options;									/**< Capture options (OWON_OPT_), set after owon_open() */
+	OWON_STATS_T stats;									/**< Timings and counters, see owon_get_stats() */
 
 	libusb_context *context; 							/**< libusb context */
 	libusb_device_handle *handle; 						/**< libusb handle */
+	libusb_device *device;								/**< libusb device, reopened by owon_reconnect() */
+	struct owon_link *link;								/**< Simulated scope, see owon_open_sim() */
+	struct owon_dedup *dedup;							/**< Checksums of the last capture (OWON_OPT_DEDUP) */
+	struct owon_stream *stream;							/**< Background acquisition */
 } OWON_SCOPE_T;
 
+/**
+ * Min/max decimation pyramid of a channel, see owon_pyramid_build()
+ */
+typedef struct {
+	uint32_t samples;							/**< Samples in the channel */
+	unsigned levels;							/**< Levels built */
+	uint32_t offset[OWON_PYRAMID_LEVELS];		/**< Start of each level in min and max */
+	uint32_t length[OWON_PYRAMID_LEVELS];		/**< Entries in each level */
+	int16_t *min;								/**< Minimum of each entry */
+	size_t min_size;							/**< Allocated minimum size (bytes) */
+	int16_t *max;								/**< Maximum of each entry */
+	size_t max_size;							/**< Allocated maximum size (bytes) */
+	int64_t *sum;								/**< Prefix sums of the samples (OWON_PYRAMID_MEAN) */
+	size_t sum_size;							/**< Allocated prefix sums size (bytes) */
+	const int16_t *data;						/**< Channel samples */
+	double sample_rate;							/**< Channel sample rate */
+	double scale;								/**< Volts per sample step */
+	unsigned flags;								/**< OWON_PYRAMID_ flags */
+} OWON_PYRAMID_T;
+
+/**
+ * Spectrum of a channel, see owon_spectrum()
+ */
+typedef struct {
+	uint32_t samples;							/**< Samples transformed */
+	uint32_t bins;								/**< Frequency bins, samples / 2 + 1 */
+	double resolution;							/**< Bin spacing (Hz) */
+	unsigned window;							/**< OWON_WINDOW_ */
+	unsigned averages;							/**< Spectra averaged */
+	double *magnitude;							/**< Peak amplitude of each bin (v), RMS of the averages */
+	size_t magnitude_size;						/**< Allocated magnitude size (bytes) */
+	double *phase;								/**< Phase of each bin in the last spectrum (rad), OWON_SPECTRUM_PHASE */
+	size_t phase_size;							/**< Allocated phase size (bytes) */
+	double *power;								/**< Sum of the squared amplitudes averaged */
+	size_t power_size;							/**< Allocated power size (bytes) */
+	double *work;								/**< Transform buffers */
+	size_t work_size;							/**< Allocated transform buffer size (bytes) */
+	struct owon_plan *plan;						/**< Cached transform plan */
+} OWON_SPECTRUM_T;
+
+/**
+ * Captures accumulated, see owon_accum_add()
+ */
+typedef struct {
+	unsigned count;								/**< Captures accumulated */
+	unsigned channel_count;						/**< Channels accumulated */
+	double alpha;								/**< Weight of each capture in the exponential average, 0 for OWON_ACCUM_ALPHA */
+	OWON_CHANNEL_T view[OWON_MAX_CHANNELS][OWON_ACCUM_VIEWS];	/**< Views of each channel, see owon_accum_view() */
+	struct owon_accum *sums[OWON_MAX_CHANNELS];	/**< Accumulated samples of each channel */
+} OWON_ACCUM_T;
+
+/**
+ * Group of scopes sharing a libusb context
+ */
+typedef struct {
+	libusb_context *context; 							/**< Shared libusb context */
+	unsigned count;										/**< Scopes opened */
+	OWON_SCOPE_T scope[OWON_MAX_DEVICES];				/**< Scopes */
+	int error[OWON_MAX_DEVICES];						/**< Result of the last read of each scope */
+	struct owon_group *workers;							/**< Capture threads */
+} OWON_GROUP_T;
+
+/**
+ * Capture callback
+ *
+ * @param scope		Scope struct holding the decoded capture
+ * @param context	User data
+ * @return Non-zero to stop capturing
+ */
+typedef int (*OWON_CALLBACK)(OWON_SCOPE_T *scope, void *context);
+
 LIBOWONPDS_EXPORT char *owon_version();
+LIBOWONPDS_EXPORT uint64_t owon_time(void);
 LIBOWONPDS_EXPORT int owon_open(OWON_SCOPE_T *scope, const unsigned index);
+LIBOWONPDS_EXPORT int owon_open_select(OWON_SCOPE_T *scope,
+		const OWON_SELECT_T *select);
+LIBOWONPDS_EXPORT int owon_reconnect(OWON_SCOPE_T *scope);
+LIBOWONPDS_EXPORT int owon_open_sim(OWON_SCOPE_T *scope,
+		const OWON_SIM_T *sim);
+LIBOWONPDS_EXPORT void owon_release_devices(void);
 LIBOWONPDS_EXPORT int owon_read(OWON_SCOPE_T *scope);
+LIBOWONPDS_EXPORT int owon_read_async(OWON_SCOPE_T *scope,
+		OWON_CALLBACK callback, void *context);
+LIBOWONPDS_EXPORT int owon_start_streaming(OWON_SCOPE_T *scope,
+		const unsigned ring_depth);
+LIBOWONPDS_EXPORT int owon_try_pop(OWON_SCOPE_T *scope,
+		OWON_SCOPE_T **capture);
+LIBOWONPDS_EXPORT int owon_pop(OWON_SCOPE_T *scope, OWON_SCOPE_T **capture,
+		const unsigned timeout);
+LIBOWONPDS_EXPORT int owon_stop_streaming(OWON_SCOPE_T *scope);
+LIBOWONPDS_EXPORT int owon_decode_buffer(OWON_SCOPE_T *scope,
+		const uint8_t *buffer, const size_t length);
+LIBOWONPDS_EXPORT double *owon_get_vector(OWON_CHANNEL_T *channel);
+LIBOWONPDS_EXPORT void owon_convert_float(const OWON_CHANNEL_T *channel,
+		float *vector);
+LIBOWONPDS_EXPORT int owon_measure(OWON_CHANNEL_T *channel);
+LIBOWONPDS_EXPORT void owon_get_stats(const OWON_SCOPE_T *scope,
+		OWON_STATS_T *stats);
+LIBOWONPDS_EXPORT void owon_reset_stats(OWON_SCOPE_T *scope);
 LIBOWONPDS_EXPORT void owon_free(OWON_SCOPE_T *scope);
 LIBOWONPDS_EXPORT void owon_close(OWON_SCOPE_T *scope);
+LIBOWONPDS_EXPORT int owon_pyramid_build(OWON_PYRAMID_T *pyramid,
+		const OWON_CHANNEL_T *channel, const unsigned flags);
+LIBOWONPDS_EXPORT int owon_pyramid_query(const OWON_PYRAMID_T *pyramid,
+		const double start, const double end, const unsigned columns,
+		double *min, double *max, double *mean);
+LIBOWONPDS_EXPORT void owon_pyramid_free(OWON_PYRAMID_T *pyramid);
+LIBOWONPDS_EXPORT int owon_spectrum(OWON_SPECTRUM_T *spectrum,
+		const OWON_CHANNEL_T *channel, const unsigned window,
+		const unsigned flags);
+LIBOWONPDS_EXPORT void owon_spectrum_free(OWON_SPECTRUM_T *spectrum);
+LIBOWONPDS_EXPORT int owon_accum_add(OWON_ACCUM_T *accum,
+		const OWON_SCOPE_T *scope);
+LIBOWONPDS_EXPORT OWON_CHANNEL_T *owon_accum_view(OWON_ACCUM_T *accum,
+		const unsigned channel, const unsigned view);
+LIBOWONPDS_EXPORT void owon_accum_reset(OWON_ACCUM_T *accum);
+LIBOWONPDS_EXPORT void owon_accum_free(OWON_ACCUM_T *accum);
+LIBOWONPDS_EXPORT size_t owon_pack_bound(const uint32_t count);
+LIBOWONPDS_EXPORT size_t owon_pack_samples(unsigned char *out,
+		const int16_t *samples, const uint32_t count);
+LIBOWONPDS_EXPORT int owon_unpack_samples(int16_t *samples,
+		const uint32_t count, const unsigned char *in, const size_t length);
+LIBOWONPDS_EXPORT int owon_open_all(OWON_GROUP_T *group);
+LIBOWONPDS_EXPORT int owon_read_all(OWON_GROUP_T *group);
+LIBOWONPDS_EXPORT void owon_close_all(OWON_GROUP_T *group);
 
 #endif /* LIBOWONPDS_H_ */
 
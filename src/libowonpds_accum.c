@@ -0,0 +1,289 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+/*
+ * Accumulated captures
+ *
+ * Each capture is added to the sums, exponential average and extremes of
+ * every sample in one vectorised pass, into buffers allocated when
+ * accumulation starts. The mean and average views are rounded to samples
+ * (and converted to volts exactly) when first viewed after a capture,
+ * the extremes are viewed in place.
+ *
+ */
+
+// Accumulated samples of a channel
+struct owon_accum {
+	uint32_t samples;
+	uint64_t added;					// Captures added, never restarted
+	uint64_t finished[2];			// Captures added when the mean and
+									// average views were finished
+	double *sum;
+	size_t sum_size;
+	double *average;
+	size_t average_size;
+	int16_t *extreme;				// Minimum, maximum and peak of each sample
+	size_t extreme_size;
+	int16_t *rounded;				// Mean and average samples
+	size_t rounded_size;
+};
+
+// Accumulation restarts when the capture settings change
+static bool same_settings(const OWON_ACCUM_T *accum,
+		const OWON_SCOPE_T *scope) {
+
+	unsigned i;
+
+	if (scope->channel_count != accum->channel_count)
+		return (false);
+
+	for (i = 0; i < scope->channel_count; i++) {
+		const OWON_CHANNEL_T *channel = &scope->channel[i];
+		const OWON_CHANNEL_T *view = &accum->view[i][OWON_ACCUM_MEAN];
+		if (channel->samples != view->samples
+				|| channel->scale != view->scale
+				|| channel->offset != view->offset
+				|| channel->timebase != view->timebase)
+			return (false);
+	}
+
+	return (true);
+}
+
+// Start accumulating a channel
+static bool start_channel(OWON_ACCUM_T *accum, const unsigned index,
+		const OWON_CHANNEL_T *channel) {
+
+	struct owon_accum *sums = accum->sums[index];
+	uint32_t samples = channel->samples;
+	unsigned i;
+
+	if (!sums) {
+		sums = calloc(1, sizeof(struct owon_accum));
+		if (!sums)
+			return (false);
+		accum->sums[index] = sums;
+	}
+
+	sums->sum = reserve(sums->sum, &sums->sum_size, sizeof(double) * samples);
+	sums->average = reserve(sums->average, &sums->average_size,
+			sizeof(double) * samples);
+	sums->extreme = reserve(sums->extreme, &sums->extreme_size,
+			sizeof(int16_t) * 3 * samples);
+	sums->rounded = reserve(sums->rounded, &sums->rounded_size,
+			sizeof(int16_t) * 2 * samples);
+	if (!sums->sum || !sums->average || !sums->extreme || !sums->rounded)
+		return (false);
+
+	sums->samples = samples;
+	memset(sums->sum, 0, sizeof(double) * samples);
+	memset(sums->average, 0, sizeof(double) * samples);
+	for (i = 0; i < samples; i++) {
+		sums->extreme[i] = INT16_MAX;
+		sums->extreme[samples + i] = INT16_MIN;
+	}
+	memset(sums->extreme + 2 * samples, 0, sizeof(int16_t) * samples);
+
+	// Views take the channel settings, the mean and average own no samples
+	for (i = 0; i < OWON_ACCUM_VIEWS; i++) {
+		OWON_CHANNEL_T *view = &accum->view[index][i];
+		memcpy(view->name, channel->name, sizeof(view->name));
+		view->samples = samples;
+		view->timebase = channel->timebase;
+		view->slow = channel->slow;
+		view->sample_rate = channel->sample_rate;
+		view->offset = channel->offset;
+		view->sensitivity = channel->sensitivity;
+		view->attenuation = channel->attenuation;
+		view->scale = channel->scale;
+		view->data_size = 0;
+	}
+	accum->view[index][OWON_ACCUM_MEAN].data = sums->rounded;
+	accum->view[index][OWON_ACCUM_AVERAGE].data = sums->rounded + samples;
+	accum->view[index][OWON_ACCUM_MIN].data = sums->extreme;
+	accum->view[index][OWON_ACCUM_MAX].data = sums->extreme + samples;
+	accum->view[index][OWON_ACCUM_PEAK].data = sums->extreme + 2 * samples;
+
+	return (true);
+}
+
+/**
+ * Add a capture to the accumulated captures
+ *
+ * The mean, exponential average, minimum, maximum and largest magnitude
+ * of every sample of each channel are updated in one vectorised pass.
+ * Buffers are allocated when accumulation starts, and reused.\n
+ * Accumulation restarts when the channels, samples, scale, offset or
+ * timebase change.
+ *
+ * @param accum		Zero initialised or previously used accumulator
+ * @param scope		Decoded vector capture
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_accum_add(OWON_ACCUM_T *accum,
+		const OWON_SCOPE_T *scope) {
+
+	ACCUMULATE_FN accumulate = simd_kernels()->accumulate;
+	double alpha = accum->alpha > 0 && accum->alpha <= 1 ?
+			accum->alpha : OWON_ACCUM_ALPHA;
+	unsigned i, j;
+
+	if (scope->type != OWON_TYPE_VECTOR || !scope->channel_count)
+		return (OWON_ERROR_FORMAT);
+	for (i = 0; i < scope->channel_count; i++)
+		if (!scope->channel[i].data)
+			return (OWON_ERROR_FORMAT);
+
+	if (accum->count && !same_settings(accum, scope))
+		accum->count = 0;
+	if (!accum->count) {
+		accum->channel_count = 0;
+		for (i = 0; i < scope->channel_count; i++) {
+			if (!start_channel(accum, i, &scope->channel[i])) {
+				error("Failed to allocate accumulator memory");
+				return (LIBUSB_ERROR_NO_MEM);
+			}
+		}
+		accum->channel_count = scope->channel_count;
+	}
+
+	for (i = 0; i < accum->channel_count; i++) {
+		struct owon_accum *sums = accum->sums[i];
+		uint32_t samples = sums->samples;
+
+		// The first capture sets the average
+		accumulate(sums->sum, sums->average, sums->extreme,
+				sums->extreme + samples, sums->extreme + 2 * samples,
+				scope->channel[i].data, samples, accum->count ? alpha : 1);
+		sums->added++;
+
+		for (j = 0; j < OWON_ACCUM_VIEWS; j++) {
+			accum->view[i][j].converted = false;
+			accum->view[i][j].measure.valid = false;
+		}
+	}
+	accum->count++;
+
+	return (0);
+}
+
+/**
+ * View the accumulated samples of a channel
+ *
+ * The view is a channel with the settings of the captures, its samples
+ * and volts can be used as those of a decoded channel until the next
+ * capture is added. Mean and average volts are exact, their samples
+ * rounded.
+ *
+ * @param accum		Accumulator
+ * @param channel	Channel index
+ * @param view		OWON_ACCUM_ view
+ * @return The view, or NULL if nothing is accumulated or out of memory
+ *
+ */
+LIBOWONPDS_EXPORT OWON_CHANNEL_T *owon_accum_view(OWON_ACCUM_T *accum,
+		const unsigned channel, const unsigned view) {
+
+	OWON_CHANNEL_T *result;
+	struct owon_accum *sums;
+	double factor;
+	uint32_t i;
+
+	if (!accum->count || channel >= accum->channel_count
+			|| view >= OWON_ACCUM_VIEWS)
+		return (NULL);
+
+	result = &accum->view[channel][view];
+	sums = accum->sums[channel];
+	if (view > OWON_ACCUM_AVERAGE || sums->finished[view] == sums->added)
+		return (result);
+
+	result->vector = reserve(result->vector, &result->vector_size,
+			sizeof(double) * sums->samples);
+	if (!result->vector) {
+		error("Failed to allocate vector memory");
+		return (NULL);
+	}
+
+	const double *values = view == OWON_ACCUM_MEAN ? sums->sum : sums->average;
+	factor = view == OWON_ACCUM_MEAN ? 1.0 / accum->count : 1.0;
+	for (i = 0; i < sums->samples; i++) {
+		double value = values[i] * factor;
+		result->vector[i] = value * result->scale;
+		result->data[i] = (int16_t) lrint(value);
+	}
+	result->converted = true;
+	sums->finished[view] = sums->added;
+
+	return (result);
+}
+
+/**
+ * Restart accumulating, keeping the buffers
+ *
+ * @param accum		Accumulator
+ *
+ */
+LIBOWONPDS_EXPORT void owon_accum_reset(OWON_ACCUM_T *accum) {
+
+	accum->count = 0;
+	accum->channel_count = 0;
+}
+
+/**
+ * Free the buffers of an accumulator
+ *
+ * @param accum		Accumulator to free
+ *
+ */
+LIBOWONPDS_EXPORT void owon_accum_free(OWON_ACCUM_T *accum) {
+
+	unsigned i, j;
+
+	for (i = 0; i < OWON_MAX_CHANNELS; i++) {
+		struct owon_accum *sums = accum->sums[i];
+		if (sums) {
+			free(sums->sum);
+			free(sums->average);
+			free(sums->extreme);
+			free(sums->rounded);
+			free(sums);
+		}
+		for (j = 0; j < OWON_ACCUM_VIEWS; j++)
+			free(accum->view[i][j].vector);
+	}
+	memset(accum, 0, sizeof(OWON_ACCUM_T));
+}
@@ -0,0 +1,1012 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <direct.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "libowonpds.h"
+#include "libowonpds_archive.h"
+#include "libowonpds_internal.h"
+
+/*
+ * Archive of raw captures
+ *
+ * A directory of numbered segments, each a data file (00000000.owa) and
+ * an index file (00000000.owi). Segments are only appended to, a new one
+ * is started when the current one reaches the segment size or the
+ * archive is reopened.
+ * Values are little endian.
+ *
+ * Segment header (both files)
+ *		unsigned char magic[4];     0	ARCHIVE_MAGIC_DATA or ARCHIVE_MAGIC_INDEX
+ *		uint16_t  version;          4
+ *		uint16_t  headerSize;       6
+ *		uint32_t  segment;          8
+ *		uint32_t  reserved;         12
+ *
+ * Data record
+ *		unsigned char magic[4];     0	ARCHIVE_MAGIC_RECORD
+ *		uint32_t  length;           4	Raw capture length
+ *		uint64_t  time;             8	Capture time (ns since 1970 UTC)
+ *		unsigned char raw[];        16	As written by owon_write_raw()
+ *
+ * Packed data record (OWON_ARCHIVE_PACK)
+ *		unsigned char magic[4];     0	ARCHIVE_MAGIC_PACKED
+ *		uint32_t  length;           4	Length of the following data
+ *		uint64_t  time;             8
+ *		uint32_t  rawLength;        16	Raw capture length
+ *		uint32_t  regions;          20	Channel sample regions
+ *		Region n (at 24 + n * 12)
+ *			uint32_t  offset;       0	Offset of the samples in the capture
+ *			uint32_t  samples;      4
+ *			uint32_t  packedLength; 8
+ *		The raw capture without the regions, then the samples of each
+ *		region packed with owon_pack_samples()
+ *
+ * Index entry, one per record in ascending time
+ *		uint64_t  time;             0
+ *		uint64_t  offset;           8	Offset of the data record
+ *
+ */
+#define ARCHIVE_MAGIC_DATA "OWNA"
+#define ARCHIVE_MAGIC_INDEX "OWNI"
+#define ARCHIVE_MAGIC_RECORD "OWNR"
+#define ARCHIVE_MAGIC_PACKED "OWNP"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 16
+#define ARCHIVE_RECORD_SIZE 16
+#define ARCHIVE_ENTRY_SIZE 16
+#define ARCHIVE_PACKED_SIZE 8
+#define ARCHIVE_REGION_SIZE 12
+#define ARCHIVE_EXT_DATA ".owa"
+#define ARCHIVE_EXT_INDEX ".owi"
+#define ARCHIVE_DIGITS 8			// Digits of segment numbers in file names
+#define ARCHIVE_NAME_MAX 16			// Longest file name, "4294967295.owa"
+#define ARCHIVE_BUFFER 1048576		// Write buffer of the data file (bytes)
+#define ARCHIVE_INDEX_BUFFER 16384	// Write buffer of the index file (bytes)
+
+#define ARCHIVE_FILE_VERSION 4
+#define ARCHIVE_FILE_HEADER_SIZE 6
+#define ARCHIVE_FILE_SEGMENT 8
+
+#define ARCHIVE_REC_LENGTH 4
+#define ARCHIVE_REC_TIME 8
+
+#define ARCHIVE_ENTRY_TIME 0
+#define ARCHIVE_ENTRY_OFFSET 8
+
+#define ARCHIVE_PACKED_RAW_LENGTH 0
+#define ARCHIVE_PACKED_REGIONS 4
+
+#define ARCHIVE_REGION_OFFSET 0
+#define ARCHIVE_REGION_SAMPLES 4
+#define ARCHIVE_REGION_LENGTH 8
+
+// Copy a string
+static char *copy_string(const char *string) {
+
+	size_t length = strlen(string) + 1;
+	char *copy = malloc(length);
+
+	if (copy)
+		memcpy(copy, string, length);
+
+	return (copy);
+}
+
+// Open a file of a segment
+static FILE *open_file(const char *directory, const unsigned segment,
+		const char *extension, const char *mode) {
+
+	char *path = malloc(strlen(directory) + ARCHIVE_NAME_MAX + 2);
+	FILE *file;
+
+	if (!path) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	sprintf(path, "%s/%0*u%s", directory, ARCHIVE_DIGITS, segment, extension);
+	file = fopen(path, mode);
+	free(path);
+
+	return (file);
+}
+
+// Write buffered data to the disk
+static int flush_file(FILE *file) {
+
+	errno = 0;
+	if (fflush(file) != 0)
+		return errno;
+#if defined(_WIN32)
+	if (_commit(_fileno(file)) != 0)
+		return errno;
+#else
+	if (fsync(fileno(file)) != 0)
+		return errno;
+#endif
+
+	return (0);
+}
+
+// Parse the segment number of a data file name
+static bool parse_name(const char *name, unsigned *segment) {
+
+	const char *end = name;
+	unsigned long value = 0;
+
+	while (*end >= '0' && *end <= '9') {
+		value = value * 10 + (unsigned long) (*end - '0');
+		if (value > UINT_MAX)
+			return (false);
+		end++;
+	}
+	if (end - name < ARCHIVE_DIGITS || strcmp(end, ARCHIVE_EXT_DATA) != 0)
+		return (false);
+
+	*segment = (unsigned) value;
+
+	return (true);
+}
+
+static int compare_segments(const void *a, const void *b) {
+
+	unsigned x = *(const unsigned *) a;
+	unsigned y = *(const unsigned *) b;
+
+	return ((x > y) - (x < y));
+}
+
+// Add a segment to a list
+static bool add_segment(unsigned **segments, unsigned *count,
+		unsigned *size, const unsigned segment) {
+
+	if (*count == *size) {
+		unsigned grown = *size ? *size * 2 : 16;
+		unsigned *list = realloc(*segments, sizeof(unsigned) * grown);
+		if (!list)
+			return (false);
+		*segments = list;
+		*size = grown;
+	}
+	(*segments)[(*count)++] = segment;
+
+	return (true);
+}
+
+// List the segments of an archive in ascending order
+static int scan_segments(const char *directory, unsigned **segments,
+		unsigned *count) {
+
+	unsigned *list = NULL;
+	unsigned length = 0;
+	unsigned size = 0;
+	unsigned segment;
+	bool added = true;
+
+#if defined(_WIN32)
+	WIN32_FIND_DATAA found;
+	HANDLE find;
+	char *pattern = malloc(strlen(directory) + 8);
+
+	if (!pattern)
+		return (ENOMEM);
+	sprintf(pattern, "%s/*%s", directory, ARCHIVE_EXT_DATA);
+	find = FindFirstFileA(pattern, &found);
+	free(pattern);
+	if (find != INVALID_HANDLE_VALUE) {
+		do {
+			if (parse_name(found.cFileName, &segment))
+				added = add_segment(&list, &length, &size, segment);
+		} while (added && FindNextFileA(find, &found));
+		FindClose(find);
+	}
+#else
+	DIR *dir;
+	struct dirent *entry;
+
+	errno = 0;
+	dir = opendir(directory);
+	if (!dir)
+		return errno;
+	while (added && (entry = readdir(dir)) != NULL) {
+		if (parse_name(entry->d_name, &segment))
+			added = add_segment(&list, &length, &size, segment);
+	}
+	closedir(dir);
+#endif
+
+	if (!added) {
+		free(list);
+		return (ENOMEM);
+	}
+
+	if (length)
+		qsort(list, length, sizeof(unsigned), compare_segments);
+	*segments = list;
+	*count = length;
+
+	return (0);
+}
+
+// Write a segment file header
+static int write_header(FILE *file, const char *magic,
+		const unsigned segment) {
+
+	unsigned char header[ARCHIVE_HEADER_SIZE];
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, magic, 4);
+	put_le(&header[ARCHIVE_FILE_VERSION], ARCHIVE_VERSION, 2);
+	put_le(&header[ARCHIVE_FILE_HEADER_SIZE], ARCHIVE_HEADER_SIZE, 2);
+	put_le(&header[ARCHIVE_FILE_SEGMENT], segment, 4);
+
+	errno = 0;
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+		return (errno ? errno : EIO);
+
+	return (0);
+}
+
+// Check a segment file header
+static int check_header(FILE *file, const char *magic) {
+
+	unsigned char header[ARCHIVE_HEADER_SIZE];
+
+	if (fread(header, 1, sizeof(header), file) != sizeof(header)
+			|| memcmp(header, magic, 4) != 0
+			|| get_le(&header[ARCHIVE_FILE_VERSION], 2) != ARCHIVE_VERSION
+			|| get_le(&header[ARCHIVE_FILE_HEADER_SIZE], 2)
+					!= ARCHIVE_HEADER_SIZE)
+		return (OWON_ERROR_FORMAT);
+
+	return (0);
+}
+
+// Free the write buffers of the segment files
+static void free_buffers(OWON_ARCHIVE_T *archive) {
+
+	free(archive->data_buffer);
+	free(archive->index_buffer);
+	archive->data_buffer = NULL;
+	archive->index_buffer = NULL;
+}
+
+// Start the current segment
+static int open_segment(OWON_ARCHIVE_T *archive) {
+
+	int error_code;
+
+	// Some C libraries ignore the size unless given the buffer
+	archive->data_buffer = malloc(ARCHIVE_BUFFER);
+	archive->index_buffer = malloc(ARCHIVE_INDEX_BUFFER);
+	if (!archive->data_buffer || !archive->index_buffer) {
+		free_buffers(archive);
+		return (ENOMEM);
+	}
+
+	errno = 0;
+	archive->data = open_file(archive->directory, archive->segment,
+			ARCHIVE_EXT_DATA, "wb");
+	if (!archive->data) {
+		error_code = errno;
+		free_buffers(archive);
+		return (error_code);
+	}
+	archive->index = open_file(archive->directory, archive->segment,
+			ARCHIVE_EXT_INDEX, "wb");
+	if (!archive->index) {
+		error_code = errno;
+		fclose(archive->data);
+		archive->data = NULL;
+		free_buffers(archive);
+		return (error_code);
+	}
+
+	setvbuf(archive->data, archive->data_buffer, _IOFBF, ARCHIVE_BUFFER);
+	setvbuf(archive->index, archive->index_buffer, _IOFBF,
+			ARCHIVE_INDEX_BUFFER);
+
+	error_code = write_header(archive->data, ARCHIVE_MAGIC_DATA,
+			archive->segment);
+	if (!error_code)
+		error_code = write_header(archive->index, ARCHIVE_MAGIC_INDEX,
+				archive->segment);
+	archive->length = ARCHIVE_HEADER_SIZE;
+
+	return (error_code);
+}
+
+// Sync and close the current segment
+static int close_segment(OWON_ARCHIVE_T *archive) {
+
+	int error_code;
+
+	if (!archive->data)
+		return (0);
+
+	error_code = owon_archive_sync(archive);
+	if (fclose(archive->data) != 0 && !error_code)
+		error_code = errno ? errno : EIO;
+	if (fclose(archive->index) != 0 && !error_code)
+		error_code = errno ? errno : EIO;
+	archive->data = NULL;
+	archive->index = NULL;
+	free_buffers(archive);
+
+	return (error_code);
+}
+
+/**
+ * Open an archive for recording
+ *
+ * The directory is created if needed. Recording starts a new segment
+ * after any already in the directory.
+ *
+ * @param archive		Archive structure
+ * @param directory		Archive directory
+ * @param segment_size	Segment length before starting another (bytes),
+ * 						0 for OWON_ARCHIVE_SEGMENT_DEFAULT
+ * @param sync			Captures written between fsyncs, 0 for
+ * 						OWON_ARCHIVE_SYNC_DEFAULT
+ * @param flags			OWON_ARCHIVE_ flags
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_archive_open(OWON_ARCHIVE_T *archive,
+		const char *directory, const uint64_t segment_size,
+		const unsigned sync, const unsigned flags) {
+
+	unsigned *segments = NULL;
+	unsigned count = 0;
+	int error_code;
+
+	memset(archive, 0, sizeof(OWON_ARCHIVE_T));
+
+	errno = 0;
+#if defined(_WIN32)
+	if (_mkdir(directory) != 0 && errno != EEXIST)
+		return errno;
+#else
+	if (mkdir(directory, 0777) != 0 && errno != EEXIST)
+		return errno;
+#endif
+
+	error_code = scan_segments(directory, &segments, &count);
+	if (error_code)
+		return (error_code);
+	archive->segment = count ? segments[count - 1] + 1 : 0;
+	free(segments);
+
+	archive->directory = copy_string(directory);
+	if (!archive->directory)
+		return (ENOMEM);
+	archive->segment_size =
+			segment_size ? segment_size : OWON_ARCHIVE_SEGMENT_DEFAULT;
+	archive->sync = sync ? sync : OWON_ARCHIVE_SYNC_DEFAULT;
+	archive->flags = flags;
+	archive->entries = malloc((size_t) archive->sync * ARCHIVE_ENTRY_SIZE);
+	if (!archive->entries) {
+		free(archive->directory);
+		archive->directory = NULL;
+		return (ENOMEM);
+	}
+
+	return (0);
+}
+
+// Pack the samples of a raw capture into archive->buffer
+// Returns the record data length, 0 if the capture has no samples
+static uint32_t pack_record(OWON_ARCHIVE_T *archive, const unsigned char *raw,
+		const uint32_t length) {
+
+	uint32_t offsets[OWON_MAX_CHANNELS];
+	uint32_t samples[OWON_MAX_CHANNELS];
+	unsigned count = find_samples(raw, length, offsets, samples);
+	size_t bound = ARCHIVE_PACKED_SIZE + count * ARCHIVE_REGION_SIZE + length;
+	uint32_t most = 0;
+	uint32_t position = 0;
+	unsigned char *out;
+	unsigned i;
+
+	if (!count)
+		return (0);
+
+	for (i = 0; i < count; i++) {
+		bound += owon_pack_bound(samples[i]);
+		most = samples[i] > most ? samples[i] : most;
+	}
+	archive->buffer = reserve(archive->buffer, &archive->buffer_size, bound);
+	archive->samples = reserve(archive->samples, &archive->samples_size,
+			sizeof(int16_t) * most);
+	if (!archive->buffer || !archive->samples)
+		return (0);
+
+	put_le(&archive->buffer[ARCHIVE_PACKED_RAW_LENGTH], length, 4);
+	put_le(&archive->buffer[ARCHIVE_PACKED_REGIONS], count, 4);
+	out = archive->buffer + ARCHIVE_PACKED_SIZE + count * ARCHIVE_REGION_SIZE;
+
+	// The capture around the samples
+	for (i = 0; i < count; i++) {
+		memcpy(out, raw + position, offsets[i] - position);
+		out += offsets[i] - position;
+		position = offsets[i] + samples[i] * (uint32_t) sizeof(int16_t);
+	}
+	memcpy(out, raw + position, length - position);
+	out += length - position;
+
+	for (i = 0; i < count; i++) {
+		unsigned char *region = archive->buffer + ARCHIVE_PACKED_SIZE
+				+ i * ARCHIVE_REGION_SIZE;
+		size_t packed;
+
+		copy_samples(archive->samples, raw + offsets[i], samples[i]);
+		packed = owon_pack_samples(out, archive->samples, samples[i]);
+		out += packed;
+
+		put_le(&region[ARCHIVE_REGION_OFFSET], offsets[i], 4);
+		put_le(&region[ARCHIVE_REGION_SAMPLES], samples[i], 4);
+		put_le(&region[ARCHIVE_REGION_LENGTH], packed, 4);
+	}
+
+	return ((uint32_t) (out - archive->buffer));
+}
+
+/**
+ * Append the raw capture to an archive
+ *
+ * Writes are buffered and synced to the disk every archive->sync
+ * captures, captures are indexed (and found by readers) once synced. With OWON_ARCHIVE_PACK the samples of vector captures are
+ * packed losslessly, see owon_pack_samples().
+ *
+ * @param archive	Archive opened with owon_archive_open()
+ * @param scope		Scope structure holding a raw capture
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_archive_write(OWON_ARCHIVE_T *archive,
+		const OWON_SCOPE_T *scope) {
+
+	if (!scope->raw || scope->raw_length < OWON_HEADER_SIZE)
+		return (OWON_ERROR_FORMAT);
+
+	unsigned char record[ARCHIVE_RECORD_SIZE];
+	unsigned char *entry;
+	const unsigned char *data = scope->raw;
+	uint32_t data_length = scope->raw_length;
+	uint32_t packed = 0;
+	uint64_t time = wall_time();
+	uint64_t length;
+	uint64_t age;
+	int error_code;
+
+	// Convert the monotonic capture time, keeping the index in order
+	if (scope->timestamp) {
+		age = owon_time() - scope->timestamp;
+		if (age < time)
+			time -= age;
+	}
+	if (time < archive->time)
+		time = archive->time;
+
+	if (archive->flags & OWON_ARCHIVE_PACK)
+		packed = pack_record(archive, scope->raw, scope->raw_length);
+	if (packed) {
+		data = archive->buffer;
+		data_length = packed;
+	}
+	length = ARCHIVE_RECORD_SIZE + (uint64_t) data_length;
+
+	if (archive->data && archive->length > ARCHIVE_HEADER_SIZE
+			&& archive->length + length > archive->segment_size) {
+		error_code = close_segment(archive);
+		archive->segment++;
+		if (error_code)
+			return (error_code);
+	}
+	if (!archive->data) {
+		error_code = open_segment(archive);
+		if (error_code)
+			return (error_code);
+	}
+
+	memcpy(record, packed ? ARCHIVE_MAGIC_PACKED : ARCHIVE_MAGIC_RECORD, 4);
+	put_le(&record[ARCHIVE_REC_LENGTH], data_length, 4);
+	put_le(&record[ARCHIVE_REC_TIME], time, 8);
+
+	errno = 0;
+	if (fwrite(record, 1, sizeof(record), archive->data) != sizeof(record)
+			|| fwrite(data, 1, data_length, archive->data) != data_length)
+		return (errno ? errno : EIO);
+
+	// Indexed by owon_archive_sync() once the record is on the disk
+	entry = &archive->entries[archive->pending * ARCHIVE_ENTRY_SIZE];
+	put_le(&entry[ARCHIVE_ENTRY_TIME], time, 8);
+	put_le(&entry[ARCHIVE_ENTRY_OFFSET], archive->length, 8);
+
+	archive->length += length;
+	archive->time = time;
+
+	if (++archive->pending >= archive->sync)
+		return (owon_archive_sync(archive));
+
+	return (0);
+}
+
+/**
+ * Write buffered captures to the disk
+ *
+ * The records are synced before their index entries are written, so an
+ * entry never refers to a partial record.
+ *
+ * @param archive	Archive opened with owon_archive_open()
+ *
+ * @return
+ * 			- 0 Success
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_archive_sync(OWON_ARCHIVE_T *archive) {
+
+	size_t length = (size_t) archive->pending * ARCHIVE_ENTRY_SIZE;
+	int error_code;
+
+	archive->pending = 0;
+	if (!archive->data)
+		return (0);
+
+	error_code = flush_file(archive->data);
+	if (!error_code && length) {
+		errno = 0;
+		if (fwrite(archive->entries, 1, length, archive->index) != length)
+			error_code = errno ? errno : EIO;
+	}
+	if (!error_code)
+		error_code = flush_file(archive->index);
+
+	return (error_code);
+}
+
+/**
+ * Sync and close an archive being recorded
+ *
+ * @param archive	Archive opened with owon_archive_open()
+ *
+ * @return
+ * 			- 0 Success
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_archive_close(OWON_ARCHIVE_T *archive) {
+
+	int error_code = close_segment(archive);
+
+	free(archive->directory);
+	free(archive->entries);
+	free(archive->buffer);
+	free(archive->samples);
+	memset(archive, 0, sizeof(OWON_ARCHIVE_T));
+
+	return (error_code);
+}
+
+// Read an index entry
+static int read_entry(FILE *index, const uint64_t entry, uint64_t *time,
+		uint64_t *offset) {
+
+	unsigned char data[ARCHIVE_ENTRY_SIZE];
+
+	if (fseek(index, (long) (ARCHIVE_HEADER_SIZE + entry * ARCHIVE_ENTRY_SIZE),
+	SEEK_SET) != 0 || fread(data, 1, sizeof(data), index) != sizeof(data))
+		return (OWON_ERROR_FORMAT);
+
+	*time = get_le(&data[ARCHIVE_ENTRY_TIME], 8);
+	if (offset)
+		*offset = get_le(&data[ARCHIVE_ENTRY_OFFSET], 8);
+
+	return (0);
+}
+
+// Number of complete entries in an index
+static uint64_t count_entries(FILE *index) {
+
+	long length;
+
+	if (fseek(index, 0, SEEK_END) != 0)
+		return (0);
+	length = ftell(index);
+	if (length < ARCHIVE_HEADER_SIZE)
+		return (0);
+
+	return ((uint64_t) (length - ARCHIVE_HEADER_SIZE) / ARCHIVE_ENTRY_SIZE);
+}
+
+// Time of the first capture in a segment
+static int first_time(const char *directory, const unsigned segment,
+		uint64_t *time) {
+
+	FILE *index;
+	int error_code;
+
+	errno = 0;
+	index = open_file(directory, segment, ARCHIVE_EXT_INDEX, "rb");
+	if (!index)
+		return errno;
+
+	error_code = check_header(index, ARCHIVE_MAGIC_INDEX);
+	if (!error_code && read_entry(index, 0, time, NULL) != 0)
+		error_code = OWON_ERROR_END;
+	fclose(index);
+
+	return (error_code);
+}
+
+// Close the files of the current segment
+static void close_reader(OWON_ARCHIVE_READER_T *reader) {
+
+	if (reader->data)
+		fclose(reader->data);
+	if (reader->index)
+		fclose(reader->index);
+	reader->data = NULL;
+	reader->index = NULL;
+}
+
+// Open a segment for reading
+static int open_reader(OWON_ARCHIVE_READER_T *reader,
+		const unsigned position) {
+
+	unsigned segment = reader->segments[position];
+	int error_code;
+
+	close_reader(reader);
+
+	errno = 0;
+	reader->data = open_file(reader->directory, segment, ARCHIVE_EXT_DATA,
+			"rb");
+	if (!reader->data)
+		return errno;
+	reader->index = open_file(reader->directory, segment, ARCHIVE_EXT_INDEX,
+			"rb");
+	if (!reader->index) {
+		error_code = errno;
+		close_reader(reader);
+		return (error_code);
+	}
+
+	error_code = check_header(reader->data, ARCHIVE_MAGIC_DATA);
+	if (!error_code)
+		error_code = check_header(reader->index, ARCHIVE_MAGIC_INDEX);
+	if (error_code) {
+		close_reader(reader);
+		return (error_code);
+	}
+
+	reader->position = position;
+	reader->entry = 0;
+	reader->entries = count_entries(reader->index);
+
+	return (0);
+}
+
+// Look for segments started since the archive was opened
+static int rescan_reader(OWON_ARCHIVE_READER_T *reader) {
+
+	unsigned current = reader->segments[reader->position];
+	unsigned *segments;
+	unsigned count;
+	unsigned i;
+	int error_code;
+
+	error_code = scan_segments(reader->directory, &segments, &count);
+	if (error_code)
+		return (error_code);
+
+	free(reader->segments);
+	reader->segments = segments;
+	reader->count = count;
+	reader->position = count;
+	for (i = 0; i < count; i++) {
+		if (segments[i] == current) {
+			reader->position = i;
+			break;
+		}
+	}
+
+	return (reader->position < count ? 0 : OWON_ERROR_END);
+}
+
+/**
+ * Open an archive for reading from a time
+ *
+ * The segment and capture are found with binary searches of the
+ * indexes, captures are not scanned.\n
+ * Close the reader with owon_archive_finish(), also on failure.
+ *
+ * @param reader	Zero initialised or finished reader structure
+ * @param directory	Archive directory
+ * @param time		Time of the first capture to read (ns since 1970 UTC),
+ * 					0 for the start of the archive
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error, OWON_ERROR_END for an empty archive
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_archive_seek(OWON_ARCHIVE_READER_T *reader,
+		const char *directory, const uint64_t time) {
+
+	unsigned low, high, position = 0;
+	uint64_t begin, end, first;
+	int error_code;
+
+	memset(reader, 0, sizeof(OWON_ARCHIVE_READER_T));
+	reader->directory = copy_string(directory);
+	if (!reader->directory)
+		return (ENOMEM);
+
+	error_code = scan_segments(directory, &reader->segments, &reader->count);
+	if (error_code)
+		return (error_code);
+	if (!reader->count)
+		return (OWON_ERROR_END);
+
+	// Last segment starting at or before the time
+	low = 0;
+	high = reader->count;
+	while (low < high) {
+		unsigned middle = low + (high - low) / 2;
+		error_code = first_time(directory, reader->segments[middle], &first);
+		if (error_code && error_code != OWON_ERROR_END)
+			return (error_code);
+		if (!error_code && first <= time) {
+			position = middle;
+			low = middle + 1;
+		} else
+			high = middle;
+	}
+
+	error_code = open_reader(reader, position);
+	if (error_code)
+		return (error_code);
+
+	// First capture at or after the time
+	begin = 0;
+	end = reader->entries;
+	while (begin < end) {
+		uint64_t middle = begin + (end - begin) / 2;
+		error_code = read_entry(reader->index, middle, &first, NULL);
+		if (error_code)
+			return (error_code);
+		if (first < time)
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+	reader->entry = begin;
+
+	return (0);
+}
+
+// Restore the raw capture of a packed record into scope->raw
+static int unpack_record(OWON_ARCHIVE_READER_T *reader, OWON_SCOPE_T *scope,
+		const unsigned char *data, const uint32_t data_length) {
+
+	uint32_t length, count, position = 0;
+	size_t header, skipped = 0, packed = 0;
+	const unsigned char *in;
+	unsigned char *raw;
+	unsigned i;
+
+	if (data_length < ARCHIVE_PACKED_SIZE)
+		return (OWON_ERROR_FORMAT);
+	length = (uint32_t) get_le(&data[ARCHIVE_PACKED_RAW_LENGTH], 4);
+	count = (uint32_t) get_le(&data[ARCHIVE_PACKED_REGIONS], 4);
+	header = ARCHIVE_PACKED_SIZE + (size_t) count * ARCHIVE_REGION_SIZE;
+	if (count > OWON_MAX_CHANNELS || length < OWON_HEADER_SIZE
+			|| data_length < header)
+		return (OWON_ERROR_FORMAT);
+
+	// Regions in order within the capture, and the data all accounted for
+	for (i = 0; i < count; i++) {
+		const unsigned char *region = data + ARCHIVE_PACKED_SIZE
+				+ i * ARCHIVE_REGION_SIZE;
+		uint64_t offset = get_le(&region[ARCHIVE_REGION_OFFSET], 4);
+		uint64_t end = offset
+				+ get_le(&region[ARCHIVE_REGION_SAMPLES], 4) * sizeof(int16_t);
+
+		if (offset < position || end > length)
+			return (OWON_ERROR_FORMAT);
+		skipped += (size_t) (end - offset);
+		packed += (size_t) get_le(&region[ARCHIVE_REGION_LENGTH], 4);
+		position = (uint32_t) end;
+	}
+	if ((uint64_t) header + (length - skipped) + packed != data_length)
+		return (OWON_ERROR_FORMAT);
+
+	scope->raw = reserve(scope->raw, &scope->raw_size, length);
+	if (!scope->raw)
+		return (ENOMEM);
+	raw = scope->raw;
+
+	in = data + header;
+	position = 0;
+	for (i = 0; i < count; i++) {
+		const unsigned char *region = data + ARCHIVE_PACKED_SIZE
+				+ i * ARCHIVE_REGION_SIZE;
+		uint32_t offset = (uint32_t) get_le(&region[ARCHIVE_REGION_OFFSET], 4);
+		memcpy(raw + position, in, offset - position);
+		in += offset - position;
+		position = offset + (uint32_t) get_le(&region[ARCHIVE_REGION_SAMPLES],
+				4) * (uint32_t) sizeof(int16_t);
+	}
+	memcpy(raw + position, in, length - position);
+	in += length - position;
+
+	for (i = 0; i < count; i++) {
+		const unsigned char *region = data + ARCHIVE_PACKED_SIZE
+				+ i * ARCHIVE_REGION_SIZE;
+		uint32_t offset = (uint32_t) get_le(&region[ARCHIVE_REGION_OFFSET], 4);
+		uint32_t samples = (uint32_t) get_le(&region[ARCHIVE_REGION_SAMPLES], 4);
+		size_t bytes = (size_t) get_le(&region[ARCHIVE_REGION_LENGTH], 4);
+
+		reader->samples = reserve(reader->samples, &reader->samples_size,
+				sizeof(int16_t) * samples);
+		if (!reader->samples)
+			return (ENOMEM);
+		if (owon_unpack_samples(reader->samples, samples, in, bytes) != 0)
+			return (OWON_ERROR_FORMAT);
+		store_samples(raw + offset, reader->samples, samples);
+		in += bytes;
+	}
+	scope->raw_length = length;
+
+	return (0);
+}
+
+/**
+ * Read and decode the next capture of an archive
+ *
+ * Captures appended while reading are also returned.
+ *
+ * @param reader	Reader opened with owon_archive_seek()
+ * @param scope		Zero initialised or opened scope structure, the capture
+ * 					is kept in scope->raw as with owon_load_raw()
+ * @param time		Time of the capture (ns since 1970 UTC), or NULL
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error, OWON_ERROR_END after the last capture
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_archive_next(OWON_ARCHIVE_READER_T *reader,
+		OWON_SCOPE_T *scope, uint64_t *time) {
+
+	unsigned char record[ARCHIVE_RECORD_SIZE];
+	uint64_t entry_time, offset;
+	uint32_t length;
+	int error_code;
+
+	if (!reader->index)
+		return (OWON_ERROR_END);
+
+	while (reader->entry >= reader->entries) {
+		reader->entries = count_entries(reader->index);
+		if (reader->entry < reader->entries)
+			break;
+		if (reader->position + 1 >= reader->count) {
+			error_code = rescan_reader(reader);
+			if (error_code)
+				return (error_code);
+			if (reader->position + 1 >= reader->count)
+				return (OWON_ERROR_END);
+		}
+		error_code = open_reader(reader, reader->position + 1);
+		if (error_code)
+			return (error_code);
+	}
+
+	error_code = read_entry(reader->index, reader->entry, &entry_time,
+			&offset);
+	if (error_code)
+		return (error_code);
+	reader->entry++;
+
+	if (fseek(reader->data, (long) offset, SEEK_SET) != 0
+			|| fread(record, 1, sizeof(record), reader->data) != sizeof(record)
+			|| get_le(&record[ARCHIVE_REC_TIME], 8) != entry_time)
+		return (OWON_ERROR_FORMAT);
+
+	length = (uint32_t) get_le(&record[ARCHIVE_REC_LENGTH], 4);
+	scope->raw_length = 0;
+	if (memcmp(record, ARCHIVE_MAGIC_PACKED, 4) == 0) {
+		reader->buffer = reserve(reader->buffer, &reader->buffer_size,
+				length);
+		if (!reader->buffer)
+			return (ENOMEM);
+		if (fread(reader->buffer, 1, length, reader->data) != length)
+			return (OWON_ERROR_FORMAT);
+		error_code = unpack_record(reader, scope, reader->buffer, length);
+		if (error_code)
+			return (error_code);
+	} else {
+		if (memcmp(record, ARCHIVE_MAGIC_RECORD, 4) != 0
+				|| length < OWON_HEADER_SIZE)
+			return (OWON_ERROR_FORMAT);
+
+		scope->raw = reserve(scope->raw, &scope->raw_size, length);
+		if (!scope->raw)
+			return (ENOMEM);
+		if (fread(scope->raw, 1, length, reader->data) != length)
+			return (OWON_ERROR_FORMAT);
+		scope->raw_length = length;
+	}
+
+	if (time)
+		*time = entry_time;
+
+	return (owon_decode_buffer(scope, scope->raw, scope->raw_length));
+}
+
+/**
+ * Close an archive being read
+ *
+ * @param reader	Reader opened with owon_archive_seek()
+ *
+ */
+LIBOWONPDS_EXPORT void owon_archive_finish(OWON_ARCHIVE_READER_T *reader) {
+
+	close_reader(reader);
+	free(reader->segments);
+	free(reader->directory);
+	free(reader->buffer);
+	free(reader->samples);
+	memset(reader, 0, sizeof(OWON_ARCHIVE_READER_T));
+}
@@ -0,0 +1,106 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @file
+ * @defgroup 	LibOwonPdsArchive
+ * @{
+ * @brief		Recording of captures to an indexed archive
+ * @author		Al Brown
+ * @copyright	Copyright &copy; 2015 Al Brown
+ *
+ */
+
+#ifndef LIBOWONPDS_ARCHIVE_H_
+#define LIBOWONPDS_ARCHIVE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "libowonpds.h"
+#include "libowonpds_export.h"
+
+#define OWON_ARCHIVE_SEGMENT_DEFAULT (64 * 1024 * 1024)	/**< Segment size (bytes) */
+#define OWON_ARCHIVE_SYNC_DEFAULT 16	/**< Captures written between fsyncs */
+
+// Archive options
+#define OWON_ARCHIVE_PACK 0x01		/**< Pack the samples of vector captures */
+
+/**
+ * Archive being recorded
+ */
+typedef struct {
+	char *directory;		/**< Archive directory */
+	uint64_t segment_size;	/**< Segment length before rotating (bytes) */
+	unsigned sync;			/**< Captures written between fsyncs */
+	unsigned flags;			/**< OWON_ARCHIVE_ flags */
+	unsigned segment;		/**< Number of the current segment */
+	uint64_t length;		/**< Length of the current segment (bytes) */
+	unsigned pending;		/**< Captures written since the last fsync */
+	uint64_t time;			/**< Time of the last capture (ns since 1970 UTC) */
+	FILE *data;				/**< Current segment data */
+	FILE *index;			/**< Current segment index */
+	char *data_buffer;		/**< Write buffer of the data file */
+	char *index_buffer;		/**< Write buffer of the index file */
+	unsigned char *entries;	/**< Index entries of the captures not yet synced */
+	unsigned char *buffer;	/**< Packed record */
+	size_t buffer_size;		/**< Allocated packed record size (bytes) */
+	int16_t *samples;		/**< Samples being packed */
+	size_t samples_size;	/**< Allocated samples size (bytes) */
+} OWON_ARCHIVE_T;
+
+/**
+ * Archive being read
+ */
+typedef struct {
+	char *directory;		/**< Archive directory */
+	unsigned *segments;		/**< Segment numbers, ascending */
+	unsigned count;			/**< Number of segments */
+	unsigned position;		/**< Current segment in segments */
+	uint64_t entry;			/**< Next entry of the current index */
+	uint64_t entries;		/**< Entries in the current index */
+	FILE *data;				/**< Current segment data */
+	FILE *index;			/**< Current segment index */
+	unsigned char *buffer;	/**< Packed record */
+	size_t buffer_size;		/**< Allocated packed record size (bytes) */
+	int16_t *samples;		/**< Samples being unpacked */
+	size_t samples_size;	/**< Allocated samples size (bytes) */
+} OWON_ARCHIVE_READER_T;
+
+LIBOWONPDS_EXPORT int owon_archive_open(OWON_ARCHIVE_T *archive,
+		const char *directory, const uint64_t segment_size,
+		const unsigned sync, const unsigned flags);
+LIBOWONPDS_EXPORT int owon_archive_write(OWON_ARCHIVE_T *archive,
+		const OWON_SCOPE_T *scope);
+LIBOWONPDS_EXPORT int owon_archive_sync(OWON_ARCHIVE_T *archive);
+LIBOWONPDS_EXPORT int owon_archive_close(OWON_ARCHIVE_T *archive);
+LIBOWONPDS_EXPORT int owon_archive_seek(OWON_ARCHIVE_READER_T *reader,
+		const char *directory, const uint64_t time);
+LIBOWONPDS_EXPORT int owon_archive_next(OWON_ARCHIVE_READER_T *reader,
+		OWON_SCOPE_T *scope, uint64_t *time);
+LIBOWONPDS_EXPORT void owon_archive_finish(OWON_ARCHIVE_READER_T *reader);
+
+#endif /* LIBOWONPDS_ARCHIVE_H_ */
+
+/** @}*/
@@ -0,0 +1,612 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+// Transfers in flight
+#define XFER_START		1u
+#define XFER_HEADER 	2u
+#define XFER_PAYLOAD	4u
+
+// Payloads are read in chunks, a multiple of the packet size, with
+// several in flight
+#define PAYLOAD_CHUNK	(64 * 1024)
+#define PAYLOAD_CHUNKS	4
+
+// Asynchronous acquisition state
+typedef struct {
+	OWON_SCOPE_T *scope;
+	struct libusb_transfer *start;		// START command
+	struct libusb_transfer *header;		// Capture header
+	struct libusb_transfer *payload;	// Capture payload
+	unsigned char header_buffer[OWON_HEADER_SIZE];
+	unsigned char *buffer[2];			// Raw capture buffers
+	size_t buffer_size[2];				// Allocated size of each buffer
+	unsigned filling;					// Buffer being filled by the device
+	uint64_t timestamp;					// Time the filling capture was requested
+	uint64_t mark;						// Start of the current stage (OWON_OPT_STATS)
+	uint64_t last[OWON_STAGES];			// Stage times of the filling capture
+	unsigned pending;					// XFER_ flags of transfers in flight
+	int completed;						// Capture received or error
+	int error_code;
+} ASYNC_T;
+
+// Chunked payload read
+typedef struct {
+	OWON_SCOPE_T *scope;
+	struct libusb_transfer *transfer[PAYLOAD_CHUNKS];
+	unsigned char *payload;
+	uint32_t length;					// Payload length
+	uint32_t requested;					// Bytes requested
+	uint32_t received;					// Bytes received, chunks complete in order
+	unsigned pending;					// Chunks in flight
+	bool ended;							// Short chunk, the payload is complete
+	int completed;						// A chunk finished
+	int error_code;
+} CHUNKS_T;
+
+// Convert a transfer status to a libusb error
+static int transfer_error(const struct libusb_transfer *transfer) {
+
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return (LIBUSB_SUCCESS);
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return (LIBUSB_ERROR_TIMEOUT);
+	case LIBUSB_TRANSFER_CANCELLED:
+		return (LIBUSB_ERROR_INTERRUPTED);
+	case LIBUSB_TRANSFER_STALL:
+		return (LIBUSB_ERROR_PIPE);
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return (LIBUSB_ERROR_NO_DEVICE);
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return (LIBUSB_ERROR_OVERFLOW);
+	default:
+		return (LIBUSB_ERROR_IO);
+	}
+}
+
+// Record the first error and wake the event loop
+static void async_fail(ASYNC_T *async, const int error_code) {
+
+	if (async->error_code == LIBUSB_SUCCESS)
+		async->error_code = error_code;
+	async->completed = 1;
+}
+
+// Submit a transfer, tracking it while in flight
+static int async_submit(ASYNC_T *async, struct libusb_transfer *transfer,
+		const unsigned flag) {
+
+	int error_code = libusb_submit_transfer(transfer);
+	if (error_code == LIBUSB_SUCCESS)
+		async->pending |= flag;
+	else
+		async_fail(async, error_code);
+
+	return (error_code);
+}
+
+// End a stage of the filling capture started at stats_time()
+// Its times are kept until the capture is handed to the scope
+static void async_stage(ASYNC_T *async, const unsigned stage,
+		const uint64_t start) {
+
+	if (!start)
+		return;
+
+	uint64_t time = owon_time() - start;
+	async->last[stage] += time;
+	async->scope->stats.total[stage] += time;
+}
+
+// End a transfer stage and count its result
+static void async_stats(ASYNC_T *async, const struct libusb_transfer *transfer,
+		const unsigned stage) {
+
+	async_stage(async, stage, async->mark);
+	stats_transfer(async->scope, transfer_error(transfer),
+			transfer->actual_length);
+	async->mark = stats_time(async->scope);
+}
+
+static void LIBUSB_CALL on_payload(struct libusb_transfer *transfer) {
+
+	ASYNC_T *async = transfer->user_data;
+	async->pending &= ~XFER_PAYLOAD;
+	async_stats(async, transfer, OWON_STAGE_PAYLOAD);
+
+	int error_code = transfer_error(transfer);
+	if (error_code != LIBUSB_SUCCESS) {
+		async_fail(async, error_code);
+		return;
+	}
+
+	async->completed = 1;
+}
+
+static void LIBUSB_CALL on_header(struct libusb_transfer *transfer) {
+
+	ASYNC_T *async = transfer->user_data;
+	async->pending &= ~XFER_HEADER;
+	async_stats(async, transfer, OWON_STAGE_HEADER);
+
+	int error_code = transfer_error(transfer);
+	if (error_code != LIBUSB_SUCCESS) {
+		async_fail(async, error_code);
+		return;
+	}
+
+	// Grow the buffer to fit the payload
+	unsigned filling = async->filling;
+	uint32_t fileLength = header_file_length(async->header_buffer);
+	size_t size = OWON_HEADER_SIZE + (size_t) fileLength;
+	uint64_t start = stats_time(async->scope);
+	async->buffer[filling] = reserve(async->buffer[filling],
+			&async->buffer_size[filling], size);
+	async_stage(async, OWON_STAGE_ALLOC, start);
+	async->mark = stats_time(async->scope);
+	if (!async->buffer[filling]) {
+		error("Failed to allocate transfer memory");
+		async_fail(async, LIBUSB_ERROR_NO_MEM);
+		return;
+	}
+	memcpy(async->buffer[filling], async->header_buffer, OWON_HEADER_SIZE);
+
+	libusb_fill_bulk_transfer(async->payload, async->scope->handle,
+			READ_ENDPOINT, async->buffer[filling] + OWON_HEADER_SIZE,
+			(int) fileLength, on_payload, async, TIMEOUT);
+	async_submit(async, async->payload, XFER_PAYLOAD);
+}
+
+static void LIBUSB_CALL on_start(struct libusb_transfer *transfer) {
+
+	ASYNC_T *async = transfer->user_data;
+	async->pending &= ~XFER_START;
+	async_stats(async, transfer, OWON_STAGE_START);
+
+	int error_code = transfer_error(transfer);
+	if (error_code != LIBUSB_SUCCESS)
+		async_fail(async, error_code);
+}
+
+// Queue the START command and the header read for the next capture
+static int async_queue(ASYNC_T *async) {
+
+	async->completed = 0;
+	memset(async->last, 0, sizeof(async->last));
+	async->timestamp = owon_time();
+	async->mark = stats_time(async->scope);
+
+	libusb_fill_bulk_transfer(async->start, async->scope->handle,
+			WRITE_ENDPOINT, (unsigned char *) CMD_START, sizeof(CMD_START),
+			on_start, async, TIMEOUT);
+	libusb_fill_bulk_transfer(async->header, async->scope->handle,
+			READ_ENDPOINT, async->header_buffer, OWON_HEADER_SIZE, on_header,
+			async, TIMEOUT);
+
+	int error_code = async_submit(async, async->start, XFER_START);
+	if (error_code == LIBUSB_SUCCESS)
+		error_code = async_submit(async, async->header, XFER_HEADER);
+
+	return (error_code);
+}
+
+// Handle the transfers that have finished without waiting, so the next
+// capture is requested while the previous one is decoded
+static void async_poll(ASYNC_T *async) {
+
+	struct timeval zero = { 0, 0 };
+
+	if (async->pending && !async->completed)
+		libusb_handle_events_timeout_completed(async->scope->context, &zero,
+				NULL);
+}
+
+// Wait for transfers in flight to finish
+// A capture is left to complete so the device is not left mid-reply,
+// after an error, or if events fail, the remaining transfers are cancelled
+// Returns false if transfers are still in flight and can not be freed
+static bool async_drain(ASYNC_T *async) {
+
+	bool cancelled = false;
+	int error_code;
+
+	while (async->pending) {
+		if (async->error_code != LIBUSB_SUCCESS && !cancelled) {
+			if (async->pending & XFER_START)
+				libusb_cancel_transfer(async->start);
+			if (async->pending & XFER_HEADER)
+				libusb_cancel_transfer(async->header);
+			if (async->pending & XFER_PAYLOAD)
+				libusb_cancel_transfer(async->payload);
+			cancelled = true;
+		}
+
+		error_code = libusb_handle_events(async->scope->context);
+		if (error_code == LIBUSB_SUCCESS
+				|| error_code == LIBUSB_ERROR_INTERRUPTED)
+			continue;
+		if (cancelled)
+			break;
+		async_fail(async, error_code);
+	}
+
+	return (!async->pending);
+}
+
+// Decode the capture handed to the scope a block at a time, handling the
+// next capture's transfers in between
+static int async_decode(ASYNC_T *async) {
+
+	OWON_SCOPE_T *scope = async->scope;
+	DECODER_T decoder;
+	size_t received;
+	int error_code = 0;
+
+	memset(&decoder, 0, sizeof(decoder));
+	for (received = OWON_HEADER_SIZE + PAYLOAD_CHUNK;
+			received < scope->raw_length && !error_code;
+			received += PAYLOAD_CHUNK) {
+		async_poll(async);
+		error_code = decode_partial(scope, &decoder, scope->raw, received,
+				false);
+	}
+	async_poll(async);
+	if (!error_code)
+		error_code = decode_partial(scope, &decoder, scope->raw,
+				scope->raw_length, true);
+
+	return (error_code);
+}
+
+static void LIBUSB_CALL on_chunk(struct libusb_transfer *transfer);
+
+// Request the next chunk of the payload, if any
+static void submit_chunk(CHUNKS_T *chunks, struct libusb_transfer *transfer) {
+
+	uint32_t length = chunks->length - chunks->requested;
+	int error_code;
+
+	if (!length || chunks->ended || chunks->error_code != LIBUSB_SUCCESS)
+		return;
+	if (length > PAYLOAD_CHUNK)
+		length = PAYLOAD_CHUNK;
+
+	libusb_fill_bulk_transfer(transfer, chunks->scope->handle, READ_ENDPOINT,
+			chunks->payload + chunks->requested, (int) length, on_chunk,
+			chunks, TIMEOUT);
+	error_code = libusb_submit_transfer(transfer);
+	if (error_code != LIBUSB_SUCCESS) {
+		chunks->error_code = error_code;
+		return;
+	}
+	chunks->requested += length;
+	chunks->pending++;
+}
+
+static void LIBUSB_CALL on_chunk(struct libusb_transfer *transfer) {
+
+	CHUNKS_T *chunks = transfer->user_data;
+	int error_code = transfer_error(transfer);
+
+	chunks->pending--;
+	chunks->completed = 1;
+
+	// Chunks after a short one are cancelled
+	if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+		stats_transfer(chunks->scope, error_code, transfer->actual_length);
+	if (error_code != LIBUSB_SUCCESS) {
+		if (!chunks->ended && chunks->error_code == LIBUSB_SUCCESS)
+			chunks->error_code = error_code;
+		return;
+	}
+
+	chunks->received += (uint32_t) transfer->actual_length;
+	if (transfer->actual_length < transfer->length)
+		chunks->ended = true;
+	else
+		submit_chunk(chunks, transfer);
+}
+
+// Read the payload from a link a chunk at a time, decoding as it arrives
+static int read_link_payload(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture,
+		DEDUP_T *dedup, const uint32_t length) {
+
+	DECODER_T decoder;
+	uint32_t received = 0;
+	uint64_t start = stats_time(scope);
+	uint64_t decoding = 0;
+	int error_code = LIBUSB_SUCCESS;
+	int decode_error = 0;
+
+	memset(&decoder, 0, sizeof(decoder));
+	while (received < length) {
+		int requested = (int) (length - received);
+		int transferred = 0;
+
+		if (requested > PAYLOAD_CHUNK)
+			requested = PAYLOAD_CHUNK;
+		error_code = transfer(scope, READ_ENDPOINT,
+				capture->raw + OWON_HEADER_SIZE + received, requested,
+				&transferred, TIMEOUT);
+		stats_transfer(scope, error_code, transferred);
+		if (error_code != LIBUSB_SUCCESS)
+			break;
+		received += (uint32_t) transferred;
+		if (transferred < requested)
+			break;
+
+		// Decoding waits while it matches the last capture
+		if (dedup_update(dedup, capture->raw,
+				OWON_HEADER_SIZE + (size_t) received, false))
+			continue;
+		if (received < length && !decode_error) {
+			uint64_t mark = stats_time(scope);
+			decode_error = decode_partial(capture, &decoder, capture->raw,
+					OWON_HEADER_SIZE + (size_t) received, false);
+			if (mark)
+				decoding += owon_time() - mark;
+		}
+	}
+	if (start)
+		stats_add(scope, OWON_STAGE_PAYLOAD,
+				owon_time() - start - decoding);
+
+	if (error_code != LIBUSB_SUCCESS)
+		return (error_code);
+
+	capture->raw_length = OWON_HEADER_SIZE + received;
+	if (dedup_update(dedup, capture->raw, capture->raw_length, true))
+		dedup_keep(capture, dedup);
+	else if (!decode_error)
+		decode_error = decode_partial(capture, &decoder, capture->raw,
+				capture->raw_length, true);
+
+	return (decode_error);
+}
+
+// Read the payload of a capture after its header, decoding the channels
+// that have arrived while the rest are transferred
+int read_payload(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture,
+		DEDUP_T *dedup, const uint32_t length) {
+
+	CHUNKS_T chunks;
+	DECODER_T decoder;
+	uint32_t decoded = 0;
+	uint64_t start = stats_time(scope);
+	uint64_t decoding = 0;
+	bool cancelled = false;
+	int decode_error = 0;
+	unsigned i;
+
+	if (scope->link)
+		return (read_link_payload(scope, capture, dedup, length));
+
+	memset(&chunks, 0, sizeof(chunks));
+	memset(&decoder, 0, sizeof(decoder));
+	chunks.scope = scope;
+	chunks.payload = capture->raw + OWON_HEADER_SIZE;
+	chunks.length = length;
+
+	for (i = 0; i < PAYLOAD_CHUNKS; i++) {
+		chunks.transfer[i] = libusb_alloc_transfer(0);
+		if (!chunks.transfer[i])
+			chunks.error_code = LIBUSB_ERROR_NO_MEM;
+	}
+	for (i = 0; i < PAYLOAD_CHUNKS; i++)
+		submit_chunk(&chunks, chunks.transfer[i]);
+
+	while (chunks.pending) {
+		chunks.completed = 0;
+		if (libusb_handle_events_completed(scope->context, &chunks.completed)
+				!= LIBUSB_SUCCESS)
+			break;
+
+		if ((chunks.ended || chunks.error_code != LIBUSB_SUCCESS)
+				&& !cancelled) {
+			for (i = 0; i < PAYLOAD_CHUNKS; i++)
+				libusb_cancel_transfer(chunks.transfer[i]);
+			cancelled = true;
+		}
+
+		// Decoding waits while it matches the last capture, the rest is
+		// decoded once all has arrived
+		if (dedup_update(dedup, capture->raw,
+				OWON_HEADER_SIZE + (size_t) chunks.received, false))
+			continue;
+		if (chunks.pending && !cancelled && !decode_error
+				&& chunks.received > decoded) {
+			uint64_t mark = stats_time(scope);
+			decoded = chunks.received;
+			decode_error = decode_partial(capture, &decoder, capture->raw,
+					OWON_HEADER_SIZE + (size_t) decoded, false);
+			if (mark)
+				decoding += owon_time() - mark;
+		}
+	}
+	if (start)
+		stats_add(scope, OWON_STAGE_PAYLOAD,
+				owon_time() - start - decoding);
+
+	// Transfers still in flight after an event error can not be freed
+	if (chunks.pending) {
+		error("Failed to handle transfers");
+		return (LIBUSB_ERROR_OTHER);
+	}
+	for (i = 0; i < PAYLOAD_CHUNKS; i++)
+		libusb_free_transfer(chunks.transfer[i]);
+
+	if (chunks.error_code != LIBUSB_SUCCESS)
+		return (chunks.error_code);
+
+	capture->raw_length = OWON_HEADER_SIZE + chunks.received;
+	if (dedup_update(dedup, capture->raw, capture->raw_length, true))
+		dedup_keep(capture, dedup);
+	else if (!decode_error)
+		decode_error = decode_partial(capture, &decoder, capture->raw,
+				capture->raw_length, true);
+
+	return (decode_error);
+}
+
+/**
+ * Continuously capture data from the device
+ *
+ * The next capture is requested from the device while the previous one
+ * is being decoded and passed to the callback, hiding the USB round trip
+ * latency. The scope struct holds the decoded capture for the duration
+ * of the callback, and the last one once this returns.
+ *
+ * @param scope 	Initialised scope struct to read data to
+ * @param callback	Called with each decoded capture,
+ * 					return non-zero to stop
+ * @param context	User data passed to the callback
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_read_async(OWON_SCOPE_T *scope,
+		OWON_CALLBACK callback, void *context) {
+
+	ASYNC_T *async;
+	int error_code = LIBUSB_SUCCESS;
+	unsigned i;
+
+	if (!is_open(scope))
+		return (LIBUSB_ERROR_NO_DEVICE);
+
+	// Links have no asynchronous transfers, each capture is read in turn
+	if (scope->link) {
+		while ((error_code = owon_read(scope)) == LIBUSB_SUCCESS)
+			if (callback(scope, context))
+				break;
+		return (error_code);
+	}
+
+	// Allocated, as transfers that can not be drained keep using it
+	async = calloc(1, sizeof(ASYNC_T));
+	if (!async)
+		return (LIBUSB_ERROR_NO_MEM);
+
+	clear_decoded(scope);
+
+	// Take over the scope's raw buffer as the first transfer buffer
+	async->scope = scope;
+	async->buffer[0] = scope->raw;
+	async->buffer_size[0] = scope->raw_size;
+	scope->raw = NULL;
+	scope->raw_size = 0;
+	scope->raw_length = 0;
+	async->start = libusb_alloc_transfer(0);
+	async->header = libusb_alloc_transfer(0);
+	async->payload = libusb_alloc_transfer(0);
+
+	if (async->start && async->header && async->payload)
+		error_code = async_queue(async);
+	else
+		error_code = LIBUSB_ERROR_NO_MEM;
+
+	while (error_code == LIBUSB_SUCCESS) {
+		// Wait for the capture in flight
+		while (!async->completed) {
+			error_code = libusb_handle_events_completed(scope->context,
+					&async->completed);
+			if (error_code != LIBUSB_SUCCESS)
+				break;
+		}
+		if (error_code == LIBUSB_SUCCESS)
+			error_code = async->error_code;
+		if (error_code != LIBUSB_SUCCESS)
+			break;
+
+		// Hand the filled buffer to the scope and request the next capture
+		unsigned filled = async->filling;
+		scope->raw = async->buffer[filled];
+		scope->raw_size = async->buffer_size[filled];
+		scope->timestamp = async->timestamp;
+		scope->raw_length = OWON_HEADER_SIZE
+				+ (uint32_t) async->payload->actual_length;
+		if (scope->options & OWON_OPT_STATS)
+			memcpy(scope->stats.last, async->last, sizeof(async->last));
+		async->filling ^= 1;
+		error_code = async_queue(async);
+		if (error_code != LIBUSB_SUCCESS)
+			break;
+
+		DEDUP_T dedup;
+		dedup_begin(scope, scope, &dedup);
+		clear_decoded(scope);
+		if (dedup_update(&dedup, scope->raw, scope->raw_length, true))
+			dedup_keep(scope, &dedup);
+		else
+			error_code = async_decode(async);
+		dedup_end(scope, &dedup, error_code == LIBUSB_SUCCESS);
+		if (error_code != LIBUSB_SUCCESS)
+			break;
+		scope->sequence++;
+		stats_capture(scope, scope->timestamp);
+
+		// Let the next payload be requested before the callback runs
+		async_poll(async);
+		if (callback(scope, context))
+			break;
+	}
+
+	bool drained = async_drain(async);
+
+	// The scope keeps the last decoded buffer, or any buffer if none were
+	// A buffer still being filled is left with its transfers
+	for (i = 0; i < 2; i++) {
+		if (async->buffer[i] == scope->raw
+				|| (!drained && i == async->filling))
+			continue;
+		if (!scope->raw) {
+			scope->raw = async->buffer[i];
+			scope->raw_size = async->buffer_size[i];
+		} else
+			free(async->buffer[i]);
+	}
+
+	// Transfers still in flight after an event error can not be freed
+	if (!drained) {
+		error("Failed to handle transfers");
+		return (error_code != LIBUSB_SUCCESS ?
+				error_code : LIBUSB_ERROR_OTHER);
+	}
+	libusb_free_transfer(async->start);
+	libusb_free_transfer(async->header);
+	libusb_free_transfer(async->payload);
+	free(async);
+
+	return (error_code);
+}
@@ -0,0 +1,264 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+/*
+ * Packed samples
+ *
+ * Samples are coded in blocks of CODEC_BLOCK (the last may be shorter),
+ * each a byte holding the bit width followed by the differences between
+ * successive samples, zigzag coded and packed at that width least
+ * significant bit first. The first difference of a block is from the last
+ * sample of the previous one, or 0.
+ * Differences wrap at 16 bits, so any samples are coded losslessly in at
+ * most 16 bits.
+ *
+ */
+#define CODEC_BLOCK 128
+#define CODEC_WIDTH_MAX 16
+#define CODEC_GROUP 8				// Values packed together
+#define CODEC_LOAD 8				// Bytes read by each load
+#define CODEC_STORE 16				// Bytes written by each store
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static inline uint64_t load_le64(const unsigned char *from) {
+
+	return ((uint64_t) from[0] | (uint64_t) from[1] << 8
+			| (uint64_t) from[2] << 16 | (uint64_t) from[3] << 24
+			| (uint64_t) from[4] << 32 | (uint64_t) from[5] << 40
+			| (uint64_t) from[6] << 48 | (uint64_t) from[7] << 56);
+}
+
+static inline void store_le64(unsigned char *to, const uint64_t value) {
+
+	to[0] = (unsigned char) value;
+	to[1] = (unsigned char) (value >> 8);
+	to[2] = (unsigned char) (value >> 16);
+	to[3] = (unsigned char) (value >> 24);
+	to[4] = (unsigned char) (value >> 32);
+	to[5] = (unsigned char) (value >> 40);
+	to[6] = (unsigned char) (value >> 48);
+	to[7] = (unsigned char) (value >> 56);
+}
+
+// Bytes holding a block
+static inline size_t block_bytes(const uint32_t length, const unsigned width) {
+
+	return (((size_t) length * width + 7) / 8);
+}
+
+// Pack groups of 8 values, each group filling width bytes
+// Stores reach CODEC_STORE bytes past the last group
+static inline void pack(unsigned char *out, const uint16_t *values,
+		const uint32_t groups, const unsigned width) {
+
+	uint32_t i;
+
+	for (i = 0; i < groups; i++) {
+		uint64_t low = (uint64_t) values[0] | (uint64_t) values[1] << width
+				| (uint64_t) values[2] << 2 * width
+				| (uint64_t) values[3] << 3 * width;
+		uint64_t high = (uint64_t) values[4] | (uint64_t) values[5] << width
+				| (uint64_t) values[6] << 2 * width
+				| (uint64_t) values[7] << 3 * width;
+
+		// Shifted in halves, the whole word is shifted out at width 16
+		store_le64(out, low | high << 2 * width << 2 * width);
+		store_le64(out + 8, high >> (64 - 4 * width));
+		out += width;
+		values += 8;
+	}
+}
+
+// Unpack groups of 8 values
+// Loads reach CODEC_LOAD bytes past the last group
+static inline void unpack(uint16_t *values, const unsigned char *in,
+		const uint32_t groups, const unsigned width) {
+
+	uint64_t mask = ((uint64_t) 1 << width) - 1;
+	uint32_t i;
+	unsigned j;
+
+	for (i = 0; i < groups; i++) {
+		for (j = 0; j < 8; j++)
+			values[j] = (uint16_t) ((load_le64(in + j * width / 8)
+					>> (j * width % 8)) & mask);
+		in += width;
+		values += 8;
+	}
+}
+
+// Widths are made constant for the compiler in each case
+#define CODEC_WIDTHS(CASE) \
+	CASE(1) CASE(2) CASE(3) CASE(4) CASE(5) CASE(6) CASE(7) CASE(8) \
+	CASE(9) CASE(10) CASE(11) CASE(12) CASE(13) CASE(14) CASE(15) CASE(16)
+#define PACK_WIDTH(width) \
+	case width: \
+		pack(out, values, groups, width); \
+		break;
+#define UNPACK_WIDTH(width) \
+	case width: \
+		unpack(values, in, groups, width); \
+		break;
+
+static void pack_groups(unsigned char *out, const uint16_t *values,
+		const uint32_t groups, const unsigned width) {
+
+	switch (width) {
+	CODEC_WIDTHS(PACK_WIDTH)
+	}
+}
+
+static void unpack_groups(uint16_t *values, const unsigned char *in,
+		const uint32_t groups, const unsigned width) {
+
+	switch (width) {
+	CODEC_WIDTHS(UNPACK_WIDTH)
+	default:
+		memset(values, 0, sizeof(uint16_t) * 8 * groups);
+		break;
+	}
+}
+
+/**
+ * Largest length of packed samples
+ *
+ * @param count		Number of samples
+ * @return Bytes needed by owon_pack_samples()
+ *
+ */
+LIBOWONPDS_EXPORT size_t owon_pack_bound(const uint32_t count) {
+
+	return ((size_t) count * sizeof(int16_t)
+			+ (count + CODEC_BLOCK - 1) / CODEC_BLOCK);
+}
+
+/**
+ * Pack samples losslessly
+ *
+ * Differences between samples are bit packed in blocks, so slowly
+ * changing or quiet channels take a fraction of their size.
+ *
+ * @param out		Packed samples, at least owon_pack_bound() bytes
+ * @param samples	Samples
+ * @param count		Number of samples
+ * @return Length of the packed samples (bytes)
+ *
+ */
+LIBOWONPDS_EXPORT size_t owon_pack_samples(unsigned char *out,
+		const int16_t *samples, const uint32_t count) {
+
+	unsigned char packed[CODEC_BLOCK * sizeof(int16_t) + CODEC_STORE];
+	DELTA_FN delta = simd_kernels()->delta;
+	uint16_t values[CODEC_BLOCK];
+	int16_t previous = 0;
+	unsigned char *start = out;
+	uint32_t done;
+
+	for (done = 0; done < count; done += CODEC_BLOCK) {
+		const int16_t *block = &samples[done];
+		uint32_t length = MIN(count - done, CODEC_BLOCK);
+		uint32_t groups = (length + CODEC_GROUP - 1) / CODEC_GROUP;
+		uint16_t used = delta(values, block, length, previous);
+		unsigned width = 0;
+		size_t bytes;
+		uint32_t i;
+
+		for (i = length; i < groups * CODEC_GROUP; i++)
+			values[i] = 0;
+		while (used >> width)
+			width++;
+		previous = block[length - 1];
+
+		bytes = block_bytes(length, width);
+		*out++ = (unsigned char) width;
+		if (width) {
+			pack_groups(packed, values, groups, width);
+			memcpy(out, packed, bytes);
+		}
+		out += bytes;
+	}
+
+	return ((size_t) (out - start));
+}
+
+/**
+ * Unpack samples packed with owon_pack_samples()
+ *
+ * @param samples	Samples
+ * @param count		Number of samples packed
+ * @param in		Packed samples
+ * @param length	Length of the packed samples (bytes)
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_unpack_samples(int16_t *samples,
+		const uint32_t count, const unsigned char *in, const size_t length) {
+
+	unsigned char tail[CODEC_BLOCK * sizeof(int16_t) + CODEC_LOAD];
+	UNDELTA_FN undelta = simd_kernels()->undelta;
+	uint16_t values[CODEC_BLOCK];
+	int16_t previous = 0;
+	const unsigned char *end = in + length;
+	uint32_t done;
+
+	for (done = 0; done < count; done += CODEC_BLOCK) {
+		int16_t *block = &samples[done];
+		uint32_t block_length = MIN(count - done, CODEC_BLOCK);
+		uint32_t groups = (block_length + CODEC_GROUP - 1) / CODEC_GROUP;
+		const unsigned char *data;
+		unsigned width;
+		size_t bytes;
+
+		if (in >= end || *in > CODEC_WIDTH_MAX)
+			return (OWON_ERROR_FORMAT);
+		width = *in++;
+		bytes = block_bytes(block_length, width);
+		if ((size_t) (end - in) < bytes)
+			return (OWON_ERROR_FORMAT);
+
+		// Loads near the end read a padded copy
+		data = in;
+		if ((size_t) (end - in) < groups * width + CODEC_LOAD) {
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, in, bytes);
+			data = tail;
+		}
+		in += bytes;
+
+		unpack_groups(values, data, groups, width);
+		undelta(block, values, block_length, previous);
+		previous = block[block_length - 1];
+	}
+
+	return (in == end ? 0 : OWON_ERROR_FORMAT);
+}
@@ -0,0 +1,202 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+/*
+ * Unchanged captures
+ *
+ * With OWON_OPT_DEDUP the CRC32C of a capture is taken as it arrives,
+ * with a checkpoint every DEDUP_CHECKPOINT bytes, and compared with the
+ * last capture read from the scope. The checksums are kept by the scope,
+ * so captures streamed into a ring are compared with the one before.
+ * If the last capture was decoded into the same struct decoding is held
+ * back while the checkpoints match, and if all match its channels are
+ * kept. Otherwise, or once a capture differs, it is decoded as it arrives
+ * as usual.
+ *
+ */
+
+#define DEDUP_CHECKPOINT 65536		// Bytes between checkpoints
+
+// Checksums of the last capture read from a scope
+struct owon_dedup {
+	uint32_t *crc;				// CRC at each checkpoint
+	size_t size;				// Checkpoints allocated
+	uint32_t count;				// Checkpoints of the last capture, 0 if none
+	const OWON_SCOPE_T *capture;	// Struct it was decoded into
+	unsigned channels;			// Vector channels decoded from it, 0 if none
+	unsigned options;			// Options it was decoded with
+};
+
+// Start checking a capture from scope, read into capture, against the
+// last one
+void dedup_begin(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture,
+		DEDUP_T *dedup) {
+
+	struct owon_dedup *last = scope->dedup;
+
+	memset(dedup, 0, sizeof(DEDUP_T));
+	capture->crc = 0;
+	capture->unchanged = false;
+	if (!(capture->options & OWON_OPT_DEDUP))
+		return;
+
+	if (!last) {
+		last = calloc(1, sizeof(struct owon_dedup));
+		if (!last) {
+			error("Failed to allocate checksums");
+			return;
+		}
+		scope->dedup = last;
+	}
+
+	dedup->last = last;
+	dedup->enabled = true;
+	dedup->matching = last->count > 0;
+	dedup->previous = last->count;
+	dedup->channels = last->channels;
+	if (last->capture != capture || last->options != capture->options)
+		dedup->channels = 0;
+}
+
+// Hash the bytes received so far, and finally the rest
+// Returns true while the channels of the last capture can be kept
+bool dedup_update(DEDUP_T *dedup, const unsigned char *raw,
+		const size_t received, const bool final) {
+
+	struct owon_dedup *last = dedup->last;
+	CRC_FN crc = simd_kernels()->crc;
+
+	if (!dedup->enabled)
+		return (false);
+
+	while (dedup->hashed < received) {
+		size_t next = (dedup->hashed / DEDUP_CHECKPOINT + 1)
+				* (size_t) DEDUP_CHECKPOINT;
+		uint32_t i = dedup->checkpoints;
+
+		if (next > received) {
+			if (!final)
+				break;
+			next = received;
+		}
+		dedup->crc = crc(dedup->crc, raw + dedup->hashed,
+				next - dedup->hashed);
+		dedup->hashed = (uint32_t) next;
+
+		// The checkpoints of the last capture are replaced as they are passed
+		if (i >= last->size) {
+			size_t size = last->size ? last->size * 2 : 64;
+			uint32_t *grown = realloc(last->crc, sizeof(uint32_t) * size);
+			if (!grown) {
+				error("Failed to allocate checksums");
+				dedup->matching = false;
+				dedup->enabled = false;
+				last->count = 0;
+				return (false);
+			}
+			last->crc = grown;
+			last->size = size;
+		}
+		if (i >= dedup->previous || last->crc[i] != dedup->crc)
+			dedup->matching = false;
+		last->crc[i] = dedup->crc;
+		last->count = 0;
+		dedup->checkpoints++;
+	}
+	if (final && dedup->checkpoints != dedup->previous)
+		dedup->matching = false;
+
+	return (dedup->matching && dedup->channels);
+}
+
+// Keep the channels decoded from the last capture
+void dedup_keep(OWON_SCOPE_T *capture, const DEDUP_T *dedup) {
+
+	capture->type = OWON_TYPE_VECTOR;
+	capture->channel_count = dedup->channels;
+}
+
+// Finish checking a capture, read and decoded if success
+void dedup_end(OWON_SCOPE_T *capture, const DEDUP_T *dedup,
+		const bool success) {
+
+	struct owon_dedup *last = dedup->last;
+
+	if (!dedup->enabled)
+		return;
+
+	// Nothing was received, the last capture is still decoded
+	if (!dedup->hashed) {
+		last->count = dedup->previous;
+		last->channels = dedup->channels;
+		if (dedup->channels)
+			last->capture = capture;
+		return;
+	}
+	if (!success)
+		return;
+
+	last->count = dedup->checkpoints;
+	last->capture = capture;
+	last->channels = capture->type == OWON_TYPE_VECTOR ?
+			capture->channel_count : 0;
+	last->options = capture->options;
+	capture->crc = dedup->crc;
+	capture->unchanged = dedup->matching;
+}
+
+// Forget the last capture, its channels have been cleared
+void dedup_clear(OWON_SCOPE_T *scope) {
+
+	if (scope->dedup) {
+		scope->dedup->count = 0;
+		scope->dedup->capture = NULL;
+		scope->dedup->channels = 0;
+	}
+}
+
+// Keep the checksums of the last capture but not its channels
+void dedup_detach(OWON_SCOPE_T *scope) {
+
+	if (scope->dedup) {
+		scope->dedup->capture = NULL;
+		scope->dedup->channels = 0;
+	}
+}
+
+void dedup_free(OWON_SCOPE_T *scope) {
+
+	if (scope->dedup) {
+		free(scope->dedup->crc);
+		free(scope->dedup);
+		scope->dedup = NULL;
+	}
+}
@@ -0,0 +1,347 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+/*
+ * Scopes opened with owon_open() share one libusb context and the scopes
+ * found by the last enumeration, with their descriptions. Both are kept
+ * after the scopes are closed so opening again (or reconnecting) does not
+ * enumerate the bus or read the string descriptors again, until
+ * owon_release_devices().
+ * A scope missing from the cache, or gone from the bus, enumerates again.
+ *
+ */
+
+// Scope found by an enumeration
+struct owon_device {
+	libusb_device *device;
+	bool described;				// Descriptions read
+	unsigned char manufacturer[OWON_DESC_NAME_LEN + 1];
+	unsigned char product[OWON_DESC_NAME_LEN + 1];
+	unsigned char serial[OWON_DESC_NAME_LEN + 1];
+};
+
+static libusb_context *context = NULL;
+static unsigned users = 0;				// Scopes using the context
+static struct owon_device devices[OWON_MAX_DEVICES];
+static unsigned device_count = 0;
+static bool enumerated = false;
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Drop the cached scopes
+static void forget_devices(void) {
+
+	unsigned i;
+
+	for (i = 0; i < device_count; i++)
+		libusb_unref_device(devices[i].device);
+	memset(devices, 0, sizeof(devices));
+	device_count = 0;
+	enumerated = false;
+}
+
+// Cache the scopes on the bus
+static int enumerate(void) {
+
+	libusb_device **list;
+	struct libusb_device_descriptor descriptor;
+	ssize_t total;
+	ssize_t i;
+
+	forget_devices();
+
+	total = libusb_get_device_list(context, &list);
+	if (total < 0)
+		return ((int) total);
+
+	for (i = 0; i < total && device_count < OWON_MAX_DEVICES; i++) {
+		if (libusb_get_device_descriptor(list[i], &descriptor)
+				!= LIBUSB_SUCCESS || descriptor.idVendor != USB_VID
+				|| descriptor.idProduct != USB_PID)
+			continue;
+		devices[device_count++].device = libusb_ref_device(list[i]);
+	}
+	libusb_free_device_list(list, 1);
+	enumerated = true;
+
+	return (LIBUSB_SUCCESS);
+}
+
+// Read the descriptions of a cached scope, opening it if not given a handle
+static int describe_device(struct owon_device *cached,
+		libusb_device_handle *handle) {
+
+	libusb_device_handle *opened = NULL;
+	int error_code;
+
+	if (cached->described)
+		return (LIBUSB_SUCCESS);
+
+	if (!handle) {
+		error_code = libusb_open(cached->device, &opened);
+		if (error_code != LIBUSB_SUCCESS)
+			return (error_code);
+		handle = opened;
+	}
+	describe_handle(handle, cached->manufacturer, cached->product,
+			cached->serial);
+	cached->described = true;
+	if (opened)
+		libusb_close(opened);
+
+	return (LIBUSB_SUCCESS);
+}
+
+static bool selected(const struct owon_device *cached,
+		const OWON_SELECT_T *select) {
+
+	if (select->bus && libusb_get_bus_number(cached->device) != select->bus)
+		return (false);
+	if (select->port
+			&& libusb_get_port_number(cached->device) != select->port)
+		return (false);
+	if (select->serial
+			&& strcmp((const char *) cached->serial, select->serial) != 0)
+		return (false);
+
+	return (true);
+}
+
+// Open the selected scope of the cache
+static int open_cached(OWON_SCOPE_T *scope, const OWON_SELECT_T *select) {
+
+	unsigned count = 0;
+	unsigned i;
+	int error_code;
+
+	for (i = 0; i < device_count; i++) {
+		struct owon_device *cached = &devices[i];
+
+		// Scopes in use by other processes can not be read, skip them
+		if (select->serial
+				&& describe_device(cached, NULL) != LIBUSB_SUCCESS)
+			continue;
+		if (!selected(cached, select) || count++ != select->index)
+			continue;
+
+		error_code = open_handle(scope, cached->device);
+		if (error_code == LIBUSB_SUCCESS)
+			error_code = describe_device(cached, scope->handle);
+		if (error_code != LIBUSB_SUCCESS) {
+			release_handle(scope);
+			return (error_code);
+		}
+
+		memcpy(scope->manufacturer, cached->manufacturer,
+				sizeof(scope->manufacturer));
+		memcpy(scope->product, cached->product, sizeof(scope->product));
+		memcpy(scope->serial, cached->serial, sizeof(scope->serial));
+		return (LIBUSB_SUCCESS);
+	}
+
+	return (LIBUSB_ERROR_NOT_FOUND);
+}
+
+// Use the shared context
+int acquire_context(OWON_SCOPE_T *scope) {
+
+	int error_code = LIBUSB_SUCCESS;
+
+	pthread_mutex_lock(&devices_lock);
+	if (!context)
+		error_code = libusb_init(&context);
+	if (error_code == LIBUSB_SUCCESS) {
+		scope->context = context;
+		users++;
+	}
+	pthread_mutex_unlock(&devices_lock);
+
+	return (error_code);
+}
+
+// Stop using the shared context (kept), other contexts are freed
+void release_context(OWON_SCOPE_T *scope) {
+
+	pthread_mutex_lock(&devices_lock);
+	if (scope->context == context)
+		users--;
+	else
+		libusb_exit(scope->context);
+	pthread_mutex_unlock(&devices_lock);
+}
+
+// Open the selected scope, enumerating again if it is not cached
+int open_device(OWON_SCOPE_T *scope, const OWON_SELECT_T *select) {
+
+	int error_code = LIBUSB_SUCCESS;
+	bool cached;
+
+	pthread_mutex_lock(&devices_lock);
+	cached = enumerated;
+	if (!enumerated)
+		error_code = enumerate();
+	if (error_code == LIBUSB_SUCCESS)
+		error_code = open_cached(scope, select);
+
+	// Attached, detached or reattached since the last enumeration
+	if (cached && (error_code == LIBUSB_ERROR_NOT_FOUND
+			|| error_code == LIBUSB_ERROR_NO_DEVICE)) {
+		error_code = enumerate();
+		if (error_code == LIBUSB_SUCCESS)
+			error_code = open_cached(scope, select);
+	}
+	pthread_mutex_unlock(&devices_lock);
+
+	if (error_code == LIBUSB_ERROR_NOT_FOUND)
+		error_code = LIBUSB_ERROR_NO_DEVICE;
+
+	return (error_code);
+}
+
+/**
+ * Open communications with a chosen scope
+ *
+ * Scopes are chosen by USB bus and port, which stay the same between
+ * runs, or serial number, then by index of the scopes matching.
+ * Enumerations and descriptions are cached and the configuration is only
+ * set if not already active, so opening again is fast.\n
+ * With the OWON_SIM environment variable set simulated scopes are opened
+ * instead, chosen by index or serial number (SIM0, SIM1...), see
+ * owon_open_sim().
+ *
+ * @param scope		Scope struct to be initialised
+ * @param select	Scope to open
+ * @return
+ * 				- 0 Success
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_open_select(OWON_SCOPE_T *scope,
+		const OWON_SELECT_T *select) {
+
+	OWON_SIM_T sim;
+	unsigned scopes;
+	unsigned count = 0;
+	unsigned i;
+	int error_code;
+
+	memset(scope, 0, sizeof(OWON_SCOPE_T));
+
+	if (sim_environment(&sim, &scopes)) {
+		for (i = 0; i < scopes; i++) {
+			char serial[OWON_DESC_NAME_LEN + 1];
+			snprintf(serial, sizeof(serial), "SIM%u", i);
+			if (select->serial && strcmp(select->serial, serial) != 0)
+				continue;
+			if (count++ != select->index)
+				continue;
+			sim.seed += i;
+			error_code = owon_open_sim(scope, &sim);
+			memcpy(scope->serial, serial, sizeof(scope->serial));
+			return (error_code);
+		}
+		return (LIBUSB_ERROR_NO_DEVICE);
+	}
+
+	error_code = acquire_context(scope);
+	if (error_code == LIBUSB_SUCCESS)
+		error_code = open_device(scope, select);
+
+	return (error_code);
+}
+
+/**
+ * Reopen the scope after an error, keeping the context and buffers
+ *
+ * The same device is opened again, or if it was reattached found again by
+ * serial number (or bus and port without one).
+ * Streaming is stopped.
+ *
+ * @param scope		Scope opened with owon_open() or owon_open_select()
+ * @return
+ * 				- 0 Success
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_reconnect(OWON_SCOPE_T *scope) {
+
+	OWON_SELECT_T select;
+	char serial[OWON_DESC_NAME_LEN + 1];
+	int error_code;
+
+	if (scope->link) {
+		owon_stop_streaming(scope);
+		scope->link->reset(scope->link);
+		return (LIBUSB_SUCCESS);
+	}
+	if (!scope->context || !scope->device)
+		return (LIBUSB_ERROR_INVALID_PARAM);
+
+	owon_stop_streaming(scope);
+	release_handle(scope);
+
+	error_code = open_handle(scope, scope->device);
+	if (error_code == LIBUSB_SUCCESS)
+		return (error_code);
+	release_handle(scope);
+	if (error_code != LIBUSB_ERROR_NO_DEVICE || scope->context != context)
+		return (error_code);
+
+	memset(&select, 0, sizeof(OWON_SELECT_T));
+	if (scope->serial[0]) {
+		memcpy(serial, scope->serial, sizeof(serial));
+		select.serial = serial;
+	} else {
+		select.bus = scope->bus;
+		select.port = scope->port;
+	}
+
+	return (open_device(scope, &select));
+}
+
+/**
+ * Release the cached scopes and the shared libusb context
+ *
+ * The context is released once all scopes opened with owon_open() are
+ * closed, otherwise only the cache is cleared.
+ *
+ */
+LIBOWONPDS_EXPORT void owon_release_devices(void) {
+
+	pthread_mutex_lock(&devices_lock);
+	forget_devices();
+	if (context && !users) {
+		libusb_exit(context);
+		context = NULL;
+	}
+	pthread_mutex_unlock(&devices_lock);
+}
@@ -0,0 +1,300 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+// Capture threads, one per device
+struct owon_group {
+	OWON_GROUP_T *group;
+	pthread_t thread[OWON_MAX_DEVICES];
+	unsigned threads;			// Threads running
+	pthread_mutex_t mutex;
+	pthread_cond_t start;		// Signalled to start a capture
+	pthread_cond_t done;		// Signalled when all captures finish
+	unsigned generation;		// Capture request count
+	unsigned remaining;			// Devices still capturing
+	bool stop;
+};
+
+typedef struct {
+	struct owon_group *workers;
+	unsigned index;
+} WORKER_T;
+
+// Capture thread for one device
+static void *group_thread(void *arg) {
+
+	struct owon_group *workers = ((WORKER_T *) arg)->workers;
+	unsigned index = ((WORKER_T *) arg)->index;
+	OWON_SCOPE_T *scope = &workers->group->scope[index];
+	unsigned seen = 0;
+
+	free(arg);
+
+	pthread_mutex_lock(&workers->mutex);
+	for (;;) {
+		while (!workers->stop && workers->generation == seen)
+			pthread_cond_wait(&workers->start, &workers->mutex);
+		if (workers->stop)
+			break;
+		seen = workers->generation;
+		pthread_mutex_unlock(&workers->mutex);
+
+		int error_code = owon_read(scope);
+
+		pthread_mutex_lock(&workers->mutex);
+		workers->group->error[index] = error_code;
+		if (--workers->remaining == 0)
+			pthread_cond_signal(&workers->done);
+	}
+	pthread_mutex_unlock(&workers->mutex);
+
+	return (NULL);
+}
+
+// Stop and join the capture threads
+static void stop_workers(OWON_GROUP_T *group) {
+
+	struct owon_group *workers = group->workers;
+	unsigned i;
+
+	if (!workers)
+		return;
+
+	pthread_mutex_lock(&workers->mutex);
+	workers->stop = true;
+	pthread_cond_broadcast(&workers->start);
+	pthread_mutex_unlock(&workers->mutex);
+
+	for (i = 0; i < workers->threads; i++)
+		pthread_join(workers->thread[i], NULL);
+
+	pthread_cond_destroy(&workers->done);
+	pthread_cond_destroy(&workers->start);
+	pthread_mutex_destroy(&workers->mutex);
+	free(workers);
+	group->workers = NULL;
+}
+
+// Start a capture thread for each device
+static int start_workers(OWON_GROUP_T *group) {
+
+	struct owon_group *workers;
+	unsigned i;
+
+	workers = calloc(1, sizeof(struct owon_group));
+	if (!workers)
+		return (LIBUSB_ERROR_NO_MEM);
+
+	workers->group = group;
+	pthread_mutex_init(&workers->mutex, NULL);
+	pthread_cond_init(&workers->start, NULL);
+	pthread_cond_init(&workers->done, NULL);
+	group->workers = workers;
+
+	for (i = 0; i < group->count; i++) {
+		WORKER_T *arg = malloc(sizeof(WORKER_T));
+		if (!arg)
+			break;
+		arg->workers = workers;
+		arg->index = i;
+		if (pthread_create(&workers->thread[i], NULL, group_thread, arg)
+				!= 0) {
+			free(arg);
+			break;
+		}
+		workers->threads++;
+	}
+
+	if (workers->threads != group->count) {
+		error("Failed to create capture threads");
+		stop_workers(group);
+		return (LIBUSB_ERROR_OTHER);
+	}
+
+	return (LIBUSB_SUCCESS);
+}
+
+// Open simulated scopes set by OWON_SIM instead, without a context
+static int open_sims(OWON_GROUP_T *group, OWON_SIM_T *sim,
+		const unsigned scopes) {
+
+	int error_code = LIBUSB_SUCCESS;
+	unsigned i;
+
+	for (i = 0; i < scopes && group->count < OWON_MAX_DEVICES; i++) {
+		OWON_SCOPE_T *scope = &group->scope[group->count];
+		error_code = owon_open_sim(scope, sim);
+		if (error_code != LIBUSB_SUCCESS)
+			break;
+		snprintf((char *) scope->serial, sizeof(scope->serial), "SIM%u", i);
+		group->count++;
+		sim->seed++;
+	}
+
+	if (error_code == LIBUSB_SUCCESS && group->count == 0)
+		error_code = LIBUSB_ERROR_NO_DEVICE;
+	if (error_code == LIBUSB_SUCCESS)
+		error_code = start_workers(group);
+	if (error_code != LIBUSB_SUCCESS)
+		owon_close_all(group);
+
+	return (error_code);
+}
+
+/**
+ * Open every attached scope
+ *
+ * All scopes share one libusb context and get a capture thread each.
+ * Scopes that fail to open (busy or claimed by another process) are
+ * skipped, on error nothing is left open.
+ * With the OWON_SIM environment variable set simulated scopes are opened
+ * instead, see owon_open_sim().
+ *
+ * @param group		Group struct to be initialised
+ * @return
+ * 				- 0 Success, group->count scopes opened
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_open_all(OWON_GROUP_T *group) {
+
+	libusb_device **devices;
+	struct libusb_device_descriptor descriptor;
+	OWON_SIM_T sim;
+	unsigned scopes;
+	ssize_t total;
+	ssize_t i;
+	int error_code;
+
+	memset(group, 0, sizeof(OWON_GROUP_T));
+
+	if (sim_environment(&sim, &scopes))
+		return (open_sims(group, &sim, scopes));
+
+	error_code = libusb_init(&group->context);
+	if (error_code != LIBUSB_SUCCESS)
+		return (error_code);
+
+	total = libusb_get_device_list(group->context, &devices);
+	if (total < 0) {
+		owon_close_all(group);
+		return ((int) total);
+	}
+
+	for (i = 0; i < total && group->count < OWON_MAX_DEVICES; i++) {
+		if (libusb_get_device_descriptor(devices[i], &descriptor)
+				!= LIBUSB_SUCCESS)
+			continue;
+		if (descriptor.idVendor != USB_VID || descriptor.idProduct != USB_PID)
+			continue;
+
+		// One bad scope does not stop the others
+		OWON_SCOPE_T *scope = &group->scope[group->count];
+		scope->context = group->context;
+		if (open_handle(scope, devices[i]) != LIBUSB_SUCCESS) {
+			close_device(scope);
+			memset(scope, 0, sizeof(OWON_SCOPE_T));
+			continue;
+		}
+		describe_handle(scope->handle, scope->manufacturer, scope->product,
+				scope->serial);
+		group->count++;
+	}
+	libusb_free_device_list(devices, 1);
+
+	error_code = group->count ? start_workers(group) : LIBUSB_ERROR_NO_DEVICE;
+	if (error_code != LIBUSB_SUCCESS)
+		owon_close_all(group);
+
+	return (error_code);
+}
+
+/**
+ * Capture data from every scope in parallel
+ *
+ * Returns once all scopes have been read, the result of each is in
+ * group->error[] and the capture time in group->scope[].timestamp.
+ *
+ * @param group		Opened group struct
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error from a scope
+ * 				- <0 libusb error from a scope
+ *
+ */
+LIBOWONPDS_EXPORT int owon_read_all(OWON_GROUP_T *group) {
+
+	struct owon_group *workers = group->workers;
+	unsigned i;
+
+	if (!workers)
+		return (LIBUSB_ERROR_NO_DEVICE);
+
+	pthread_mutex_lock(&workers->mutex);
+	workers->generation++;
+	workers->remaining = group->count;
+	pthread_cond_broadcast(&workers->start);
+	while (workers->remaining)
+		pthread_cond_wait(&workers->done, &workers->mutex);
+	pthread_mutex_unlock(&workers->mutex);
+
+	for (i = 0; i < group->count; i++) {
+		if (group->error[i] != LIBUSB_SUCCESS)
+			return (group->error[i]);
+	}
+
+	return (LIBUSB_SUCCESS);
+}
+
+/**
+ * Close every scope in a group
+ *
+ * @param group		Group struct
+ *
+ */
+LIBOWONPDS_EXPORT void owon_close_all(OWON_GROUP_T *group) {
+
+	unsigned i;
+
+	if (!group)
+		return;
+
+	stop_workers(group);
+	for (i = 0; i < group->count; i++)
+		close_device(&group->scope[i]);
+	group->count = 0;
+	if (group->context) {
+		libusb_exit(group->context);
+		group->context = NULL;
+	}
+}
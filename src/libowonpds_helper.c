@@ -21,25 +21,459 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <png.h>
 #include <pngconf.h>
+#include <math.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "libowonpds.h"
+#include "libowonpds_helper.h"
+#include "libowonpds_internal.h"
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
-void png_close(png_structp *png, FILE *file) {
+#define CSV_FIELD_MAX 32			// Longest formatted value
+#define CSV_SCALED_MAX 1e15			// Largest value formatted without snprintf
+#define CSV_TIE_EPSILON 1e-15		// Relative error of a scaled value
+#define CSV_BLOCK_ROWS 16384		// Rows formatted per block
 
-	png_destroy_write_struct(png, (png_infopp) NULL);
+/*
+ * Binary capture (owon_write_bin)
+ *
+ * Values are little endian, int16 sample data starts on a BIN_ALIGN
+ * boundary
+ *
+ * File Header
+ *		char      magic[4];         0	"OWNB"
+ *		uint16_t  version;          4
+ *		uint16_t  headerSize;       6
+ *		uint16_t  channelSize;      8
+ *		uint16_t  channelCount;     10
+ *		uint32_t  fileLength;       12	Length of the capture on the scope
+ *		uint64_t  timestamp;        16
+ *		char      name[8];          24
+ *		uint64_t  length;           32	Length of this file
+ *
+ * Channel n (at headerSize + n * channelSize)
+ *		char      name[4];          0
+ *		uint32_t  samples;          4
+ *		double    timebase;         8
+ *		double    slow;             16
+ *		double    sampleRate;       24
+ *		double    offset;           32
+ *		double    sensitivity;      40
+ *		double    scale;            48
+ *		uint32_t  attenuation;      56
+ *		uint16_t  encoding;         60	BIN_ENCODING_
+ *		uint64_t  dataOffset;       64
+ *		uint64_t  dataLength;       72
+ *
+ */
+#define BIN_MAGIC "OWNB"
+#define BIN_VERSION 1
+#define BIN_HEADER_SIZE 64
+#define BIN_CHANNEL_SIZE 80
+#define BIN_ALIGN 64
+#define BIN_CHUNK 4096				// Samples converted per write
+
+#define BIN_ENCODING_INT16 0		// int16_t samples
+#define BIN_ENCODING_PACKED 1		// owon_pack_samples(), read into memory
+
+#define BIN_FILE_VERSION 4
+#define BIN_FILE_HEADER_SIZE 6
+#define BIN_FILE_CHANNEL_SIZE 8
+#define BIN_FILE_CHANNELS 10
+#define BIN_FILE_SCOPE_LENGTH 12
+#define BIN_FILE_TIMESTAMP 16
+#define BIN_FILE_NAME 24
+#define BIN_FILE_LENGTH 32
+
+#define BIN_CH_NAME 0
+#define BIN_CH_SAMPLES 4
+#define BIN_CH_TIMEBASE 8
+#define BIN_CH_SLOW 16
+#define BIN_CH_SAMPLE_RATE 24
+#define BIN_CH_OFFSET 32
+#define BIN_CH_SENSITIVITY 40
+#define BIN_CH_SCALE 48
+#define BIN_CH_ATTENUATION 56
+#define BIN_CH_ENCODING 60
+#define BIN_CH_DATA_OFFSET 64
+#define BIN_CH_DATA_LENGTH 72
+
+void png_close(png_structp *png, png_infop *info, FILE *file) {
+
+	png_destroy_write_struct(png, info);
 	fclose(file);
 
 }
 
+// Format a value with a fixed number of decimals, independent of locale
+// Returns the length written, at most CSV_FIELD_MAX
+size_t format_fixed(char *out, const double value, const unsigned decimals) {
+
+	static const double POWER[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+			1e8, 1e9, 1e10, 1e11, 1e12 };
+	char digits[24];
+	double scaled = fabs(value) * POWER[decimals];
+	size_t length = 0;
+	size_t count = 0;
+
+	// Out of range for the integer path
+	if (!(scaled < CSV_SCALED_MAX)) {
+		int written = snprintf(out, CSV_FIELD_MAX, "%.17g", value);
+		size_t i;
+		for (i = 0; i < (size_t) written; i++) {
+			if (out[i] == ',')
+				out[i] = '.';
+		}
+		return ((size_t) written);
+	}
+
+	uint64_t rounded = (uint64_t) (scaled + 0.5);
+
+	// Near a tie the product may have rounded the wrong way,
+	// decide from the exact value as printf does (ties to even)
+	double fraction = scaled - floor(scaled);
+	if (fabs(fraction - 0.5) <= scaled * CSV_TIE_EPSILON) {
+		double magnitude = fabs(value);
+		double below = fma(magnitude, POWER[decimals],
+				-((double) rounded - 0.5));
+		double above = fma(magnitude, POWER[decimals],
+				-((double) rounded + 0.5));
+		if (below < 0 || (below == 0 && (rounded & 1)))
+			rounded--;
+		else if (above > 0 || (above == 0 && (rounded & 1)))
+			rounded++;
+	}
+
+	if (signbit(value))
+		out[length++] = '-';
+
+	// Digits in reverse, at least one before the point
+	do {
+		digits[count++] = (char) ('0' + rounded % 10);
+		rounded /= 10;
+	} while (rounded || count <= decimals);
+
+	while (count > decimals)
+		out[length++] = digits[--count];
+	if (decimals) {
+		out[length++] = '.';
+		while (count)
+			out[length++] = digits[--count];
+	}
+
+	return (length);
+}
+
+// Format rows of channel data, returning the length written
+size_t format_rows(const OWON_SCOPE_T *scope, const uint32_t first,
+		const uint32_t last, char *out) {
+
+	char *current = out;
+	char time[OWON_MAX_CHANNELS][CSV_FIELD_MAX];
+	size_t time_len[OWON_MAX_CHANNELS];
+	uint32_t formatted[OWON_MAX_CHANNELS];
+	unsigned column[OWON_MAX_CHANNELS];
+	uint32_t i;
+	unsigned j, k;
+
+	// Channels usually share a sample rate, and with it a time column
+	// formatted once a row
+	for (j = 0; j < scope->channel_count; j++) {
+		column[j] = j;
+		formatted[j] = 0;
+		for (k = 0; k < j; k++) {
+			if (scope->channel[k].sample_rate
+					== scope->channel[j].sample_rate) {
+				column[j] = column[k];
+				break;
+			}
+		}
+	}
+
+	for (i = first; i < last; i++) {
+		for (j = 0; j < scope->channel_count; j++) {
+			const OWON_CHANNEL_T *channel = &scope->channel[j];
+			if (i < channel->samples) {
+				k = column[j];
+				if (formatted[k] != i + 1) {
+					time_len[k] = format_fixed(time[k],
+							i / channel->sample_rate, 12);
+					formatted[k] = i + 1;
+				}
+
+				memcpy(current, time[k], time_len[k]);
+				current += time_len[k];
+				*current++ = ',';
+				*current++ = ' ';
+				current += format_fixed(current,
+						channel->data[i] * channel->scale, 6);
+				if (j < scope->channel_count - 1) {
+					*current++ = ',';
+					*current++ = ' ';
+				}
+			}
+		}
+		*current++ = '\n';
+	}
+
+	return ((size_t) (current - out));
+}
+
+// Block of rows formatted by a thread
+typedef struct {
+	pthread_t thread;
+	const OWON_SCOPE_T *scope;
+	bool thread_started;
+	uint32_t first;
+	uint32_t last;
+	char *buffer;
+	size_t length;
+} CSV_BLOCK_T;
+
+static void *format_thread(void *arg) {
+
+	CSV_BLOCK_T *block = arg;
+	block->length = format_rows(block->scope, block->first, block->last,
+			block->buffer);
+
+	return (NULL);
+}
+
+// Store a little endian value
+void put_le(unsigned char *to, uint64_t value, const size_t length) {
+
+	size_t i;
+	for (i = 0; i < length; i++) {
+		to[i] = (unsigned char) value;
+		value >>= 8;
+	}
+}
+
+// Load a little endian value
+uint64_t get_le(const unsigned char *from, const size_t length) {
+
+	uint64_t value = 0;
+	size_t i;
+	for (i = length; i > 0; i--)
+		value = value << 8 | from[i - 1];
+
+	return (value);
+}
+
+static void put_double(unsigned char *to, const double value) {
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put_le(to, bits, sizeof(bits));
+}
+
+static double get_double(const unsigned char *from) {
+
+	uint64_t bits = get_le(from, sizeof(bits));
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+
+	return (value);
+}
+
+// Free the packed samples of channels
+static void free_packed(unsigned char **packed, const unsigned count) {
+
+	unsigned i;
+	for (i = 0; i < count; i++)
+		free(packed[i]);
+}
+
+// Round up to the sample alignment of binary captures
+static uint64_t bin_align(const uint64_t offset) {
+
+	return ((offset + BIN_ALIGN - 1) / BIN_ALIGN * BIN_ALIGN);
+}
+
+// Map a file read only
+static int map_file(const char *filename, void **map, size_t *length) {
+
+	*map = NULL;
+	*length = 0;
+
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+	LARGE_INTEGER size;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (ENOENT);
+
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0
+			|| (uint64_t) size.QuadPart > SIZE_MAX) {
+		CloseHandle(file);
+		return (OWON_ERROR_FORMAT);
+	}
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return (EIO);
+
+	*map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!*map)
+		return (EIO);
+	*length = (size_t) size.QuadPart;
+#else
+	int file;
+	struct stat status;
+
+	errno = 0;
+	file = open(filename, O_RDONLY);
+	if (file < 0)
+		return errno;
+
+	if (fstat(file, &status) != 0) {
+		int error_code = errno;
+		close(file);
+		return (error_code);
+	}
+	if (status.st_size <= 0 || (uint64_t) status.st_size > SIZE_MAX) {
+		close(file);
+		return (OWON_ERROR_FORMAT);
+	}
+
+	*map = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, file,
+			0);
+	close(file);
+	if (*map == MAP_FAILED) {
+		*map = NULL;
+		return errno;
+	}
+	*length = (size_t) status.st_size;
+#endif
+
+	return (0);
+}
+
+static void unmap_file(void *map, const size_t length) {
+
+#if defined(_WIN32)
+	(void) length;
+	UnmapViewOfFile(map);
+#else
+	munmap(map, length);
+#endif
+}
+
+// Point the channels of a scope at the samples of a mapped binary capture
+static bool decode_bin(OWON_SCOPE_T *scope, const unsigned char *map,
+		const size_t length) {
+
+	const uint16_t probe = 1;
+	bool little = *(const unsigned char *) &probe;
+	unsigned header_size;
+	unsigned channel_size;
+	unsigned count;
+	unsigned i;
+
+	if (length < BIN_HEADER_SIZE
+			|| memcmp(map, BIN_MAGIC, sizeof(BIN_MAGIC) - 1) != 0
+			|| get_le(&map[BIN_FILE_VERSION], 2) != BIN_VERSION)
+		return (false);
+
+	header_size = (unsigned) get_le(&map[BIN_FILE_HEADER_SIZE], 2);
+	channel_size = (unsigned) get_le(&map[BIN_FILE_CHANNEL_SIZE], 2);
+	count = (unsigned) get_le(&map[BIN_FILE_CHANNELS], 2);
+	if (header_size < BIN_HEADER_SIZE || channel_size < BIN_CHANNEL_SIZE
+			|| count > OWON_MAX_CHANNELS
+			|| length < header_size + (size_t) count * channel_size)
+		return (false);
+
+	memcpy(scope->name, &map[BIN_FILE_NAME], OWON_SCOPE_NAME_LEN);
+	scope->name[OWON_SCOPE_NAME_LEN] = '\0';
+	scope->type = OWON_TYPE_VECTOR;
+	scope->file_length = (uint32_t) get_le(&map[BIN_FILE_SCOPE_LENGTH], 4);
+	scope->timestamp = get_le(&map[BIN_FILE_TIMESTAMP], 8);
+
+	for (i = 0; i < count; i++) {
+		const unsigned char *desc = &map[header_size + i * channel_size];
+		OWON_CHANNEL_T *channel = &scope->channel[i];
+		uint32_t samples = (uint32_t) get_le(&desc[BIN_CH_SAMPLES], 4);
+		uint64_t offset = get_le(&desc[BIN_CH_DATA_OFFSET], 8);
+		uint64_t data_length = get_le(&desc[BIN_CH_DATA_LENGTH], 8);
+		uint64_t encoding = get_le(&desc[BIN_CH_ENCODING], 2);
+
+		if (offset > length)
+			return (false);
+		if (encoding == BIN_ENCODING_PACKED) {
+			if (data_length > length - offset)
+				return (false);
+		} else if (encoding != BIN_ENCODING_INT16 || offset % sizeof(int16_t)
+				|| (uint64_t) samples * sizeof(int16_t) > length - offset)
+			return (false);
+
+		memcpy(channel->name, &desc[BIN_CH_NAME], OWON_CHANNEL_NAME_LEN);
+		channel->name[OWON_CHANNEL_NAME_LEN] = '\0';
+		channel->samples = samples;
+		channel->timebase = get_double(&desc[BIN_CH_TIMEBASE]);
+		channel->slow = get_double(&desc[BIN_CH_SLOW]);
+		channel->sample_rate = get_double(&desc[BIN_CH_SAMPLE_RATE]);
+		channel->offset = get_double(&desc[BIN_CH_OFFSET]);
+		channel->sensitivity = get_double(&desc[BIN_CH_SENSITIVITY]);
+		channel->scale = get_double(&desc[BIN_CH_SCALE]);
+		channel->attenuation = (unsigned) get_le(&desc[BIN_CH_ATTENUATION], 4);
+		channel->converted = false;
+		channel->measure.valid = false;
+
+		// Samples are used in place, unless packed or the host is big endian
+		if (encoding == BIN_ENCODING_PACKED) {
+			channel->data = reserve(channel->data, &channel->data_size,
+					sizeof(int16_t) * samples);
+			if (!channel->data
+					|| owon_unpack_samples(channel->data, samples, map + offset,
+							(size_t) data_length) != 0)
+				return (false);
+		} else if (little) {
+			if (channel->data_size)
+				free(channel->data);
+			channel->data = (int16_t *) (map + offset);
+			channel->data_size = 0;
+		} else {
+			channel->data = reserve(channel->data, &channel->data_size,
+					sizeof(int16_t) * samples);
+			if (!channel->data)
+				return (false);
+			copy_samples(channel->data, map + offset, samples);
+		}
+		if (scope->options & OWON_OPT_MEASURE)
+			measure_channel(channel);
+		scope->channel_count = i + 1;
+	}
+
+	return (true);
+}
+
 /**
  * Write channel data to a CSV file
  *
@@ -56,15 +490,46 @@ void png_close(png_structp *png, FILE *file) {
 LIBOWONPDS_EXPORT int owon_write_csv(const OWON_SCOPE_T *scope,
 		const char* filename, const bool verbose) {
 
+	return (owon_write_csv_threaded(scope, filename, verbose, 1));
+}
+
+/**
+ * Write channel data to a CSV file, formatting on several threads
+ *
+ * Rows are formatted in blocks, one per thread, and written in order.
+ *
+ * @param scope		Scope structure
+ * @param filename	Filename
+ * @param verbose 	Include scope information
+ * @param threads	Number of formatting threads
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_csv_threaded(const OWON_SCOPE_T *scope,
+		const char* filename, const bool verbose, const unsigned threads) {
+
 	if (scope->type != OWON_TYPE_VECTOR)
 		return (OWON_ERROR_FORMAT);
 
 	FILE *file;
+	CSV_BLOCK_T *blocks;
+	unsigned count = MAX(threads, 1);
+	int error_code = 0;
+
+	blocks = calloc(count, sizeof(CSV_BLOCK_T));
+	if (!blocks)
+		return (ENOMEM);
 
 	errno = 0;
 	file = fopen(filename, "w");
-	if (!file)
+	if (!file) {
+		free(blocks);
 		return errno;
+	}
 
 	if (verbose) {
 		fprintf(file, "Device, %s\n", scope->name);
@@ -81,23 +546,54 @@ LIBOWONPDS_EXPORT int owon_write_csv(const OWON_SCOPE_T *scope,
 	}
 	fprintf(file, "\n");
 
-	unsigned j;
-	for (i = 0; i < max_len; i++) {
-		for (j = 0; j < scope->channel_count; j++) {
-			OWON_CHANNEL_T channel = scope->channel[j];
-			double time = i / channel.sample_rate;
-			if (i < channel.samples) {
-				fprintf(file, "%.12f, %f", time, channel.vector[i]);
-				if (j < scope->channel_count - 1)
-					fprintf(file, ", ");
+	size_t row_max = scope->channel_count * (2 * CSV_FIELD_MAX + 4) + 1;
+	for (i = 0; i < count; i++) {
+		blocks[i].scope = scope;
+		blocks[i].buffer = malloc(row_max * CSV_BLOCK_ROWS);
+		if (!blocks[i].buffer)
+			error_code = ENOMEM;
+	}
+
+	uint32_t row = 0;
+	while (row < max_len && !error_code) {
+		unsigned used;
+
+		for (used = 0; used < count && row < max_len; used++) {
+			CSV_BLOCK_T *block = &blocks[used];
+			block->first = row;
+			block->last = MIN(max_len, row + CSV_BLOCK_ROWS);
+			row = block->last;
+		}
+
+		// The calling thread formats the first block
+		for (i = 1; i < used; i++) {
+			if (pthread_create(&blocks[i].thread, NULL, format_thread,
+					&blocks[i]) != 0)
+				format_thread(&blocks[i]);
+			else
+				blocks[i].thread_started = true;
+		}
+		format_thread(&blocks[0]);
+
+		for (i = 0; i < used; i++) {
+			if (blocks[i].thread_started) {
+				pthread_join(blocks[i].thread, NULL);
+				blocks[i].thread_started = false;
 			}
+			if (fwrite(blocks[i].buffer, 1, blocks[i].length, file)
+					!= blocks[i].length)
+				error_code = errno ? errno : EIO;
 		}
-		fprintf(file, "\n");
 	}
 
-	fclose(file);
+	for (i = 0; i < count; i++)
+		free(blocks[i].buffer);
+	free(blocks);
 
-	return errno;
+	if (fclose(file) && !error_code)
+		error_code = errno ? errno : EIO;
+
+	return (error_code);
 }
 
 /**
@@ -115,50 +611,590 @@ LIBOWONPDS_EXPORT int owon_write_csv(const OWON_SCOPE_T *scope,
 LIBOWONPDS_EXPORT int owon_write_png(const OWON_SCOPE_T *scope,
 		const char* filename) {
 
+	return (owon_write_png_ex(scope, filename, NULL));
+}
+
+/**
+ * Write bitmap data to a PNG file with encoding options
+ *
+ * OWON_PNG_FAST encodes screenshots several times faster than the
+ * defaults, for slightly larger files.
+ *
+ * @param scope		Scope structure
+ * @param filename	Filename
+ * @param options	Encoding options, NULL for the defaults
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_png_ex(const OWON_SCOPE_T *scope,
+		const char* filename, const OWON_PNG_T *options) {
+
 	if (scope->type != OWON_TYPE_BITMAP)
 		return (OWON_ERROR_FORMAT);
 
 	FILE *file;
 	errno = 0;
-	file = fopen(filename, "w");
+	file = fopen(filename, "wb");
 	if (!file)
 		return errno;
 
 	png_structp png;
+	png_infop info = NULL;
 	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (png) {
-		png_infop info = png_create_info_struct(png);
+		info = png_create_info_struct(png);
 		if (info) {
 			if (setjmp(png_jmpbuf(png))) {
-				png_close(&png, file);
+				png_close(&png, &info, file);
 				return (OWON_ERROR_PNG);
 			}
 			png_init_io(png, file);
 
+			if (options) {
+				if (options->level != OWON_PNG_LEVEL_DEFAULT)
+					png_set_compression_level(png, options->level);
+				if (options->filters != OWON_PNG_FILTER_DEFAULT)
+					png_set_filter(png, PNG_FILTER_TYPE_BASE,
+							(int) options->filters);
+				if (options->strategy != OWON_PNG_STRATEGY_DEFAULT)
+					png_set_compression_strategy(png, options->strategy);
+			}
+
 			png_set_IHDR(png, info, OWON_BITMAP_WIDTH, OWON_BITMAP_HEIGHT, 8,
 			PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
 			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 			png_write_info(png, info);
 
+			// Rows straight from the capture buffer
 			png_byte *rows[OWON_BITMAP_HEIGHT];
-			int rowSize = OWON_BITMAP_WIDTH * sizeof(char)
-					* OWON_BITMAP_CHANNELS;
 			int i;
 			for (i = 0; i < OWON_BITMAP_HEIGHT; i++) {
-				rows[i] = &scope->bitmap[i * rowSize];
+				rows[i] = (png_byte *) scope->bitmap
+						+ (ptrdiff_t) i * scope->bitmap_stride;
 			}
 			png_set_bgr(png);
 			png_write_image(png, rows);
 			png_write_end(png, info);
 		} else {
-			png_close(&png, file);
+			png_close(&png, &info, file);
 			return (OWON_ERROR_PNG);
 		}
 	} else {
-		png_close(&png, file);
+		png_close(&png, &info, file);
 		return (OWON_ERROR_PNG);
 	}
 
-	png_close(&png, file);
+	png_close(&png, &info, file);
 	return (0);
 }
+
+// Queue of bitmaps shared by the encoding threads
+typedef struct {
+	pthread_mutex_t lock;
+	unsigned next;
+	unsigned count;
+	const OWON_SCOPE_T * const *scopes;
+	const char * const *filenames;
+	const OWON_PNG_T *options;
+	int *errors;
+	unsigned failed;			// Lowest index that failed
+	int error_code;
+} PNG_QUEUE_T;
+
+static void *png_thread(void *arg) {
+
+	PNG_QUEUE_T *queue = arg;
+
+	for (;;) {
+		unsigned i;
+		int error_code;
+
+		pthread_mutex_lock(&queue->lock);
+		i = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->count)
+			break;
+
+		error_code = owon_write_png_ex(queue->scopes[i], queue->filenames[i],
+				queue->options);
+		if (queue->errors)
+			queue->errors[i] = error_code;
+		if (error_code) {
+			pthread_mutex_lock(&queue->lock);
+			if (i < queue->failed) {
+				queue->failed = i;
+				queue->error_code = error_code;
+			}
+			pthread_mutex_unlock(&queue->lock);
+		}
+	}
+
+	return (NULL);
+}
+
+/**
+ * Write the bitmaps of several captures to PNG files on a thread pool
+ *
+ * @param scopes	Bitmap captures
+ * @param filenames	Filename of each capture
+ * @param count		Number of captures
+ * @param options	Encoding options, NULL for the defaults
+ * @param threads	Number of encoding threads
+ * @param errors	Result of each capture, or NULL
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error of the first capture that failed
+ * 			- <0 errno error of the first capture that failed
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_png_batch(const OWON_SCOPE_T * const *scopes,
+		const char * const *filenames, const unsigned count,
+		const OWON_PNG_T *options, const unsigned threads, int *errors) {
+
+	PNG_QUEUE_T queue;
+	pthread_t *pool;
+	unsigned started = 0;
+	unsigned workers = MIN(MAX(threads, 1), MAX(count, 1));
+	unsigned i;
+
+	pool = calloc(workers, sizeof(pthread_t));
+	if (!pool)
+		return (ENOMEM);
+
+	memset(&queue, 0, sizeof(queue));
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.count = count;
+	queue.scopes = scopes;
+	queue.filenames = filenames;
+	queue.options = options;
+	queue.errors = errors;
+	queue.failed = count;
+
+	// The calling thread encodes too
+	for (i = 1; i < workers; i++) {
+		if (pthread_create(&pool[started], NULL, png_thread, &queue) == 0)
+			started++;
+	}
+	png_thread(&queue);
+
+	for (i = 0; i < started; i++)
+		pthread_join(pool[i], NULL);
+
+	pthread_mutex_destroy(&queue.lock);
+	free(pool);
+
+	return (queue.error_code);
+}
+
+/**
+ * Write bitmap data to a BMP file
+ *
+ * The bitmap is written as sent by the scope, without converting it.
+ *
+ * @param scope		Scope structure
+ * @param filename	Filename
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_bmp(const OWON_SCOPE_T *scope,
+		const char* filename) {
+
+	if (scope->type != OWON_TYPE_BITMAP || !scope->raw
+			|| scope->raw_length < OWON_HEADER_SIZE
+			|| scope->raw_length - OWON_HEADER_SIZE < scope->file_length)
+		return (OWON_ERROR_FORMAT);
+
+	FILE *file;
+	int error_code = 0;
+
+	errno = 0;
+	file = fopen(filename, "wb");
+	if (!file)
+		return errno;
+
+	if (fwrite(scope->raw + OWON_HEADER_SIZE, 1, scope->file_length, file)
+			!= scope->file_length)
+		error_code = errno ? errno : EIO;
+
+	if (fclose(file) && !error_code)
+		error_code = errno ? errno : EIO;
+
+	return (error_code);
+}
+
+/**
+ * Write bitmap data to a binary PPM file
+ *
+ * @param scope		Scope structure
+ * @param filename	Filename
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_ppm(const OWON_SCOPE_T *scope,
+		const char* filename) {
+
+	if (scope->type != OWON_TYPE_BITMAP || !scope->bitmap)
+		return (OWON_ERROR_FORMAT);
+
+	FILE *file;
+	unsigned char row[OWON_BITMAP_WIDTH * OWON_BITMAP_CHANNELS];
+	unsigned width = scope->bitmap_width;
+	unsigned i;
+	int error_code = 0;
+
+	errno = 0;
+	file = fopen(filename, "wb");
+	if (!file)
+		return errno;
+
+	fprintf(file, "P6\n%u %u\n255\n", width, scope->bitmap_height);
+
+	for (i = 0; i < scope->bitmap_height && !error_code; i++) {
+		const unsigned char *pixel = scope->bitmap
+				+ (ptrdiff_t) i * scope->bitmap_stride;
+		unsigned j;
+
+		// BGR to RGB
+		for (j = 0; j < width; j++) {
+			row[j * 3] = pixel[j * 3 + 2];
+			row[j * 3 + 1] = pixel[j * 3 + 1];
+			row[j * 3 + 2] = pixel[j * 3];
+		}
+		if (fwrite(row, 3, width, file) != width)
+			error_code = errno ? errno : EIO;
+	}
+
+	if (fclose(file) && !error_code)
+		error_code = errno ? errno : EIO;
+
+	return (error_code);
+}
+
+/**
+ * Write the raw capture to a file
+ *
+ * The file holds the 12 byte header followed by the payload and can be
+ * replayed with owon_load_raw() or owon_decode_buffer().
+ *
+ * @param scope		Scope structure
+ * @param filename	Filename
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_raw(const OWON_SCOPE_T *scope,
+		const char* filename) {
+
+	if (!scope->raw)
+		return (OWON_ERROR_FORMAT);
+
+	FILE *file;
+	int error_code = 0;
+
+	errno = 0;
+	file = fopen(filename, "wb");
+	if (!file)
+		return errno;
+
+	if (fwrite(scope->raw, 1, scope->raw_length, file) != scope->raw_length)
+		error_code = errno ? errno : EIO;
+
+	if (fclose(file) && !error_code)
+		error_code = errno ? errno : EIO;
+
+	return (error_code);
+}
+
+/**
+ * Load and decode a raw capture file
+ *
+ * The file is kept in scope->raw, as if it had been read from the device.
+ *
+ * @param scope		Zero initialised or opened scope structure
+ * @param filename	Filename
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_load_raw(OWON_SCOPE_T *scope,
+		const char* filename) {
+
+	FILE *file;
+	long length;
+
+	errno = 0;
+	file = fopen(filename, "rb");
+	if (!file)
+		return errno;
+
+	if (fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0
+			|| fseek(file, 0, SEEK_SET) != 0) {
+		int error_code = errno ? errno : EIO;
+		fclose(file);
+		return (error_code);
+	}
+	if (length < OWON_HEADER_SIZE || length > UINT32_MAX) {
+		fclose(file);
+		return (OWON_ERROR_FORMAT);
+	}
+
+	scope->raw_length = 0;
+	scope->raw = reserve(scope->raw, &scope->raw_size, (size_t) length);
+	if (!scope->raw) {
+		fclose(file);
+		return (ENOMEM);
+	}
+
+	if (fread(scope->raw, 1, (size_t) length, file) != (size_t) length) {
+		fclose(file);
+		return (OWON_ERROR_FORMAT);
+	}
+	fclose(file);
+	scope->raw_length = (uint32_t) length;
+
+	return (owon_decode_buffer(scope, scope->raw, scope->raw_length));
+}
+
+/**
+ * Write channel data to a binary capture file
+ *
+ * The file holds the channel settings and the int16 samples, and can be
+ * opened without parsing with owon_map_bin().
+ *
+ * @param scope		Scope structure
+ * @param filename	Filename
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_bin(const OWON_SCOPE_T *scope,
+		const char* filename) {
+
+	return (owon_write_bin_ex(scope, filename, 0));
+}
+
+/**
+ * Write channel data to a binary capture file, with options
+ *
+ * With OWON_BIN_PACK the samples are packed losslessly (see
+ * owon_pack_samples()), typically to a quarter of their size or less.
+ * owon_map_bin() then unpacks them into memory rather than mapping them.
+ *
+ * @param scope		Scope structure
+ * @param filename	Filename
+ * @param flags		OWON_BIN_ flags
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_write_bin_ex(const OWON_SCOPE_T *scope,
+		const char* filename, const unsigned flags) {
+
+	if (scope->type != OWON_TYPE_VECTOR
+			|| scope->channel_count > OWON_MAX_CHANNELS)
+		return (OWON_ERROR_FORMAT);
+
+	unsigned char header[BIN_HEADER_SIZE
+			+ OWON_MAX_CHANNELS * BIN_CHANNEL_SIZE];
+	unsigned char *packed[OWON_MAX_CHANNELS];
+	uint64_t offsets[OWON_MAX_CHANNELS];
+	uint64_t lengths[OWON_MAX_CHANNELS];
+	uint64_t position;
+	unsigned count = scope->channel_count;
+	unsigned i;
+
+	memset(packed, 0, sizeof(packed));
+	memset(header, 0, sizeof(header));
+	memcpy(header, BIN_MAGIC, sizeof(BIN_MAGIC) - 1);
+	put_le(&header[BIN_FILE_VERSION], BIN_VERSION, 2);
+	put_le(&header[BIN_FILE_HEADER_SIZE], BIN_HEADER_SIZE, 2);
+	put_le(&header[BIN_FILE_CHANNEL_SIZE], BIN_CHANNEL_SIZE, 2);
+	put_le(&header[BIN_FILE_CHANNELS], count, 2);
+	put_le(&header[BIN_FILE_SCOPE_LENGTH], scope->file_length, 4);
+	put_le(&header[BIN_FILE_TIMESTAMP], scope->timestamp, 8);
+	memcpy(&header[BIN_FILE_NAME], scope->name, OWON_SCOPE_NAME_LEN);
+
+	position = BIN_HEADER_SIZE + count * BIN_CHANNEL_SIZE;
+	for (i = 0; i < count; i++) {
+		const OWON_CHANNEL_T *channel = &scope->channel[i];
+		unsigned char *desc = &header[BIN_HEADER_SIZE + i * BIN_CHANNEL_SIZE];
+
+		if (channel->samples && !channel->data) {
+			free_packed(packed, i);
+			return (OWON_ERROR_FORMAT);
+		}
+
+		if (flags & OWON_BIN_PACK) {
+			packed[i] = malloc(owon_pack_bound(channel->samples));
+			if (!packed[i]) {
+				free_packed(packed, i);
+				return (ENOMEM);
+			}
+			lengths[i] = owon_pack_samples(packed[i], channel->data,
+					channel->samples);
+		} else
+			lengths[i] = (uint64_t) channel->samples * sizeof(int16_t);
+
+		offsets[i] = bin_align(position);
+		position = offsets[i] + lengths[i];
+
+		memcpy(&desc[BIN_CH_NAME], channel->name, OWON_CHANNEL_NAME_LEN);
+		put_le(&desc[BIN_CH_SAMPLES], channel->samples, 4);
+		put_double(&desc[BIN_CH_TIMEBASE], channel->timebase);
+		put_double(&desc[BIN_CH_SLOW], channel->slow);
+		put_double(&desc[BIN_CH_SAMPLE_RATE], channel->sample_rate);
+		put_double(&desc[BIN_CH_OFFSET], channel->offset);
+		put_double(&desc[BIN_CH_SENSITIVITY], channel->sensitivity);
+		put_double(&desc[BIN_CH_SCALE], channel->scale);
+		put_le(&desc[BIN_CH_ATTENUATION], channel->attenuation, 4);
+		put_le(&desc[BIN_CH_ENCODING],
+				flags & OWON_BIN_PACK ?
+						BIN_ENCODING_PACKED : BIN_ENCODING_INT16, 2);
+		put_le(&desc[BIN_CH_DATA_OFFSET], offsets[i], 8);
+		put_le(&desc[BIN_CH_DATA_LENGTH], lengths[i], 8);
+	}
+	put_le(&header[BIN_FILE_LENGTH], position, 8);
+
+	FILE *file;
+	int16_t chunk[BIN_CHUNK];
+	static const unsigned char PADDING[BIN_ALIGN];
+	int error_code = 0;
+
+	errno = 0;
+	file = fopen(filename, "wb");
+	if (!file) {
+		error_code = errno ? errno : EIO;
+		free_packed(packed, count);
+		return (error_code);
+	}
+
+	position = BIN_HEADER_SIZE + count * BIN_CHANNEL_SIZE;
+	if (fwrite(header, 1, (size_t) position, file) != position)
+		error_code = errno ? errno : EIO;
+
+	for (i = 0; i < count && !error_code; i++) {
+		const OWON_CHANNEL_T *channel = &scope->channel[i];
+		size_t padding = (size_t) (offsets[i] - position);
+		uint32_t done = 0;
+
+		if (fwrite(PADDING, 1, padding, file) != padding)
+			error_code = errno ? errno : EIO;
+
+		if (packed[i] && !error_code
+				&& fwrite(packed[i], 1, (size_t) lengths[i], file) != lengths[i])
+			error_code = errno ? errno : EIO;
+
+		// Store the samples little endian
+		while (!packed[i] && done < channel->samples && !error_code) {
+			uint32_t length = MIN(channel->samples - done, BIN_CHUNK);
+			copy_samples(chunk, (const unsigned char *) &channel->data[done],
+					length);
+			if (fwrite(chunk, sizeof(int16_t), length, file) != length)
+				error_code = errno ? errno : EIO;
+			done += length;
+		}
+		position = offsets[i] + lengths[i];
+	}
+
+	if (fclose(file) && !error_code)
+		error_code = errno ? errno : EIO;
+	free_packed(packed, count);
+
+	return (error_code);
+}
+
+/**
+ * Map a binary capture file
+ *
+ * The channels of scope are pointed at the samples in the file, nothing
+ * is copied or parsed. The samples are valid until owon_unmap_bin() or
+ * owon_close().
+ * Volts are converted on request with owon_get_vector().
+ *
+ * @param scope		Zero initialised or opened scope structure
+ * @param filename	Filename
+ *
+ * @return
+ * 			- 0 Success
+ * 			- >0 OWON_ERROR error
+ * 			- <0 errno error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_map_bin(OWON_SCOPE_T *scope,
+		const char* filename) {
+
+	void *map = NULL;
+	size_t length = 0;
+	int error_code;
+
+	owon_unmap_bin(scope);
+
+	error_code = map_file(filename, &map, &length);
+	if (error_code)
+		return (error_code);
+
+	scope->map = map;
+	scope->map_length = length;
+	scope->raw_length = 0;
+	clear_decoded(scope);
+	if (!decode_bin(scope, map, length)) {
+		owon_unmap_bin(scope);
+		return (OWON_ERROR_FORMAT);
+	}
+
+	return (0);
+}
+
+/**
+ * Unmap a binary capture file
+ *
+ * The capture decoded from the file is cleared.
+ *
+ * @param scope		Scope structure
+ *
+ */
+LIBOWONPDS_EXPORT void owon_unmap_bin(OWON_SCOPE_T *scope) {
+
+	if (!scope->map)
+		return;
+
+	unsigned i;
+	for (i = 0; i < OWON_MAX_CHANNELS; i++) {
+		OWON_CHANNEL_T *channel = &scope->channel[i];
+		if (!channel->data_size) {
+			channel->data = NULL;
+			channel->converted = false;
+			channel->measure.valid = false;
+		}
+	}
+	clear_decoded(scope);
+
+	unmap_file(scope->map, scope->map_length);
+	scope->map = NULL;
+	scope->map_length = 0;
+}
@@ -40,10 +40,68 @@
 #include "libowonpds.h"
 #include "libowonpds_export.h"
 
+// PNG compression level
+#define OWON_PNG_LEVEL_DEFAULT -1		/**< zlib default (6) */
+
+// PNG row filters, combined to let the encoder choose per row
+#define OWON_PNG_FILTER_DEFAULT 0x00	/**< libpng default */
+#define OWON_PNG_FILTER_NONE 0x08		/**< No filter */
+#define OWON_PNG_FILTER_SUB 0x10		/**< Difference to the left pixel */
+#define OWON_PNG_FILTER_UP 0x20			/**< Difference to the pixel above */
+#define OWON_PNG_FILTER_AVG 0x40		/**< Difference to the average of left and above */
+#define OWON_PNG_FILTER_PAETH 0x80		/**< Paeth predictor */
+#define OWON_PNG_FILTER_ALL 0xF8		/**< Choose from all filters */
+
+// PNG (zlib) compression strategy
+#define OWON_PNG_STRATEGY_DEFAULT 0		/**< Default */
+#define OWON_PNG_STRATEGY_FILTERED 1	/**< Filtered data */
+#define OWON_PNG_STRATEGY_HUFFMAN 2		/**< Huffman coding only */
+#define OWON_PNG_STRATEGY_RLE 3			/**< Run length matches only */
+
+// Binary capture options
+#define OWON_BIN_PACK 0x01		/**< Pack the samples losslessly */
+
+/**
+ * PNG encoding options
+ */
+typedef struct {
+	int level;			/**< Compression level 0-9, or OWON_PNG_LEVEL_DEFAULT */
+	unsigned filters;	/**< OWON_PNG_FILTER_ mask */
+	int strategy;		/**< OWON_PNG_STRATEGY_ */
+} OWON_PNG_T;
+
+/** Initialiser for libpng's default encoding */
+#define OWON_PNG_DEFAULT { OWON_PNG_LEVEL_DEFAULT, OWON_PNG_FILTER_DEFAULT, \
+	OWON_PNG_STRATEGY_DEFAULT }
+/** Initialiser for fast encoding of screenshots (flat colours) */
+#define OWON_PNG_FAST { 1, OWON_PNG_FILTER_NONE, OWON_PNG_STRATEGY_RLE }
+
 LIBOWONPDS_EXPORT int owon_write_csv(const OWON_SCOPE_T *scope,
 		const char* filename, const bool verbose);
+LIBOWONPDS_EXPORT int owon_write_csv_threaded(const OWON_SCOPE_T *scope,
+		const char* filename, const bool verbose, const unsigned threads);
 LIBOWONPDS_EXPORT int owon_write_png(const OWON_SCOPE_T *scope,
 		const char* filename);
+LIBOWONPDS_EXPORT int owon_write_png_ex(const OWON_SCOPE_T *scope,
+		const char* filename, const OWON_PNG_T *options);
+LIBOWONPDS_EXPORT int owon_write_png_batch(const OWON_SCOPE_T * const *scopes,
+		const char * const *filenames, const unsigned count,
+		const OWON_PNG_T *options, const unsigned threads, int *errors);
+LIBOWONPDS_EXPORT int owon_write_bmp(const OWON_SCOPE_T *scope,
+		const char* filename);
+LIBOWONPDS_EXPORT int owon_write_ppm(const OWON_SCOPE_T *scope,
+		const char* filename);
+LIBOWONPDS_EXPORT int owon_write_raw(const OWON_SCOPE_T *scope,
+		const char* filename);
+LIBOWONPDS_EXPORT int owon_load_raw(OWON_SCOPE_T *scope,
+		const char* filename);
+LIBOWONPDS_EXPORT int owon_write_bin(const OWON_SCOPE_T *scope,
+		const char* filename);
+LIBOWONPDS_EXPORT int owon_write_bin_ex(const OWON_SCOPE_T *scope,
+		const char* filename, const unsigned flags);
+LIBOWONPDS_EXPORT int owon_map_bin(OWON_SCOPE_T *scope,
+		const char* filename);
+LIBOWONPDS_EXPORT void owon_unmap_bin(OWON_SCOPE_T *scope);
 
 #endif /* LIBOWONPDS_HELPER_H_ */
 
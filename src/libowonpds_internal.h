@@ -0,0 +1,214 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Internal interfaces shared between the library modules
+ * (not installed, not exported)
+ *
+ */
+
+#ifndef LIBOWONPDS_INTERNAL_H_
+#define LIBOWONPDS_INTERNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libowonpds.h"
+
+#define USB_VID 0x5345
+#define USB_PID 0x1234
+
+#define USB_CONFIG 1
+#define USB_INTERFACE 0
+
+#define WRITE_ENDPOINT	0x03
+#define READ_ENDPOINT  0x81
+
+#define TIMEOUT 2000
+
+#define CMD_START "START"
+
+// Atomic access for data shared between threads
+#if defined(_MSC_VER)
+#define ATOMIC_LOAD(p) (*(volatile const unsigned *)(p))
+#define ATOMIC_STORE(p, v) (*(volatile unsigned *)(p) = (v))
+#else
+#define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+// Scale int16 samples by a factor
+typedef void (*SCALE_FN)(double *vector, const int16_t *data,
+		const uint32_t length, const double scale);
+typedef void (*SCALE_FLOAT_FN)(float *vector, const int16_t *data,
+		const uint32_t length, const float scale);
+
+// Running minimum, maximum and sums of samples
+typedef struct {
+	int16_t min;
+	int16_t max;
+	int64_t sum;
+	uint64_t squares;
+} SAMPLE_SUMS_T;
+
+// Add samples to running sums
+typedef void (*SUMS_FN)(SAMPLE_SUMS_T *sums, const int16_t *data,
+		const uint32_t length);
+
+// Radix-2 butterflies of split complex values, x0 + w x1 and x0 - w x1
+typedef void (*BUTTERFLY_FN)(double *re0, double *im0, double *re1,
+		double *im1, const double *w_re, const double *w_im,
+		const uint32_t length);
+
+// Zigzag coded differences of samples from the sample before, returning
+// the bits set in any
+typedef uint16_t (*DELTA_FN)(uint16_t *values, const int16_t *data,
+		const uint32_t length, const int16_t previous);
+
+// Samples from zigzag coded differences, the inverse of DELTA_FN
+typedef void (*UNDELTA_FN)(int16_t *data, const uint16_t *values,
+		const uint32_t length, const int16_t previous);
+
+// Add samples to running sums, an exponential average, the extremes and
+// the largest magnitudes
+typedef void (*ACCUMULATE_FN)(double *sum, double *average, int16_t *min,
+		int16_t *max, int16_t *peak, const int16_t *data,
+		const uint32_t length, const double alpha);
+
+// CRC32C of data continuing from a previous CRC, 0 to start
+typedef uint32_t (*CRC_FN)(uint32_t crc, const unsigned char *data,
+		size_t length);
+
+// Transport to a scope other than a libusb device, see owon_open_sim()
+struct owon_link {
+	// Bulk transfer, as libusb_bulk_transfer()
+	int (*transfer)(struct owon_link *link, const unsigned char endpoint,
+			unsigned char *data, const int length, int *transferred,
+			const unsigned timeout);
+	void (*reset)(struct owon_link *link);
+	void (*close)(struct owon_link *link);
+};
+
+// Capture decoded as it arrives, see decode_partial()
+typedef struct {
+	uint32_t current;			// Payload offset of the next channel block
+	bool vector;				// Vector capture, decoded a block at a time
+	bool done;					// No more channel blocks
+} DECODER_T;
+
+// Capture checked against the last, see dedup_begin()
+typedef struct {
+	struct owon_dedup *last;	// Checksums of the last capture
+	bool enabled;				// OWON_OPT_DEDUP set
+	bool matching;				// Same as the last capture so far
+	uint32_t crc;				// CRC32C of the bytes hashed
+	uint32_t hashed;			// Bytes hashed
+	uint32_t checkpoints;		// Checkpoints passed
+	uint32_t previous;			// Checkpoints of the last capture
+	unsigned channels;			// Channels of the last capture that can be kept
+} DEDUP_T;
+
+// Vectorised kernels
+typedef struct {
+	const char *name;
+	SCALE_FN scale;
+	SCALE_FLOAT_FN scale_float;
+	SUMS_FN sums;
+	BUTTERFLY_FN butterfly;
+	DELTA_FN delta;
+	UNDELTA_FN undelta;
+	CRC_FN crc;
+	ACCUMULATE_FN accumulate;
+} SIMD_KERNELS_T;
+
+const SIMD_KERNELS_T *simd_kernels(void);
+const SIMD_KERNELS_T *simd_reference(void);
+
+uint64_t stats_time(const OWON_SCOPE_T *scope);
+void stats_begin(OWON_SCOPE_T *scope);
+void stats_add(OWON_SCOPE_T *scope, const unsigned stage, const uint64_t time);
+void stats_stage(OWON_SCOPE_T *scope, const unsigned stage,
+		const uint64_t start);
+void stats_transfer(OWON_SCOPE_T *scope, const int error_code,
+		const int transferred);
+void stats_capture(OWON_SCOPE_T *scope, const uint64_t timestamp);
+void stats_merge(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture);
+
+void error(const char *message);
+uint64_t wall_time(void);
+void sleep_ms(const unsigned ms);
+void sleep_until(const uint64_t time);
+void *reserve(void *buffer, size_t *size, const size_t length);
+uint32_t data_to_uint(const unsigned char* from, const size_t length);
+void put_le(unsigned char *to, uint64_t value, const size_t length);
+uint64_t get_le(const unsigned char *from, const size_t length);
+void copy_samples(int16_t *samples, const unsigned char *data,
+		const uint32_t length);
+void store_samples(unsigned char *data, const int16_t *samples,
+		const uint32_t length);
+uint32_t header_file_length(const unsigned char *header);
+unsigned find_samples(const unsigned char *raw, const size_t length,
+		uint32_t *offsets, uint32_t *samples);
+bool is_open(const OWON_SCOPE_T *scope);
+int transfer(OWON_SCOPE_T *scope, const unsigned char endpoint,
+		unsigned char *data, const int length, int *transferred,
+		const unsigned timeout);
+int open_handle(OWON_SCOPE_T *scope, libusb_device *device);
+void describe_handle(libusb_device_handle *handle,
+		unsigned char *manufacturer, unsigned char *product,
+		unsigned char *serial);
+void release_handle(OWON_SCOPE_T *scope);
+void close_device(OWON_SCOPE_T *scope);
+int acquire_context(OWON_SCOPE_T *scope);
+void release_context(OWON_SCOPE_T *scope);
+int open_device(OWON_SCOPE_T *scope, const OWON_SELECT_T *select);
+bool sim_environment(OWON_SIM_T *sim, unsigned *scopes);
+unsigned char *generate_vector(const char variant, const unsigned channels,
+		const uint32_t samples, const unsigned frame, size_t *length);
+unsigned char *generate_bitmap(size_t *length);
+int read_capture(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture);
+int read_payload(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture,
+		DEDUP_T *dedup, const uint32_t length);
+void dedup_begin(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture,
+		DEDUP_T *dedup);
+bool dedup_update(DEDUP_T *dedup, const unsigned char *raw,
+		const size_t received, const bool final);
+void dedup_keep(OWON_SCOPE_T *capture, const DEDUP_T *dedup);
+void dedup_end(OWON_SCOPE_T *capture, const DEDUP_T *dedup,
+		const bool success);
+void dedup_clear(OWON_SCOPE_T *scope);
+void dedup_detach(OWON_SCOPE_T *scope);
+void dedup_free(OWON_SCOPE_T *scope);
+bool scale_vector(OWON_CHANNEL_T *channel);
+void measure_channel(OWON_CHANNEL_T *channel);
+bool decode_channel(OWON_SCOPE_T *scope, const unsigned char *data);
+bool decode_bitmap(OWON_SCOPE_T *scope, const unsigned char *data);
+int decode_partial(OWON_SCOPE_T *scope, DECODER_T *decoder,
+		const unsigned char *buffer, const size_t received, const bool final);
+int decode_raw(OWON_SCOPE_T *scope, const unsigned char *buffer,
+		const size_t length);
+void clear_decoded(OWON_SCOPE_T *scope);
+
+#endif /* LIBOWONPDS_INTERNAL_H_ */
@@ -0,0 +1,199 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+// Edge levels, fractions of peak to peak
+#define MEASURE_LOW 0.1
+#define MEASURE_MIDDLE 0.5
+#define MEASURE_HIGH 0.9
+
+// Crossings of the edge levels, in samples
+typedef struct {
+	double low_up;			// Last rising crossing of low, or -1
+	double middle_up;		// Last rising crossing of middle
+	double high_down;		// Last falling crossing of high, or -1
+	double middle_down;		// Last falling crossing of middle
+	double first;			// First counted rising edge
+	double last;			// Last counted rising edge
+	unsigned edges;			// Rising edges counted
+	double high;			// Time above middle in complete periods
+	double pending;			// Time above middle since the last edge
+	double rise;			// Total rise time
+	unsigned rises;
+	double fall;			// Total fall time
+	unsigned falls;
+} EDGES_T;
+
+// Position a level is crossed between samples i - 1 and i
+static double crossing(const int16_t *data, const uint32_t i,
+		const double level) {
+
+	double previous = data[i - 1];
+
+	return (i - 1 + (level - previous) / (data[i] - previous));
+}
+
+// Find the edges of the samples, switching state at the low and high
+// levels so noise around the middle is not counted
+static void find_edges(EDGES_T *edges, const int16_t *data,
+		const uint32_t length, const double low, const double middle,
+		const double high) {
+
+	// Samples are integers, so compare with the levels rounded up
+	int low_step = (int) ceil(low);
+	int middle_step = (int) ceil(middle);
+	int high_step = (int) ceil(high);
+	bool above = data[0] >= middle_step;
+	int zone = (data[0] >= low_step) + (data[0] >= middle_step)
+			+ (data[0] >= high_step);
+	uint32_t i;
+
+	for (i = 1; i < length; i++) {
+		// Levels at or below the sample, most samples stay in one zone
+		int next = (data[i] >= low_step) + (data[i] >= middle_step)
+				+ (data[i] >= high_step);
+		if (next == zone)
+			continue;
+
+		double previous = data[i - 1];
+		double current = data[i];
+		zone = next;
+
+		if (current > previous) {
+			if (previous < low && current >= low)
+				edges->low_up = crossing(data, i, low);
+			if (previous < middle && current >= middle)
+				edges->middle_up = crossing(data, i, middle);
+			if (previous < high && current >= high) {
+				if (edges->low_up >= 0) {
+					edges->rise += crossing(data, i, high) - edges->low_up;
+					edges->rises++;
+					edges->low_up = -1;
+				}
+				if (!above) {
+					above = true;
+					if (edges->edges++ == 0)
+						edges->first = edges->middle_up;
+					else
+						edges->high += edges->pending;
+					edges->last = edges->middle_up;
+					edges->pending = 0;
+				}
+			}
+		} else {
+			if (previous >= high && current < high)
+				edges->high_down = crossing(data, i, high);
+			if (previous >= middle && current < middle)
+				edges->middle_down = crossing(data, i, middle);
+			if (previous >= low && current < low) {
+				if (edges->high_down >= 0) {
+					edges->fall += crossing(data, i, low) - edges->high_down;
+					edges->falls++;
+					edges->high_down = -1;
+				}
+				if (above) {
+					above = false;
+					if (edges->edges)
+						edges->pending = edges->middle_down - edges->last;
+				}
+			}
+		}
+	}
+}
+
+// Measure the samples of a channel
+void measure_channel(OWON_CHANNEL_T *channel) {
+
+	OWON_MEASURE_T *measure = &channel->measure;
+	uint32_t length = channel->samples;
+	SAMPLE_SUMS_T sums = { INT16_MAX, INT16_MIN, 0, 0 };
+	EDGES_T edges;
+	double pp;
+
+	measure->min = measure->max = measure->vpp = NAN;
+	measure->mean = measure->rms = NAN;
+	measure->frequency = measure->period = NAN;
+	measure->rise = measure->fall = measure->duty = NAN;
+	measure->cycles = 0;
+	measure->valid = true;
+	if (!length || !channel->data)
+		return;
+
+	simd_kernels()->sums(&sums, channel->data, length);
+	pp = (double) sums.max - sums.min;
+	measure->min = sums.min * channel->scale;
+	measure->max = sums.max * channel->scale;
+	measure->vpp = pp * channel->scale;
+	measure->mean = (double) sums.sum / length * channel->scale;
+	measure->rms = sqrt((double) sums.squares / length) * channel->scale;
+
+	if (pp == 0 || channel->sample_rate <= 0)
+		return;
+
+	memset(&edges, 0, sizeof(edges));
+	edges.low_up = -1;
+	edges.high_down = -1;
+	find_edges(&edges, channel->data, length, sums.min + pp * MEASURE_LOW,
+			sums.min + pp * MEASURE_MIDDLE, sums.min + pp * MEASURE_HIGH);
+
+	if (edges.rises)
+		measure->rise = edges.rise / edges.rises / channel->sample_rate;
+	if (edges.falls)
+		measure->fall = edges.fall / edges.falls / channel->sample_rate;
+	if (edges.edges > 1) {
+		double span = edges.last - edges.first;
+		measure->cycles = edges.edges - 1;
+		measure->period = span / measure->cycles / channel->sample_rate;
+		measure->frequency = 1 / measure->period;
+		measure->duty = edges.high / span;
+	}
+}
+
+/**
+ * Measure a channel
+ *
+ * Fills channel->measure, as done while decoding with OWON_OPT_MEASURE.
+ * Useful for captures loaded or mapped without the option.
+ *
+ * @param channel	Channel of a decoded capture
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_measure(OWON_CHANNEL_T *channel) {
+
+	if (channel->samples && !channel->data)
+		return (OWON_ERROR_FORMAT);
+
+	measure_channel(channel);
+
+	return (0);
+}
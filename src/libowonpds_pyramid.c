@@ -0,0 +1,265 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+/*
+ * Level 0 holds the minimum and maximum of each pair of samples, each
+ * further level those of pairs of the level below. Entry i of level n
+ * covers samples [i * 2^(n+1), (i+1) * 2^(n+1)).
+ */
+
+// Build a level from pairs of the level below
+static void build_level(int16_t *min, int16_t *max, const int16_t *below_min,
+		const int16_t *below_max, const uint32_t below_length) {
+
+	uint32_t pairs = below_length / 2;
+	uint32_t i;
+
+	for (i = 0; i < pairs; i++) {
+		int16_t a = below_min[i * 2];
+		int16_t b = below_min[i * 2 + 1];
+		min[i] = a < b ? a : b;
+		a = below_max[i * 2];
+		b = below_max[i * 2 + 1];
+		max[i] = a > b ? a : b;
+	}
+	if (below_length & 1) {
+		min[pairs] = below_min[below_length - 1];
+		max[pairs] = below_max[below_length - 1];
+	}
+}
+
+// Minimum and maximum of samples [first, last), a segment tree walk up
+// the levels taking at most two entries from each
+static void range_min_max(const OWON_PYRAMID_T *pyramid, uint32_t first,
+		uint32_t last, int16_t *min, int16_t *max) {
+
+	const int16_t *level_min = pyramid->data;
+	const int16_t *level_max = pyramid->data;
+	int16_t low = INT16_MAX;
+	int16_t high = INT16_MIN;
+	unsigned level = 0;
+
+	while (first < last) {
+		if (first & 1) {
+			if (level_min[first] < low)
+				low = level_min[first];
+			if (level_max[first] > high)
+				high = level_max[first];
+			first++;
+		}
+		if (last & 1) {
+			last--;
+			if (level_min[last] < low)
+				low = level_min[last];
+			if (level_max[last] > high)
+				high = level_max[last];
+		}
+		first >>= 1;
+		last >>= 1;
+
+		if (level >= pyramid->levels)
+			break;
+		level_min = pyramid->min + pyramid->offset[level];
+		level_max = pyramid->max + pyramid->offset[level];
+		level++;
+	}
+
+	*min = low;
+	*max = high;
+}
+
+/**
+ * Build a min/max decimation pyramid of a channel
+ *
+ * The pyramid refers to the channel samples, rebuild it after each
+ * capture. Buffers are reused between builds.
+ *
+ * @param pyramid	Zero initialised or previously built pyramid
+ * @param channel	Channel of a decoded capture
+ * @param flags		OWON_PYRAMID_ flags
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_pyramid_build(OWON_PYRAMID_T *pyramid,
+		const OWON_CHANNEL_T *channel, const unsigned flags) {
+
+	uint32_t samples = channel->samples;
+	uint32_t length = samples;
+	size_t total = 0;
+	unsigned levels = 0;
+	unsigned i;
+
+	if (samples && !channel->data)
+		return (OWON_ERROR_FORMAT);
+
+	pyramid->samples = 0;
+	pyramid->levels = 0;
+
+	// Size of each level
+	while (length > 1 && levels < OWON_PYRAMID_LEVELS) {
+		length = (length + 1) / 2;
+		pyramid->offset[levels] = (uint32_t) total;
+		pyramid->length[levels] = length;
+		total += length;
+		levels++;
+	}
+
+	pyramid->min = reserve(pyramid->min, &pyramid->min_size,
+			sizeof(int16_t) * total);
+	pyramid->max = reserve(pyramid->max, &pyramid->max_size,
+			sizeof(int16_t) * total);
+	if (!pyramid->min || !pyramid->max) {
+		error("Failed to allocate pyramid memory");
+		return (LIBUSB_ERROR_NO_MEM);
+	}
+
+	if (levels)
+		build_level(pyramid->min, pyramid->max, channel->data, channel->data,
+				samples);
+	for (i = 1; i < levels; i++)
+		build_level(pyramid->min + pyramid->offset[i],
+				pyramid->max + pyramid->offset[i],
+				pyramid->min + pyramid->offset[i - 1],
+				pyramid->max + pyramid->offset[i - 1], pyramid->length[i - 1]);
+
+	// Prefix sums give the mean of any range
+	if (flags & OWON_PYRAMID_MEAN) {
+		int64_t sum = 0;
+		uint32_t j;
+
+		pyramid->sum = reserve(pyramid->sum, &pyramid->sum_size,
+				sizeof(int64_t) * ((size_t) samples + 1));
+		if (!pyramid->sum) {
+			error("Failed to allocate pyramid memory");
+			return (LIBUSB_ERROR_NO_MEM);
+		}
+		pyramid->sum[0] = 0;
+		for (j = 0; j < samples; j++) {
+			sum += channel->data[j];
+			pyramid->sum[j + 1] = sum;
+		}
+	}
+
+	pyramid->flags = flags;
+	pyramid->data = channel->data;
+	pyramid->samples = samples;
+	pyramid->levels = levels;
+	pyramid->sample_rate = channel->sample_rate;
+	pyramid->scale = channel->scale;
+
+	return (0);
+}
+
+/**
+ * Get the envelope of a channel as display columns
+ *
+ * Each column holds the minimum and maximum (and optionally mean) level
+ * of the samples in its time span, found in O(log samples) time.
+ * Columns outside the capture are NAN.
+ *
+ * @param pyramid	Pyramid built with owon_pyramid_build()
+ * @param start		Time of the left edge of the first column (s)
+ * @param end		Time of the right edge of the last column (s)
+ * @param columns	Number of columns
+ * @param min		Minimum level of each column (V)
+ * @param max		Maximum level of each column (V)
+ * @param mean		Mean level of each column (V), or NULL. Requires
+ * 					OWON_PYRAMID_MEAN
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_pyramid_query(const OWON_PYRAMID_T *pyramid,
+		const double start, const double end, const unsigned columns,
+		double *min, double *max, double *mean) {
+
+	if (mean && !(pyramid->flags & OWON_PYRAMID_MEAN))
+		return (OWON_ERROR_FORMAT);
+	if (!columns)
+		return (0);
+
+	double first = start * pyramid->sample_rate;
+	double step = (end - start) * pyramid->sample_rate / columns;
+	double samples = pyramid->samples;
+	unsigned i;
+
+	for (i = 0; i < columns; i++) {
+		double from = floor(first + step * i);
+		double to = floor(first + step * (i + 1));
+
+		// Sparse columns show the nearest sample
+		if (to <= from)
+			to = from + 1;
+		if (from < 0)
+			from = 0;
+		if (to > samples)
+			to = samples;
+
+		if (from >= to) {
+			min[i] = NAN;
+			max[i] = NAN;
+			if (mean)
+				mean[i] = NAN;
+			continue;
+		}
+
+		uint32_t a = (uint32_t) from;
+		uint32_t b = (uint32_t) to;
+		int16_t low, high;
+		range_min_max(pyramid, a, b, &low, &high);
+		min[i] = low * pyramid->scale;
+		max[i] = high * pyramid->scale;
+		if (mean)
+			mean[i] = (double) (pyramid->sum[b] - pyramid->sum[a]) / (b - a)
+					* pyramid->scale;
+	}
+
+	return (0);
+}
+
+/**
+ * Free the buffers of a pyramid
+ *
+ * @param pyramid	Pyramid to free
+ *
+ */
+LIBOWONPDS_EXPORT void owon_pyramid_free(OWON_PYRAMID_T *pyramid) {
+
+	free(pyramid->min);
+	free(pyramid->max);
+	free(pyramid->sum);
+	memset(pyramid, 0, sizeof(OWON_PYRAMID_T));
+}
@@ -0,0 +1,404 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+/*
+ * Simulated scopes
+ *
+ * A simulated scope answers START with a capture as a scope would, the
+ * header then the payload, read in any size of transfer. Captures are
+ * made when opened and sent in turn.
+ *
+ */
+
+#define SIM_FRAMES 2				// Vector captures sent in turn
+#define SIM_FILE_HEADER 10			// Scope name and file length
+#define SIM_CHANNEL_HEADER 51		// Channel block header
+#define SIM_BITMAP_HEADER 54		// BMP file and info headers
+#define SIM_PAYLOAD_MAX 0xFFFFFF	// Largest length the header holds
+#define SIM_PI 3.14159265358979323846
+
+// Setting of the OWON_SIM environment variable
+#define SIM_KEY(name) \
+	(length == sizeof(name) - 1 && strncmp(setting, name, length) == 0)
+
+struct owon_sim {
+	struct owon_link link;				// First, used as the scope's link
+	OWON_SIM_T config;
+	unsigned char *frame[SIM_FRAMES];	// Raw captures
+	size_t frame_length[SIM_FRAMES];
+	unsigned frames;
+	unsigned next;						// Frame sent after the next START
+	const unsigned char *reply;			// Capture being sent, NULL if none
+	size_t length;						// Bytes of the reply to send
+	size_t sent;						// Bytes of the reply sent
+	int fault;							// Error sent instead, or 0
+	uint64_t ready;						// Time the reply starts
+	uint64_t payload;					// Time the payload started
+	uint32_t random;					// Random state
+};
+
+static void put_uint(unsigned char *to, uint32_t value, const size_t length) {
+
+	size_t i;
+	for (i = 0; i < length; i++) {
+		to[i] = (unsigned char) value;
+		value >>= 8;
+	}
+}
+
+// Pseudo random noise, the same on every run
+static int16_t noise(uint32_t *state) {
+
+	*state = *state * 1664525u + 1013904223u;
+
+	return ((int16_t) ((*state >> 24) % 9) - 4);
+}
+
+// Uniform random number from 0 to 1
+static double uniform(uint32_t *state) {
+
+	*state = *state * 1664525u + 1013904223u;
+
+	return ((*state >> 8) / 16777216.0);
+}
+
+// Generate a raw vector capture, the header followed by an SPB payload
+// Frames differ in phase and noise
+unsigned char *generate_vector(const char variant, const unsigned channels,
+		const uint32_t samples, const unsigned frame, size_t *length) {
+
+	size_t block = SIM_CHANNEL_HEADER + (size_t) samples * 2;
+	size_t payload = SIM_FILE_HEADER + block * channels;
+	unsigned char *raw = calloc(1, OWON_HEADER_SIZE + payload);
+	uint32_t state = 1 + frame;
+	unsigned i;
+
+	if (!raw)
+		return (NULL);
+
+	put_uint(raw, (uint32_t) payload, 3);
+
+	unsigned char *data = raw + OWON_HEADER_SIZE;
+	memcpy(data, "SPB", 3);
+	data[3] = (unsigned char) variant;
+	memcpy(&data[4], "01", 2);
+	put_uint(&data[6], (uint32_t) payload, 4);
+
+	for (i = 0; i < channels; i++) {
+		unsigned char *current = data + SIM_FILE_HEADER + block * i;
+		unsigned char *samples_data = current + SIM_CHANNEL_HEADER;
+		uint32_t j;
+
+		current[0] = 'C';
+		current[1] = 'H';
+		current[2] = (unsigned char) ('1' + i);
+		put_uint(&current[3], (uint32_t) (block - OWON_CHANNEL_NAME_LEN), 4);
+		put_uint(&current[7], samples, 4);
+		put_uint(&current[11], samples, 4);
+		put_uint(&current[19], 10, 4);				// 2.5ms/div
+		put_uint(&current[23], (uint32_t) (i * 10), 4);
+		put_uint(&current[27], 8, 4);				// 1V/div
+		put_uint(&current[31], 1, 4);				// X10
+
+		for (j = 0; j < samples; j++) {
+			double phase = 2 * SIM_PI * j * (i + 1) / 5000.0 + frame;
+			int16_t sample = (int16_t) (100 * sin(phase)) + noise(&state);
+			put_uint(&samples_data[j * 2], (uint16_t) sample, 2);
+		}
+	}
+
+	*length = OWON_HEADER_SIZE + payload;
+	return (raw);
+}
+
+// Generate a raw bitmap capture of a scope screen, grid and two traces
+unsigned char *generate_bitmap(size_t *length) {
+
+	size_t pixels = (size_t) OWON_BITMAP_WIDTH * OWON_BITMAP_HEIGHT
+			* OWON_BITMAP_CHANNELS;
+	size_t payload = SIM_BITMAP_HEADER + pixels;
+	unsigned char *raw = calloc(1, OWON_HEADER_SIZE + payload);
+	unsigned x, y;
+
+	if (!raw)
+		return (NULL);
+
+	put_uint(raw, (uint32_t) pixels, 3);
+	raw[8] = 1;
+
+	unsigned char *data = raw + OWON_HEADER_SIZE;
+	memcpy(data, "BM", 2);
+	put_uint(&data[2], (uint32_t) payload, 4);
+	put_uint(&data[10], SIM_BITMAP_HEADER, 4);
+	put_uint(&data[14], 40, 4);
+	put_uint(&data[18], OWON_BITMAP_WIDTH, 4);
+	put_uint(&data[22], OWON_BITMAP_HEIGHT, 4);
+	put_uint(&data[26], 1, 2);
+	put_uint(&data[28], 24, 2);
+
+	unsigned char *image = data + SIM_BITMAP_HEADER;
+	for (y = 0; y < OWON_BITMAP_HEIGHT; y++) {
+		int trace1 = (int) (240 + 100 * sin(y / 30.0));
+		int trace2 = (int) (300 + 60 * sin(y / 11.0));
+		for (x = 0; x < OWON_BITMAP_WIDTH; x++) {
+			unsigned char *pixel = &image[(y * OWON_BITMAP_WIDTH + x) * 3];
+			if (x % 50 == 0 || y % 50 == 0)
+				memset(pixel, (x + y) % 2 ? 100 : 0, 3);
+			if (abs((int) x - trace1) < 2) {
+				pixel[1] = 255;
+				pixel[2] = 255;
+			}
+			if (abs((int) x - trace2) < 2)
+				pixel[0] = 255;
+		}
+	}
+
+	*length = OWON_HEADER_SIZE + payload;
+	return (raw);
+}
+
+// Reply to START with the next frame, or a fault
+static void start_reply(struct owon_sim *sim) {
+
+	double chance = uniform(&sim->random);
+	unsigned frame = sim->next;
+
+	sim->next = (sim->next + 1) % sim->frames;
+	sim->reply = sim->frame[frame];
+	sim->length = sim->frame_length[frame];
+	sim->sent = 0;
+	sim->fault = 0;
+	sim->ready = owon_time() + (uint64_t) sim->config.latency * 1000;
+
+	if (chance < sim->config.timeouts)
+		sim->fault = LIBUSB_ERROR_TIMEOUT;
+	else if ((chance -= sim->config.timeouts) < sim->config.errors)
+		sim->fault = LIBUSB_ERROR_IO;
+	else if ((chance -= sim->config.errors) < sim->config.truncated)
+		// Odd, so it does not end on a transfer boundary
+		sim->length = OWON_HEADER_SIZE
+				+ (((sim->length - OWON_HEADER_SIZE) / 2) | 1);
+}
+
+static int sim_transfer(struct owon_link *link, const unsigned char endpoint,
+		unsigned char *data, const int length, int *transferred,
+		const unsigned timeout) {
+
+	struct owon_sim *sim = (struct owon_sim *) link;
+	size_t count;
+
+	*transferred = 0;
+	if (endpoint == WRITE_ENDPOINT) {
+		if (length == sizeof(CMD_START)
+				&& memcmp(data, CMD_START, sizeof(CMD_START)) == 0)
+			start_reply(sim);
+		*transferred = length;
+		return (LIBUSB_SUCCESS);
+	}
+
+	// Nothing more to send
+	if (!sim->reply || sim->fault == LIBUSB_ERROR_TIMEOUT) {
+		sim->reply = NULL;
+		sleep_ms(timeout);
+		return (LIBUSB_ERROR_TIMEOUT);
+	}
+	sleep_until(sim->ready);
+	if (sim->fault) {
+		sim->reply = NULL;
+		return (sim->fault);
+	}
+
+	// The header is sent on its own, then the payload at the rate
+	if (sim->sent < OWON_HEADER_SIZE)
+		count = OWON_HEADER_SIZE - sim->sent;
+	else
+		count = sim->length - sim->sent;
+	if (count > (size_t) length)
+		count = (size_t) length;
+	if (sim->sent == OWON_HEADER_SIZE)
+		sim->payload = owon_time();
+	if (sim->sent >= OWON_HEADER_SIZE && sim->config.rate)
+		sleep_until(sim->payload
+				+ (uint64_t) (sim->sent - OWON_HEADER_SIZE + count) * 1000000ULL
+						/ sim->config.rate);
+
+	memcpy(data, sim->reply + sim->sent, count);
+	sim->sent += count;
+	if (sim->sent == sim->length)
+		sim->reply = NULL;
+	*transferred = (int) count;
+
+	return (LIBUSB_SUCCESS);
+}
+
+static void sim_reset(struct owon_link *link) {
+
+	struct owon_sim *sim = (struct owon_sim *) link;
+
+	sim->reply = NULL;
+}
+
+static void sim_close(struct owon_link *link) {
+
+	struct owon_sim *sim = (struct owon_sim *) link;
+	unsigned i;
+
+	for (i = 0; i < SIM_FRAMES; i++)
+		free(sim->frame[i]);
+	free(sim);
+}
+
+// Read the simulated scopes set by the OWON_SIM environment variable,
+// a comma separated list of settings, for example
+// "channels=4,samples=100000,latency=20000,errors=0.01,scopes=8"
+// Returns false if not set
+bool sim_environment(OWON_SIM_T *sim, unsigned *scopes) {
+
+	const OWON_SIM_T defaults = OWON_SIM_DEFAULT;
+	const char *setting = getenv("OWON_SIM");
+
+	if (!setting)
+		return (false);
+
+	*sim = defaults;
+	*scopes = 1;
+	while (setting) {
+		const char *value = strchr(setting, '=');
+		const char *next = strchr(setting, ',');
+		size_t length;
+
+		if (value && (!next || value < next)) {
+			length = (size_t) (value - setting);
+			value++;
+			if (SIM_KEY("type"))
+				sim->type = strncmp(value, "bitmap", 6) == 0 ?
+						OWON_TYPE_BITMAP : OWON_TYPE_VECTOR;
+			else if (SIM_KEY("variant"))
+				sim->variant = value[0];
+			else if (SIM_KEY("channels"))
+				sim->channels = (unsigned) strtoul(value, NULL, 10);
+			else if (SIM_KEY("samples"))
+				sim->samples = (uint32_t) strtoul(value, NULL, 10);
+			else if (SIM_KEY("latency"))
+				sim->latency = (unsigned) strtoul(value, NULL, 10);
+			else if (SIM_KEY("rate"))
+				sim->rate = (unsigned) strtoul(value, NULL, 10);
+			else if (SIM_KEY("timeouts"))
+				sim->timeouts = strtod(value, NULL);
+			else if (SIM_KEY("errors"))
+				sim->errors = strtod(value, NULL);
+			else if (SIM_KEY("truncated"))
+				sim->truncated = strtod(value, NULL);
+			else if (SIM_KEY("seed"))
+				sim->seed = (uint32_t) strtoul(value, NULL, 10);
+			else if (SIM_KEY("scopes"))
+				*scopes = (unsigned) strtoul(value, NULL, 10);
+		}
+		setting = next ? next + 1 : NULL;
+	}
+
+	return (true);
+}
+
+/**
+ * Open a simulated scope
+ *
+ * The scope answers captures as a scope would, with sampled sine waves
+ * and noise or a screenshot, after a latency and at a transfer rate,
+ * failing at random as set. It is read, streamed and closed as a scope,
+ * without USB, for testing and load testing acquisition.\n
+ * The OWON_SIM environment variable opens simulated scopes from
+ * owon_open() and owon_open_all() instead of USB ones.
+ *
+ * @param scope		Scope struct to be initialised
+ * @param sim		Simulated scope, see OWON_SIM_DEFAULT
+ * @return
+ * 				- 0 Success
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_open_sim(OWON_SCOPE_T *scope,
+		const OWON_SIM_T *sim) {
+
+	struct owon_sim *link;
+	unsigned i;
+
+	memset(scope, 0, sizeof(OWON_SCOPE_T));
+
+	if (sim->type == OWON_TYPE_VECTOR
+			&& (sim->channels < 1 || sim->channels > OWON_MAX_CHANNELS
+					|| (sim->variant != 'V' && sim->variant != 'W'
+							&& sim->variant != 'X')
+					|| SIM_FILE_HEADER + (uint64_t) sim->channels
+							* (SIM_CHANNEL_HEADER + (uint64_t) sim->samples * 2)
+							> SIM_PAYLOAD_MAX))
+		return (LIBUSB_ERROR_INVALID_PARAM);
+	if (sim->type != OWON_TYPE_VECTOR && sim->type != OWON_TYPE_BITMAP)
+		return (LIBUSB_ERROR_INVALID_PARAM);
+
+	link = calloc(1, sizeof(struct owon_sim));
+	if (!link) {
+		error("Failed to allocate simulator");
+		return (LIBUSB_ERROR_NO_MEM);
+	}
+	link->link.transfer = sim_transfer;
+	link->link.reset = sim_reset;
+	link->link.close = sim_close;
+	link->config = *sim;
+	link->random = sim->seed;
+	link->frames = sim->type == OWON_TYPE_BITMAP ? 1 : SIM_FRAMES;
+
+	for (i = 0; i < link->frames; i++) {
+		if (sim->type == OWON_TYPE_BITMAP)
+			link->frame[i] = generate_bitmap(&link->frame_length[i]);
+		else
+			link->frame[i] = generate_vector(sim->variant, sim->channels,
+					sim->samples, sim->seed * SIM_FRAMES + i,
+					&link->frame_length[i]);
+		if (!link->frame[i]) {
+			sim_close(&link->link);
+			error("Failed to allocate simulated captures");
+			return (LIBUSB_ERROR_NO_MEM);
+		}
+	}
+
+	scope->link = &link->link;
+	snprintf((char *) scope->manufacturer, sizeof(scope->manufacturer),
+			"LibOwonPds");
+	snprintf((char *) scope->product, sizeof(scope->product),
+			"Simulated PDS");
+	snprintf((char *) scope->serial, sizeof(scope->serial), "SIM%u",
+			sim->seed);
+
+	return (LIBUSB_SUCCESS);
+}
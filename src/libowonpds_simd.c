@@ -0,0 +1,1188 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Vectorised sample kernels
+ *
+ * Each kernel has a scalar reference, the fastest version supported by
+ * the CPU is selected on first use and checked against the reference.
+ *
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET(x) __attribute__((target(x)))
+#else
+#define TARGET(x)
+#endif
+
+// Values checked when selecting kernels
+#define CHECK_BLOCK 4096
+
+// Vectors summed in 32 bit lanes before widening, each adds at most 2^16
+#define SUMS_BLOCK 16384
+
+// Butterflies checked, and their allowed error on values up to 2^16
+// (compilers may fuse the scalar multiply-adds)
+#define CHECK_BUTTERFLIES 1023
+#define CHECK_TOLERANCE 1e-9
+#define CRC_POLY 0x82F63B78			// CRC32C (Castagnoli), reflected
+
+static uint32_t crc_table[8][256];
+
+static SIMD_KERNELS_T kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// Scale samples, reference versions
+static void scale_scalar(double *vector, const int16_t *data,
+		const uint32_t length, const double scale) {
+
+	uint32_t i;
+	for (i = 0; i < length; i++)
+		vector[i] = data[i] * scale;
+}
+
+static void scale_float_scalar(float *vector, const int16_t *data,
+		const uint32_t length, const float scale) {
+
+	uint32_t i;
+	for (i = 0; i < length; i++)
+		vector[i] = (float) data[i] * scale;
+}
+
+static void sums_scalar(SAMPLE_SUMS_T *sums, const int16_t *data,
+		const uint32_t length) {
+
+	uint32_t i;
+	for (i = 0; i < length; i++) {
+		int16_t value = data[i];
+		if (value < sums->min)
+			sums->min = value;
+		if (value > sums->max)
+			sums->max = value;
+		sums->sum += value;
+		sums->squares += (uint64_t) ((int32_t) value * value);
+	}
+}
+
+static void butterfly_scalar(double *re0, double *im0, double *re1,
+		double *im1, const double *w_re, const double *w_im,
+		const uint32_t length) {
+
+	uint32_t i;
+	for (i = 0; i < length; i++) {
+		double t_re = re1[i] * w_re[i] - im1[i] * w_im[i];
+		double t_im = re1[i] * w_im[i] + im1[i] * w_re[i];
+		re1[i] = re0[i] - t_re;
+		im1[i] = im0[i] - t_im;
+		re0[i] += t_re;
+		im0[i] += t_im;
+	}
+}
+
+static uint16_t delta_scalar(uint16_t *values, const int16_t *data,
+		const uint32_t length, const int16_t previous) {
+
+	uint16_t last = (uint16_t) previous;
+	uint16_t used = 0;
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		uint16_t sample = (uint16_t) data[i];
+		uint16_t delta = (uint16_t) (sample - last);
+		values[i] = (uint16_t) (delta << 1 ^ -(delta >> 15));
+		used |= values[i];
+		last = sample;
+	}
+
+	return (used);
+}
+
+static void undelta_scalar(int16_t *data, const uint16_t *values,
+		const uint32_t length, const int16_t previous) {
+
+	uint16_t last = (uint16_t) previous;
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		last = (uint16_t) (last + (values[i] >> 1 ^ -(values[i] & 1)));
+		data[i] = (int16_t) last;
+	}
+}
+
+static void accumulate_scalar(double *sum, double *average, int16_t *min,
+		int16_t *max, int16_t *peak, const int16_t *data,
+		const uint32_t length, const double alpha) {
+
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		int16_t sample = data[i];
+		int16_t magnitude = sample < 0 ?
+				(int16_t) (sample == INT16_MIN ? INT16_MAX : -sample) : sample;
+
+		sum[i] += sample;
+		average[i] += alpha * (sample - average[i]);
+		if (sample < min[i])
+			min[i] = sample;
+		if (sample > max[i])
+			max[i] = sample;
+		if (magnitude > peak[i])
+			peak[i] = magnitude;
+	}
+}
+
+// CRC32C eight bytes at a time (slicing by 8)
+static uint32_t crc_scalar(uint32_t crc, const unsigned char *data,
+		size_t length) {
+
+	crc = ~crc;
+	for (; length >= 8; length -= 8, data += 8) {
+		uint32_t low = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8
+				| (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+		crc = crc_table[7][low & 0xFF] ^ crc_table[6][(low >> 8) & 0xFF]
+				^ crc_table[5][(low >> 16) & 0xFF] ^ crc_table[4][low >> 24]
+				^ crc_table[3][data[4]] ^ crc_table[2][data[5]]
+				^ crc_table[1][data[6]] ^ crc_table[0][data[7]];
+	}
+	while (length--)
+		crc = crc_table[0][(crc ^ *data++) & 0xFF] ^ crc >> 8;
+
+	return (~crc);
+}
+
+static void crc_init(void) {
+
+	unsigned i, j;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? crc >> 1 ^ CRC_POLY : crc >> 1;
+		crc_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc_table[j][i] = crc_table[0][crc_table[j - 1][i] & 0xFF]
+					^ crc_table[j - 1][i] >> 8;
+}
+
+#if defined(SIMD_X86)
+TARGET("sse2")
+static void scale_sse2(double *vector, const int16_t *data,
+		const uint32_t length, const double scale) {
+
+	__m128d factor = _mm_set1_pd(scale);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		__m128i values = _mm_loadu_si128((const __m128i *) &data[i]);
+		// Sign extend to 32 bits
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+
+		_mm_storeu_pd(&vector[i],
+				_mm_mul_pd(_mm_cvtepi32_pd(lo), factor));
+		_mm_storeu_pd(&vector[i + 2],
+				_mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(lo, 0xee)),
+						factor));
+		_mm_storeu_pd(&vector[i + 4],
+				_mm_mul_pd(_mm_cvtepi32_pd(hi), factor));
+		_mm_storeu_pd(&vector[i + 6],
+				_mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(hi, 0xee)),
+						factor));
+	}
+
+	scale_scalar(&vector[i], &data[i], length - i, scale);
+}
+
+TARGET("sse2")
+static void scale_float_sse2(float *vector, const int16_t *data,
+		const uint32_t length, const float scale) {
+
+	__m128 factor = _mm_set1_ps(scale);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		__m128i values = _mm_loadu_si128((const __m128i *) &data[i]);
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+
+		_mm_storeu_ps(&vector[i], _mm_mul_ps(_mm_cvtepi32_ps(lo), factor));
+		_mm_storeu_ps(&vector[i + 4],
+				_mm_mul_ps(_mm_cvtepi32_ps(hi), factor));
+	}
+
+	scale_float_scalar(&vector[i], &data[i], length - i, scale);
+}
+
+TARGET("sse2")
+static void sums_sse2(SAMPLE_SUMS_T *sums, const int16_t *data,
+		const uint32_t length) {
+
+	__m128i low = _mm_set1_epi16(sums->min);
+	__m128i high = _mm_set1_epi16(sums->max);
+	__m128i ones = _mm_set1_epi16(1);
+	__m128i zero = _mm_setzero_si128();
+	__m128i total = zero;
+	__m128i squares = zero;
+	int16_t lanes[8];
+	int64_t wide[2];
+	uint32_t i = 0;
+	unsigned j;
+
+	while (i + 8 <= length) {
+		__m128i partial = zero;
+		unsigned block;
+
+		for (block = 0; block < SUMS_BLOCK && i + 8 <= length;
+				block++, i += 8) {
+			__m128i values = _mm_loadu_si128((const __m128i *) &data[i]);
+			// Pairs of squares fit unsigned 32 bits
+			__m128i square = _mm_madd_epi16(values, values);
+
+			low = _mm_min_epi16(low, values);
+			high = _mm_max_epi16(high, values);
+			partial = _mm_add_epi32(partial, _mm_madd_epi16(values, ones));
+			squares = _mm_add_epi64(squares,
+					_mm_unpacklo_epi32(square, zero));
+			squares = _mm_add_epi64(squares,
+					_mm_unpackhi_epi32(square, zero));
+		}
+
+		// Sign extend the partial sums to 64 bits
+		__m128i sign = _mm_srai_epi32(partial, 31);
+		total = _mm_add_epi64(total, _mm_unpacklo_epi32(partial, sign));
+		total = _mm_add_epi64(total, _mm_unpackhi_epi32(partial, sign));
+	}
+
+	_mm_storeu_si128((__m128i *) lanes, low);
+	for (j = 0; j < 8; j++)
+		if (lanes[j] < sums->min)
+			sums->min = lanes[j];
+	_mm_storeu_si128((__m128i *) lanes, high);
+	for (j = 0; j < 8; j++)
+		if (lanes[j] > sums->max)
+			sums->max = lanes[j];
+	_mm_storeu_si128((__m128i *) wide, total);
+	sums->sum += wide[0] + wide[1];
+	_mm_storeu_si128((__m128i *) wide, squares);
+	sums->squares += (uint64_t) wide[0] + (uint64_t) wide[1];
+
+	sums_scalar(sums, &data[i], length - i);
+}
+
+TARGET("sse2")
+static void butterfly_sse2(double *re0, double *im0, double *re1,
+		double *im1, const double *w_re, const double *w_im,
+		const uint32_t length) {
+
+	uint32_t i;
+
+	for (i = 0; i + 2 <= length; i += 2) {
+		__m128d a_re = _mm_loadu_pd(&re0[i]);
+		__m128d a_im = _mm_loadu_pd(&im0[i]);
+		__m128d b_re = _mm_loadu_pd(&re1[i]);
+		__m128d b_im = _mm_loadu_pd(&im1[i]);
+		__m128d c = _mm_loadu_pd(&w_re[i]);
+		__m128d s = _mm_loadu_pd(&w_im[i]);
+		__m128d t_re = _mm_sub_pd(_mm_mul_pd(b_re, c), _mm_mul_pd(b_im, s));
+		__m128d t_im = _mm_add_pd(_mm_mul_pd(b_re, s), _mm_mul_pd(b_im, c));
+
+		_mm_storeu_pd(&re1[i], _mm_sub_pd(a_re, t_re));
+		_mm_storeu_pd(&im1[i], _mm_sub_pd(a_im, t_im));
+		_mm_storeu_pd(&re0[i], _mm_add_pd(a_re, t_re));
+		_mm_storeu_pd(&im0[i], _mm_add_pd(a_im, t_im));
+	}
+
+	butterfly_scalar(&re0[i], &im0[i], &re1[i], &im1[i], &w_re[i], &w_im[i],
+			length - i);
+}
+
+TARGET("sse2")
+static uint16_t delta_sse2(uint16_t *values, const int16_t *data,
+		const uint32_t length, const int16_t previous) {
+
+	__m128i used = _mm_setzero_si128();
+	uint16_t tail;
+	uint32_t i;
+
+	if (!length)
+		return (0);
+
+	// Each vector is differenced with the samples one before it
+	tail = delta_scalar(values, data, 1, previous);
+	for (i = 1; i + 8 <= length; i += 8) {
+		__m128i current = _mm_loadu_si128((const __m128i *) &data[i]);
+		__m128i before = _mm_loadu_si128((const __m128i *) &data[i - 1]);
+		__m128i delta = _mm_sub_epi16(current, before);
+		__m128i value = _mm_xor_si128(_mm_slli_epi16(delta, 1),
+				_mm_srai_epi16(delta, 15));
+		_mm_storeu_si128((__m128i *) &values[i], value);
+		used = _mm_or_si128(used, value);
+	}
+	used = _mm_or_si128(used, _mm_srli_si128(used, 8));
+	used = _mm_or_si128(used, _mm_srli_si128(used, 4));
+	used = _mm_or_si128(used, _mm_srli_si128(used, 2));
+	tail |= delta_scalar(&values[i], &data[i], length - i, data[i - 1]);
+
+	return ((uint16_t) (tail | _mm_cvtsi128_si32(used)));
+}
+
+TARGET("sse2")
+static void undelta_sse2(int16_t *data, const uint16_t *values,
+		const uint32_t length, const int16_t previous) {
+
+	__m128i last = _mm_set1_epi16(previous);
+	__m128i one = _mm_set1_epi16(1);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		__m128i value = _mm_loadu_si128((const __m128i *) &values[i]);
+		__m128i delta = _mm_xor_si128(_mm_srli_epi16(value, 1),
+				_mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(value, one)));
+
+		// Prefix sum across the lanes, then carry in the last sample
+		delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 2));
+		delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 4));
+		delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 8));
+		delta = _mm_add_epi16(delta, last);
+		_mm_storeu_si128((__m128i *) &data[i], delta);
+
+		last = _mm_shufflehi_epi16(delta, _MM_SHUFFLE(3, 3, 3, 3));
+		last = _mm_unpackhi_epi64(last, last);
+	}
+
+	undelta_scalar(&data[i], &values[i], length - i,
+			i ? data[i - 1] : previous);
+}
+
+// Add two samples to the sums and exponential average
+TARGET("sse2")
+static inline void accumulate_pd(double *sum, double *average,
+		const __m128d values, const __m128d weight) {
+
+	__m128d last = _mm_loadu_pd(average);
+
+	_mm_storeu_pd(sum, _mm_add_pd(_mm_loadu_pd(sum), values));
+	_mm_storeu_pd(average,
+			_mm_add_pd(last, _mm_mul_pd(weight, _mm_sub_pd(values, last))));
+}
+
+TARGET("sse2")
+static void accumulate_sse2(double *sum, double *average, int16_t *min,
+		int16_t *max, int16_t *peak, const int16_t *data,
+		const uint32_t length, const double alpha) {
+
+	__m128d weight = _mm_set1_pd(alpha);
+	__m128i zero = _mm_setzero_si128();
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		__m128i values = _mm_loadu_si128((const __m128i *) &data[i]);
+		// Negation saturates, so the magnitude of INT16_MIN is INT16_MAX
+		__m128i magnitude = _mm_max_epi16(values, _mm_subs_epi16(zero, values));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+
+		_mm_storeu_si128((__m128i *) &min[i], _mm_min_epi16(values,
+				_mm_loadu_si128((const __m128i *) &min[i])));
+		_mm_storeu_si128((__m128i *) &max[i], _mm_max_epi16(values,
+				_mm_loadu_si128((const __m128i *) &max[i])));
+		_mm_storeu_si128((__m128i *) &peak[i], _mm_max_epi16(magnitude,
+				_mm_loadu_si128((const __m128i *) &peak[i])));
+
+		accumulate_pd(&sum[i], &average[i], _mm_cvtepi32_pd(lo), weight);
+		accumulate_pd(&sum[i + 2], &average[i + 2],
+				_mm_cvtepi32_pd(_mm_shuffle_epi32(lo, 0xee)), weight);
+		accumulate_pd(&sum[i + 4], &average[i + 4], _mm_cvtepi32_pd(hi),
+				weight);
+		accumulate_pd(&sum[i + 6], &average[i + 6],
+				_mm_cvtepi32_pd(_mm_shuffle_epi32(hi, 0xee)), weight);
+	}
+
+	accumulate_scalar(&sum[i], &average[i], &min[i], &max[i], &peak[i],
+			&data[i], length - i, alpha);
+}
+
+TARGET("avx2")
+static uint16_t delta_avx2(uint16_t *values, const int16_t *data,
+		const uint32_t length, const int16_t previous) {
+
+	__m256i used = _mm256_setzero_si256();
+	__m128i folded;
+	uint16_t tail;
+	uint32_t i;
+
+	if (!length)
+		return (0);
+
+	tail = delta_scalar(values, data, 1, previous);
+	for (i = 1; i + 16 <= length; i += 16) {
+		__m256i current = _mm256_loadu_si256((const __m256i *) &data[i]);
+		__m256i before = _mm256_loadu_si256((const __m256i *) &data[i - 1]);
+		__m256i delta = _mm256_sub_epi16(current, before);
+		__m256i value = _mm256_xor_si256(_mm256_slli_epi16(delta, 1),
+				_mm256_srai_epi16(delta, 15));
+		_mm256_storeu_si256((__m256i *) &values[i], value);
+		used = _mm256_or_si256(used, value);
+	}
+	folded = _mm_or_si128(_mm256_castsi256_si128(used),
+			_mm256_extracti128_si256(used, 1));
+	folded = _mm_or_si128(folded, _mm_srli_si128(folded, 8));
+	folded = _mm_or_si128(folded, _mm_srli_si128(folded, 4));
+	folded = _mm_or_si128(folded, _mm_srli_si128(folded, 2));
+	tail |= delta_scalar(&values[i], &data[i], length - i, data[i - 1]);
+
+	return ((uint16_t) (tail | _mm_cvtsi128_si32(folded)));
+}
+
+TARGET("avx2")
+static void scale_avx2(double *vector, const int16_t *data,
+		const uint32_t length, const double scale) {
+
+	__m256d factor = _mm256_set1_pd(scale);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		__m256i values = _mm256_cvtepi16_epi32(
+				_mm_loadu_si128((const __m128i *) &data[i]));
+
+		_mm256_storeu_pd(&vector[i],
+				_mm256_mul_pd(
+						_mm256_cvtepi32_pd(_mm256_castsi256_si128(values)),
+						factor));
+		_mm256_storeu_pd(&vector[i + 4],
+				_mm256_mul_pd(
+						_mm256_cvtepi32_pd(
+								_mm256_extracti128_si256(values, 1)), factor));
+	}
+
+	scale_scalar(&vector[i], &data[i], length - i, scale);
+}
+
+// Add four samples to the sums and exponential average
+TARGET("avx2")
+static inline void accumulate_pd4(double *sum, double *average,
+		const __m256d values, const __m256d weight) {
+
+	__m256d last = _mm256_loadu_pd(average);
+
+	_mm256_storeu_pd(sum, _mm256_add_pd(_mm256_loadu_pd(sum), values));
+	_mm256_storeu_pd(average, _mm256_add_pd(last,
+			_mm256_mul_pd(weight, _mm256_sub_pd(values, last))));
+}
+
+TARGET("avx2")
+static void accumulate_avx2(double *sum, double *average, int16_t *min,
+		int16_t *max, int16_t *peak, const int16_t *data,
+		const uint32_t length, const double alpha) {
+
+	__m256d weight = _mm256_set1_pd(alpha);
+	__m256i zero = _mm256_setzero_si256();
+	uint32_t i;
+
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m256i values = _mm256_loadu_si256((const __m256i *) &data[i]);
+		__m256i magnitude = _mm256_max_epi16(values,
+				_mm256_subs_epi16(zero, values));
+		__m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(values));
+		__m256i hi = _mm256_cvtepi16_epi32(
+				_mm256_extracti128_si256(values, 1));
+
+		_mm256_storeu_si256((__m256i *) &min[i], _mm256_min_epi16(values,
+				_mm256_loadu_si256((const __m256i *) &min[i])));
+		_mm256_storeu_si256((__m256i *) &max[i], _mm256_max_epi16(values,
+				_mm256_loadu_si256((const __m256i *) &max[i])));
+		_mm256_storeu_si256((__m256i *) &peak[i], _mm256_max_epi16(magnitude,
+				_mm256_loadu_si256((const __m256i *) &peak[i])));
+
+		accumulate_pd4(&sum[i], &average[i],
+				_mm256_cvtepi32_pd(_mm256_castsi256_si128(lo)), weight);
+		accumulate_pd4(&sum[i + 4], &average[i + 4],
+				_mm256_cvtepi32_pd(_mm256_extracti128_si256(lo, 1)), weight);
+		accumulate_pd4(&sum[i + 8], &average[i + 8],
+				_mm256_cvtepi32_pd(_mm256_castsi256_si128(hi)), weight);
+		accumulate_pd4(&sum[i + 12], &average[i + 12],
+				_mm256_cvtepi32_pd(_mm256_extracti128_si256(hi, 1)), weight);
+	}
+
+	accumulate_scalar(&sum[i], &average[i], &min[i], &max[i], &peak[i],
+			&data[i], length - i, alpha);
+}
+
+TARGET("avx2")
+static void scale_float_avx2(float *vector, const int16_t *data,
+		const uint32_t length, const float scale) {
+
+	__m256 factor = _mm256_set1_ps(scale);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		__m256i values = _mm256_cvtepi16_epi32(
+				_mm_loadu_si128((const __m128i *) &data[i]));
+
+		_mm256_storeu_ps(&vector[i],
+				_mm256_mul_ps(_mm256_cvtepi32_ps(values), factor));
+	}
+
+	scale_float_scalar(&vector[i], &data[i], length - i, scale);
+}
+
+TARGET("avx2")
+static void sums_avx2(SAMPLE_SUMS_T *sums, const int16_t *data,
+		const uint32_t length) {
+
+	__m256i low = _mm256_set1_epi16(sums->min);
+	__m256i high = _mm256_set1_epi16(sums->max);
+	__m256i ones = _mm256_set1_epi16(1);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i total = zero;
+	__m256i squares = zero;
+	int16_t lanes[16];
+	int64_t wide[4];
+	uint32_t i = 0;
+	unsigned j;
+
+	while (i + 16 <= length) {
+		__m256i partial = zero;
+		unsigned block;
+
+		for (block = 0; block < SUMS_BLOCK && i + 16 <= length;
+				block++, i += 16) {
+			__m256i values = _mm256_loadu_si256((const __m256i *) &data[i]);
+			__m256i square = _mm256_madd_epi16(values, values);
+
+			low = _mm256_min_epi16(low, values);
+			high = _mm256_max_epi16(high, values);
+			partial = _mm256_add_epi32(partial,
+					_mm256_madd_epi16(values, ones));
+			squares = _mm256_add_epi64(squares,
+					_mm256_unpacklo_epi32(square, zero));
+			squares = _mm256_add_epi64(squares,
+					_mm256_unpackhi_epi32(square, zero));
+		}
+
+		__m256i sign = _mm256_srai_epi32(partial, 31);
+		total = _mm256_add_epi64(total, _mm256_unpacklo_epi32(partial, sign));
+		total = _mm256_add_epi64(total, _mm256_unpackhi_epi32(partial, sign));
+	}
+
+	_mm256_storeu_si256((__m256i *) lanes, low);
+	for (j = 0; j < 16; j++)
+		if (lanes[j] < sums->min)
+			sums->min = lanes[j];
+	_mm256_storeu_si256((__m256i *) lanes, high);
+	for (j = 0; j < 16; j++)
+		if (lanes[j] > sums->max)
+			sums->max = lanes[j];
+	_mm256_storeu_si256((__m256i *) wide, total);
+	sums->sum += wide[0] + wide[1] + wide[2] + wide[3];
+	_mm256_storeu_si256((__m256i *) wide, squares);
+	for (j = 0; j < 4; j++)
+		sums->squares += (uint64_t) wide[j];
+
+	sums_scalar(sums, &data[i], length - i);
+}
+
+TARGET("avx2")
+static void butterfly_avx2(double *re0, double *im0, double *re1,
+		double *im1, const double *w_re, const double *w_im,
+		const uint32_t length) {
+
+	uint32_t i;
+
+	for (i = 0; i + 4 <= length; i += 4) {
+		__m256d a_re = _mm256_loadu_pd(&re0[i]);
+		__m256d a_im = _mm256_loadu_pd(&im0[i]);
+		__m256d b_re = _mm256_loadu_pd(&re1[i]);
+		__m256d b_im = _mm256_loadu_pd(&im1[i]);
+		__m256d c = _mm256_loadu_pd(&w_re[i]);
+		__m256d s = _mm256_loadu_pd(&w_im[i]);
+		__m256d t_re = _mm256_sub_pd(_mm256_mul_pd(b_re, c),
+				_mm256_mul_pd(b_im, s));
+		__m256d t_im = _mm256_add_pd(_mm256_mul_pd(b_re, s),
+				_mm256_mul_pd(b_im, c));
+
+		_mm256_storeu_pd(&re1[i], _mm256_sub_pd(a_re, t_re));
+		_mm256_storeu_pd(&im1[i], _mm256_sub_pd(a_im, t_im));
+		_mm256_storeu_pd(&re0[i], _mm256_add_pd(a_re, t_re));
+		_mm256_storeu_pd(&im0[i], _mm256_add_pd(a_im, t_im));
+	}
+
+	butterfly_scalar(&re0[i], &im0[i], &re1[i], &im1[i], &w_re[i], &w_im[i],
+			length - i);
+}
+
+TARGET("sse4.2")
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *data,
+		size_t length) {
+
+	crc = ~crc;
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t crc64 = crc;
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		crc64 = _mm_crc32_u64(crc64, value);
+	}
+	crc = (uint32_t) crc64;
+#else
+	for (; length >= 4; length -= 4, data += 4) {
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		crc = _mm_crc32_u32(crc, value);
+	}
+#endif
+	while (length--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return (~crc);
+}
+
+// Check the CPU (and OS) support a feature
+static bool cpu_supports(const char *feature) {
+
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+	if (strcmp(feature, "avx2") == 0)
+		return (__builtin_cpu_supports("avx2"));
+	if (strcmp(feature, "sse4.2") == 0)
+		return (__builtin_cpu_supports("sse4.2"));
+	return (__builtin_cpu_supports("sse2"));
+#elif defined(_MSC_VER)
+	int info[4];
+	if (strcmp(feature, "sse4.2") == 0) {
+		__cpuid(info, 1);
+		return ((info[2] & (1 << 20)) != 0);
+	}
+	if (strcmp(feature, "avx2") == 0) {
+		__cpuid(info, 1);
+		// OSXSAVE and AVX, then the OS saves YMM state
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+			return (false);
+		if ((_xgetbv(0) & 6) != 6)
+			return (false);
+		__cpuidex(info, 7, 0);
+		return ((info[1] & (1 << 5)) != 0);
+	}
+	__cpuid(info, 1);
+	return ((info[3] & (1 << 26)) != 0);
+#else
+	return (false);
+#endif
+}
+#endif
+
+#if defined(SIMD_NEON)
+static void scale_neon(double *vector, const int16_t *data,
+		const uint32_t length, const double scale) {
+
+	float64x2_t factor = vdupq_n_f64(scale);
+	uint32_t i;
+
+	for (i = 0; i + 4 <= length; i += 4) {
+		int32x4_t values = vmovl_s16(vld1_s16(&data[i]));
+		float64x2_t lo = vcvtq_f64_s64(vmovl_s32(vget_low_s32(values)));
+		float64x2_t hi = vcvtq_f64_s64(vmovl_s32(vget_high_s32(values)));
+
+		vst1q_f64(&vector[i], vmulq_f64(lo, factor));
+		vst1q_f64(&vector[i + 2], vmulq_f64(hi, factor));
+	}
+
+	scale_scalar(&vector[i], &data[i], length - i, scale);
+}
+
+static void scale_float_neon(float *vector, const int16_t *data,
+		const uint32_t length, const float scale) {
+
+	float32x4_t factor = vdupq_n_f32(scale);
+	uint32_t i;
+
+	for (i = 0; i + 4 <= length; i += 4) {
+		int32x4_t values = vmovl_s16(vld1_s16(&data[i]));
+		vst1q_f32(&vector[i], vmulq_f32(vcvtq_f32_s32(values), factor));
+	}
+
+	scale_float_scalar(&vector[i], &data[i], length - i, scale);
+}
+#endif
+
+#if defined(SIMD_NEON)
+static void sums_neon(SAMPLE_SUMS_T *sums, const int16_t *data,
+		const uint32_t length) {
+
+	int16x8_t low = vdupq_n_s16(sums->min);
+	int16x8_t high = vdupq_n_s16(sums->max);
+	int64x2_t total = vdupq_n_s64(0);
+	uint64x2_t squares = vdupq_n_u64(0);
+	uint32_t i = 0;
+
+	while (i + 8 <= length) {
+		int32x4_t partial = vdupq_n_s32(0);
+		unsigned block;
+
+		for (block = 0; block < SUMS_BLOCK && i + 8 <= length;
+				block++, i += 8) {
+			int16x8_t values = vld1q_s16(&data[i]);
+			int32x4_t square_lo = vmull_s16(vget_low_s16(values),
+					vget_low_s16(values));
+			int32x4_t square_hi = vmull_s16(vget_high_s16(values),
+					vget_high_s16(values));
+
+			low = vminq_s16(low, values);
+			high = vmaxq_s16(high, values);
+			partial = vpadalq_s16(partial, values);
+			squares = vpadalq_u32(squares, vreinterpretq_u32_s32(square_lo));
+			squares = vpadalq_u32(squares, vreinterpretq_u32_s32(square_hi));
+		}
+
+		total = vpadalq_s32(total, partial);
+	}
+
+	if (vminvq_s16(low) < sums->min)
+		sums->min = vminvq_s16(low);
+	if (vmaxvq_s16(high) > sums->max)
+		sums->max = vmaxvq_s16(high);
+	sums->sum += vaddvq_s64(total);
+	sums->squares += vaddvq_u64(squares);
+
+	sums_scalar(sums, &data[i], length - i);
+}
+#endif
+
+#if defined(SIMD_NEON)
+static void butterfly_neon(double *re0, double *im0, double *re1,
+		double *im1, const double *w_re, const double *w_im,
+		const uint32_t length) {
+
+	uint32_t i;
+
+	for (i = 0; i + 2 <= length; i += 2) {
+		float64x2_t a_re = vld1q_f64(&re0[i]);
+		float64x2_t a_im = vld1q_f64(&im0[i]);
+		float64x2_t b_re = vld1q_f64(&re1[i]);
+		float64x2_t b_im = vld1q_f64(&im1[i]);
+		float64x2_t c = vld1q_f64(&w_re[i]);
+		float64x2_t s = vld1q_f64(&w_im[i]);
+		float64x2_t t_re = vfmsq_f64(vmulq_f64(b_re, c), b_im, s);
+		float64x2_t t_im = vfmaq_f64(vmulq_f64(b_re, s), b_im, c);
+
+		vst1q_f64(&re1[i], vsubq_f64(a_re, t_re));
+		vst1q_f64(&im1[i], vsubq_f64(a_im, t_im));
+		vst1q_f64(&re0[i], vaddq_f64(a_re, t_re));
+		vst1q_f64(&im0[i], vaddq_f64(a_im, t_im));
+	}
+
+	butterfly_scalar(&re0[i], &im0[i], &re1[i], &im1[i], &w_re[i], &w_im[i],
+			length - i);
+}
+#endif
+
+#if defined(SIMD_NEON)
+static uint16_t delta_neon(uint16_t *values, const int16_t *data,
+		const uint32_t length, const int16_t previous) {
+
+	uint16x8_t used = vdupq_n_u16(0);
+	uint16x4_t folded;
+	uint16_t tail;
+	uint32_t i;
+
+	if (!length)
+		return (0);
+
+	tail = delta_scalar(values, data, 1, previous);
+	for (i = 1; i + 8 <= length; i += 8) {
+		int16x8_t delta = vsubq_s16(vld1q_s16(&data[i]),
+				vld1q_s16(&data[i - 1]));
+		uint16x8_t value = vreinterpretq_u16_s16(
+				veorq_s16(vshlq_n_s16(delta, 1), vshrq_n_s16(delta, 15)));
+		vst1q_u16(&values[i], value);
+		used = vorrq_u16(used, value);
+	}
+	folded = vorr_u16(vget_low_u16(used), vget_high_u16(used));
+	folded = vorr_u16(folded, vext_u16(folded, folded, 2));
+	folded = vorr_u16(folded, vext_u16(folded, folded, 1));
+	tail |= delta_scalar(&values[i], &data[i], length - i, data[i - 1]);
+
+	return ((uint16_t) (tail | vget_lane_u16(folded, 0)));
+}
+
+static void undelta_neon(int16_t *data, const uint16_t *values,
+		const uint32_t length, const int16_t previous) {
+
+	int16x8_t last = vdupq_n_s16(previous);
+	int16x8_t zero = vdupq_n_s16(0);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		uint16x8_t value = vld1q_u16(&values[i]);
+		int16x8_t half = vreinterpretq_s16_u16(vshrq_n_u16(value, 1));
+		int16x8_t sign = vnegq_s16(vreinterpretq_s16_u16(
+				vandq_u16(value, vdupq_n_u16(1))));
+		int16x8_t delta = veorq_s16(half, sign);
+
+		delta = vaddq_s16(delta, vextq_s16(zero, delta, 7));
+		delta = vaddq_s16(delta, vextq_s16(zero, delta, 6));
+		delta = vaddq_s16(delta, vextq_s16(zero, delta, 4));
+		delta = vaddq_s16(delta, last);
+		vst1q_s16(&data[i], delta);
+
+		last = vdupq_laneq_s16(delta, 7);
+	}
+
+	undelta_scalar(&data[i], &values[i], length - i,
+			i ? data[i - 1] : previous);
+}
+
+// Add two samples to the sums and exponential average
+static inline void accumulate_f64(double *sum, double *average,
+		const float64x2_t values, const float64x2_t weight) {
+
+	float64x2_t last = vld1q_f64(average);
+
+	vst1q_f64(sum, vaddq_f64(vld1q_f64(sum), values));
+	vst1q_f64(average,
+			vaddq_f64(last, vmulq_f64(weight, vsubq_f64(values, last))));
+}
+
+static void accumulate_neon(double *sum, double *average, int16_t *min,
+		int16_t *max, int16_t *peak, const int16_t *data,
+		const uint32_t length, const double alpha) {
+
+	float64x2_t weight = vdupq_n_f64(alpha);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		int16x8_t values = vld1q_s16(&data[i]);
+		int32x4_t lo = vmovl_s16(vget_low_s16(values));
+		int32x4_t hi = vmovl_s16(vget_high_s16(values));
+
+		vst1q_s16(&min[i], vminq_s16(values, vld1q_s16(&min[i])));
+		vst1q_s16(&max[i], vmaxq_s16(values, vld1q_s16(&max[i])));
+		vst1q_s16(&peak[i],
+				vmaxq_s16(vqabsq_s16(values), vld1q_s16(&peak[i])));
+
+		accumulate_f64(&sum[i], &average[i],
+				vcvtq_f64_s64(vmovl_s32(vget_low_s32(lo))), weight);
+		accumulate_f64(&sum[i + 2], &average[i + 2],
+				vcvtq_f64_s64(vmovl_s32(vget_high_s32(lo))), weight);
+		accumulate_f64(&sum[i + 4], &average[i + 4],
+				vcvtq_f64_s64(vmovl_s32(vget_low_s32(hi))), weight);
+		accumulate_f64(&sum[i + 6], &average[i + 6],
+				vcvtq_f64_s64(vmovl_s32(vget_high_s32(hi))), weight);
+	}
+
+	accumulate_scalar(&sum[i], &average[i], &min[i], &max[i], &peak[i],
+			&data[i], length - i, alpha);
+}
+#endif
+
+// The CRC instructions are optional before ARMv8.1, only used when built in
+#if defined(SIMD_NEON) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+static uint32_t crc_arm(uint32_t crc, const unsigned char *data,
+		size_t length) {
+
+	crc = ~crc;
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		crc = __crc32cd(crc, value);
+	}
+	while (length--)
+		crc = __crc32cb(crc, *data++);
+
+	return (~crc);
+}
+#define CRC_NEON crc_arm
+#else
+#define CRC_NEON crc_scalar
+#endif
+
+// Check the CRC matches the reference at every alignment and tail length
+static bool check_crc(const SIMD_KERNELS_T *check) {
+
+	unsigned char data[CHECK_BLOCK];
+	uint32_t state = 1;
+	unsigned i;
+
+	for (i = 0; i < CHECK_BLOCK; i++) {
+		state = state * 1664525u + 1013904223u;
+		data[i] = (unsigned char) (state >> 24);
+	}
+	for (i = 0; i < 64; i++)
+		if (crc_scalar(i, &data[i % 16], CHECK_BLOCK - 16 - i)
+				!= check->crc(i, &data[i % 16], CHECK_BLOCK - 16 - i))
+			return (false);
+
+	return (true);
+}
+
+// Check accumulating matches the reference over a few captures of random
+// samples including the extremes, averages within the tolerance
+static bool check_accumulate(const SIMD_KERNELS_T *check) {
+
+	static double sums[2][CHECK_BLOCK], averages[2][CHECK_BLOCK];
+	static int16_t extremes[2][3][CHECK_BLOCK];
+	int16_t data[CHECK_BLOCK];
+	uint32_t state = 1;
+	unsigned capture, i, j;
+
+	for (i = 0; i < 2; i++) {
+		memset(sums[i], 0, sizeof(sums[i]));
+		memset(averages[i], 0, sizeof(averages[i]));
+		for (j = 0; j < CHECK_BLOCK; j++) {
+			extremes[i][0][j] = INT16_MAX;
+			extremes[i][1][j] = INT16_MIN;
+			extremes[i][2][j] = 0;
+		}
+	}
+
+	for (capture = 0; capture < 4; capture++) {
+		for (i = 0; i < CHECK_BLOCK; i++) {
+			state = state * 1664525u + 1013904223u;
+			data[i] = (int16_t) (state >> 16);
+		}
+		data[capture] = INT16_MIN;
+		data[capture + 8] = INT16_MAX;
+
+		accumulate_scalar(sums[0], averages[0], extremes[0][0], extremes[0][1],
+				extremes[0][2], data, CHECK_BLOCK - 1, capture ? 0.25 : 1);
+		check->accumulate(sums[1], averages[1], extremes[1][0],
+				extremes[1][1], extremes[1][2], data, CHECK_BLOCK - 1,
+				capture ? 0.25 : 1);
+	}
+
+	if (memcmp(sums[0], sums[1], sizeof(sums[0]))
+			|| memcmp(extremes[0], extremes[1], sizeof(extremes[0])))
+		return (false);
+	for (i = 0; i < CHECK_BLOCK; i++)
+		if (fabs(averages[0][i] - averages[1][i]) > CHECK_TOLERANCE)
+			return (false);
+
+	return (true);
+}
+
+// Check differences match the reference on random samples, and restore
+// the samples
+static bool check_deltas(const SIMD_KERNELS_T *check) {
+
+	int16_t data[CHECK_BLOCK];
+	int16_t restored[CHECK_BLOCK];
+	uint16_t expected[CHECK_BLOCK];
+	uint16_t actual[CHECK_BLOCK];
+	uint32_t state = 1;
+	unsigned i, shift;
+
+	// Narrower differences at each shift
+	for (shift = 0; shift < 16; shift++) {
+		for (i = 0; i < CHECK_BLOCK; i++) {
+			state = state * 1664525u + 1013904223u;
+			data[i] = (int16_t) (state >> 16 >> shift);
+		}
+		data[0] = INT16_MIN;
+		data[1] = INT16_MAX;
+
+		if (delta_scalar(expected, data, CHECK_BLOCK - 1, -1)
+				!= check->delta(actual, data, CHECK_BLOCK - 1, -1)
+				|| memcmp(expected, actual, sizeof(uint16_t) * (CHECK_BLOCK - 1)))
+			return (false);
+
+		check->undelta(restored, actual, CHECK_BLOCK - 1, -1);
+		if (memcmp(data, restored, sizeof(int16_t) * (CHECK_BLOCK - 1)))
+			return (false);
+	}
+
+	return (true);
+}
+
+// Check butterflies match the reference, on values spanning the range
+// of transformed samples
+static bool check_butterflies(const SIMD_KERNELS_T *check) {
+
+	double values[6][CHECK_BUTTERFLIES];
+	double expected[4][CHECK_BUTTERFLIES];
+	uint32_t state = 1;
+	unsigned i, j;
+
+	for (i = 0; i < 6; i++)
+		for (j = 0; j < CHECK_BUTTERFLIES; j++) {
+			state = state * 1664525u + 1013904223u;
+			values[i][j] = ((double) state / UINT32_MAX - 0.5)
+					* (i < 4 ? 65536.0 : 2.0);
+		}
+	memcpy(expected, values, sizeof(expected));
+
+	butterfly_scalar(expected[0], expected[1], expected[2], expected[3],
+			values[4], values[5], CHECK_BUTTERFLIES);
+	check->butterfly(values[0], values[1], values[2], values[3], values[4],
+			values[5], CHECK_BUTTERFLIES);
+
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < CHECK_BUTTERFLIES; j++)
+			if (fabs(values[i][j] - expected[i][j]) > CHECK_TOLERANCE)
+				return (false);
+
+	return (true);
+}
+
+// Fill a block with consecutive sample values
+static void check_block(int16_t *data, uint32_t *value) {
+
+	uint32_t i;
+	for (i = 0; i < CHECK_BLOCK; i++, (*value)++)
+		data[i] = (int16_t) (*value - 0x8000);
+}
+
+// Check kernels match the reference for every sample value
+// Odd lengths are used to include the scalar tails
+static bool check_kernels(const SIMD_KERNELS_T *check) {
+
+	int16_t data[CHECK_BLOCK];
+	double expected[CHECK_BLOCK];
+	double actual[CHECK_BLOCK];
+	float expected_float[CHECK_BLOCK];
+	float actual_float[CHECK_BLOCK];
+	const double factor = 0.5 / 25;
+	SAMPLE_SUMS_T expected_sums = { INT16_MAX, INT16_MIN, 0, 0 };
+	SAMPLE_SUMS_T actual_sums = { INT16_MAX, INT16_MIN, 0, 0 };
+	uint32_t value = 0;
+
+	while (value < 0x10000) {
+		check_block(data, &value);
+
+		scale_scalar(expected, data, CHECK_BLOCK - 1, factor);
+		check->scale(actual, data, CHECK_BLOCK - 1, factor);
+		if (memcmp(expected, actual, sizeof(double) * (CHECK_BLOCK - 1)))
+			return (false);
+
+		scale_float_scalar(expected_float, data, CHECK_BLOCK - 1,
+				(float) factor);
+		check->scale_float(actual_float, data, CHECK_BLOCK - 1,
+				(float) factor);
+		if (memcmp(expected_float, actual_float,
+				sizeof(float) * (CHECK_BLOCK - 1)))
+			return (false);
+
+		// Accumulated over every block, including the extremes
+		sums_scalar(&expected_sums, data, CHECK_BLOCK - 1);
+		check->sums(&actual_sums, data, CHECK_BLOCK - 1);
+		if (expected_sums.min != actual_sums.min
+				|| expected_sums.max != actual_sums.max
+				|| expected_sums.sum != actual_sums.sum
+				|| expected_sums.squares != actual_sums.squares)
+			return (false);
+	}
+
+	return (check_butterflies(check) && check_deltas(check)
+			&& check_crc(check) && check_accumulate(check));
+}
+
+// Use a set of kernels if they check out
+static void try_kernels(const SIMD_KERNELS_T *check) {
+
+	if (check_kernels(check))
+		kernels = *check;
+	else
+		error("SIMD kernels do not match reference, ignoring");
+}
+
+static const SIMD_KERNELS_T reference = { "scalar", scale_scalar,
+		scale_float_scalar, sums_scalar, butterfly_scalar, delta_scalar,
+		undelta_scalar, crc_scalar, accumulate_scalar };
+
+static void select_kernels(void) {
+
+	const char *force = getenv("OWON_SIMD");
+
+	crc_init();
+	kernels = reference;
+
+	if (force && strcmp(force, "scalar") == 0)
+		return;
+
+#if defined(SIMD_X86)
+	CRC_FN crc = cpu_supports("sse4.2") ? crc_sse42 : crc_scalar;
+	if (cpu_supports("sse2")) {
+		const SIMD_KERNELS_T sse2 = { "sse2", scale_sse2, scale_float_sse2,
+				sums_sse2, butterfly_sse2, delta_sse2, undelta_sse2, crc,
+				accumulate_sse2 };
+		try_kernels(&sse2);
+	}
+	if ((!force || strcmp(force, "sse2") != 0) && cpu_supports("avx2")) {
+		const SIMD_KERNELS_T avx2 = { "avx2", scale_avx2, scale_float_avx2,
+				sums_avx2, butterfly_avx2, delta_avx2, undelta_sse2, crc,
+				accumulate_avx2 };
+		try_kernels(&avx2);
+	}
+#endif
+#if defined(SIMD_NEON)
+	{
+		const SIMD_KERNELS_T neon = { "neon", scale_neon, scale_float_neon,
+				sums_neon, butterfly_neon, delta_neon, undelta_neon, CRC_NEON,
+				accumulate_neon };
+		try_kernels(&neon);
+	}
+#endif
+}
+
+// Get the kernels selected for this CPU
+// Setting OWON_SIMD to "scalar" or "sse2" limits the selection
+const SIMD_KERNELS_T *simd_kernels(void) {
+
+	pthread_once(&kernels_once, select_kernels);
+
+	return (&kernels);
+}
+
+// Get the reference kernels
+const SIMD_KERNELS_T *simd_reference(void) {
+
+	pthread_once(&kernels_once, select_kernels);
+
+	return (&reference);
+}
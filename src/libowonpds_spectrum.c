@@ -0,0 +1,517 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+/*
+ * Real samples are transformed as complex values of half the length
+ * (even lengths), then separated. Power of two lengths use a radix-2
+ * transform, others Bluestein's algorithm on a radix-2 transform of at
+ * least twice the length.
+ *
+ */
+
+#define PI 3.14159265358979323846
+
+// Unused plans kept for later captures
+#define PLAN_CACHE 8
+// Transform length finished at a time, 32kB of each part
+#define TRANSFORM_BLOCK 4096
+
+// Transform plan for a number of real samples, shared between spectra
+// Complex tables hold the real parts followed by the imaginary parts
+struct owon_plan {
+	uint32_t samples;				// Real samples
+	uint32_t size;					// Complex transform size
+	uint32_t length;				// Radix-2 transform size
+	uint32_t *reverse;				// Bit reversal permutation of length
+	double *twiddle;				// Twiddles of each stage, length each
+	double *chirp;					// Bluestein chirp, size each, or NULL
+	double *filter;					// Transformed Bluestein filter, length each
+	double *split;					// Twiddles separating real values, size + 1 each
+	double *window[OWON_WINDOWS];	// Windows, made when first used
+	double gain[OWON_WINDOWS];		// Sum of each window
+	unsigned users;					// Spectra using the plan
+	struct owon_plan *next;
+};
+
+// Plans, most recently used first
+static struct owon_plan *plans = NULL;
+static pthread_mutex_t plans_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// In place radix-2 transform
+static void transform_radix2(const struct owon_plan *plan, double *re,
+		double *im) {
+
+	BUTTERFLY_FN butterfly = simd_kernels()->butterfly;
+	uint32_t length = plan->length;
+	const double *w_re = plan->twiddle;
+	const double *w_im = plan->twiddle + length;
+	uint32_t block, start, half, i;
+
+	for (i = 0; i < length; i++) {
+		uint32_t j = plan->reverse[i];
+		if (i < j) {
+			double swap = re[i];
+			re[i] = re[j];
+			re[j] = swap;
+			swap = im[i];
+			im[i] = im[j];
+			im[j] = swap;
+		}
+	}
+
+	// Stages within a block are finished while it is cached
+	block = length < TRANSFORM_BLOCK ? length : TRANSFORM_BLOCK;
+	for (start = 0; start < length; start += block) {
+		double *b_re = &re[start];
+		double *b_im = &im[start];
+
+		// The first two stages have twiddles of 1 and -i
+		if (block >= 2)
+			for (i = 0; i < block; i += 2) {
+				double t_re = b_re[i + 1];
+				double t_im = b_im[i + 1];
+				b_re[i + 1] = b_re[i] - t_re;
+				b_im[i + 1] = b_im[i] - t_im;
+				b_re[i] += t_re;
+				b_im[i] += t_im;
+			}
+		if (block >= 4)
+			for (i = 0; i < block; i += 4) {
+				double t_re = b_re[i + 2];
+				double t_im = b_im[i + 2];
+				b_re[i + 2] = b_re[i] - t_re;
+				b_im[i + 2] = b_im[i] - t_im;
+				b_re[i] += t_re;
+				b_im[i] += t_im;
+
+				t_re = b_im[i + 3];
+				t_im = -b_re[i + 3];
+				b_re[i + 3] = b_re[i + 1] - t_re;
+				b_im[i + 3] = b_im[i + 1] - t_im;
+				b_re[i + 1] += t_re;
+				b_im[i + 1] += t_im;
+			}
+
+		for (half = 4; half < block; half *= 2)
+			for (i = 0; i < block; i += 2 * half)
+				butterfly(&b_re[i], &b_im[i], &b_re[i + half], &b_im[i + half],
+						&w_re[half - 1], &w_im[half - 1], half);
+	}
+
+	for (half = block; half < length; half *= 2)
+		for (i = 0; i < length; i += 2 * half)
+			butterfly(&re[i], &im[i], &re[i + half], &im[i + half],
+					&w_re[half - 1], &w_im[half - 1], half);
+}
+
+// Transform with Bluestein's algorithm, as a convolution with a chirp
+// work holds two plan->length buffers
+static void transform_bluestein(const struct owon_plan *plan, double *re,
+		double *im, double *work) {
+
+	uint32_t size = plan->size;
+	uint32_t length = plan->length;
+	const double *c_re = plan->chirp;
+	const double *c_im = plan->chirp + size;
+	const double *f_re = plan->filter;
+	const double *f_im = plan->filter + length;
+	double *w_re = work;
+	double *w_im = work + length;
+	uint32_t i;
+
+	for (i = 0; i < size; i++) {
+		w_re[i] = re[i] * c_re[i] - im[i] * c_im[i];
+		w_im[i] = re[i] * c_im[i] + im[i] * c_re[i];
+	}
+	memset(&w_re[size], 0, sizeof(double) * (length - size));
+	memset(&w_im[size], 0, sizeof(double) * (length - size));
+
+	transform_radix2(plan, w_re, w_im);
+
+	// Convolve, conjugated so the forward transform inverts
+	for (i = 0; i < length; i++) {
+		double t_re = w_re[i] * f_re[i] - w_im[i] * f_im[i];
+		double t_im = w_re[i] * f_im[i] + w_im[i] * f_re[i];
+		w_re[i] = t_re;
+		w_im[i] = -t_im;
+	}
+
+	transform_radix2(plan, w_re, w_im);
+
+	for (i = 0; i < size; i++) {
+		re[i] = w_re[i] * c_re[i] + w_im[i] * c_im[i];
+		im[i] = w_re[i] * c_im[i] - w_im[i] * c_re[i];
+	}
+}
+
+static void free_plan(struct owon_plan *plan) {
+
+	unsigned i;
+
+	free(plan->reverse);
+	free(plan->twiddle);
+	free(plan->chirp);
+	free(plan->filter);
+	free(plan->split);
+	for (i = 0; i < OWON_WINDOWS; i++)
+		free(plan->window[i]);
+	free(plan);
+}
+
+// Make the tables of a plan
+static struct owon_plan *create_plan(const uint32_t samples) {
+
+	struct owon_plan *plan = calloc(1, sizeof(struct owon_plan));
+	uint32_t size, length, bits, i;
+
+	if (!plan)
+		return (NULL);
+
+	size = samples % 2 ? samples : samples / 2;
+	for (length = 1, bits = 0; length < size; bits++)
+		length *= 2;
+	if (length != size)
+		for (length = 1, bits = 0; length < 2 * size - 1; bits++)
+			length *= 2;
+
+	plan->samples = samples;
+	plan->size = size;
+	plan->length = length;
+	plan->reverse = malloc(sizeof(uint32_t) * length);
+	plan->twiddle = malloc(sizeof(double) * 2 * length);
+	if (!(samples % 2))
+		plan->split = malloc(sizeof(double) * 2 * (size + 1));
+	if (length != size) {
+		plan->chirp = malloc(sizeof(double) * 2 * size);
+		plan->filter = malloc(sizeof(double) * 2 * length);
+	}
+	if (!plan->reverse || !plan->twiddle || (!(samples % 2) && !plan->split)
+			|| (length != size && (!plan->chirp || !plan->filter))) {
+		free_plan(plan);
+		return (NULL);
+	}
+
+	for (i = 0; i < length; i++) {
+		uint32_t reversed = 0;
+		uint32_t bit;
+		for (bit = 0; bit < bits; bit++)
+			reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+		plan->reverse[i] = reversed;
+	}
+
+	// Stage with half h uses exp(-i pi j / h) at h - 1 + j
+	for (i = 1; i < length; i *= 2) {
+		uint32_t j;
+		for (j = 0; j < i; j++) {
+			plan->twiddle[i - 1 + j] = cos(PI * j / i);
+			plan->twiddle[length + i - 1 + j] = -sin(PI * j / i);
+		}
+	}
+
+	if (plan->split)
+		for (i = 0; i <= size; i++) {
+			plan->split[i] = cos(PI * i / size);
+			plan->split[size + 1 + i] = -sin(PI * i / size);
+		}
+
+	if (plan->chirp) {
+		double *f_re = plan->filter;
+		double *f_im = plan->filter + length;
+
+		// exp(-i pi n^2 / size), with n^2 reduced to keep the precision
+		for (i = 0; i < size; i++) {
+			uint64_t square = (uint64_t) i * i % (2 * (uint64_t) size);
+			plan->chirp[i] = cos(PI * (double) square / size);
+			plan->chirp[size + i] = -sin(PI * (double) square / size);
+		}
+
+		// Conjugate chirp, wrapped for a circular convolution, and scaled
+		// for the inverse transform
+		memset(plan->filter, 0, sizeof(double) * 2 * length);
+		for (i = 0; i < size; i++) {
+			f_re[i] = plan->chirp[i] / length;
+			f_im[i] = -plan->chirp[size + i] / length;
+			if (i) {
+				f_re[length - i] = f_re[i];
+				f_im[length - i] = f_im[i];
+			}
+		}
+		transform_radix2(plan, f_re, f_im);
+	}
+
+	return (plan);
+}
+
+// Free unused plans beyond the cache size
+static void trim_plans(void) {
+
+	struct owon_plan **link = &plans;
+	unsigned unused = 0;
+
+	while (*link) {
+		struct owon_plan *plan = *link;
+		if (!plan->users && ++unused > PLAN_CACHE) {
+			*link = plan->next;
+			free_plan(plan);
+		} else
+			link = &plan->next;
+	}
+}
+
+// Get the plan for a number of samples, made if not cached
+static struct owon_plan *acquire_plan(const uint32_t samples) {
+
+	struct owon_plan **link;
+	struct owon_plan *plan;
+
+	pthread_mutex_lock(&plans_lock);
+	for (link = &plans; *link; link = &(*link)->next) {
+		plan = *link;
+		if (plan->samples == samples) {
+			*link = plan->next;
+			plan->next = plans;
+			plans = plan;
+			plan->users++;
+			pthread_mutex_unlock(&plans_lock);
+			return (plan);
+		}
+	}
+	pthread_mutex_unlock(&plans_lock);
+
+	// Made unlocked, another spectrum may make the same plan meanwhile
+	plan = create_plan(samples);
+	if (!plan)
+		return (NULL);
+
+	pthread_mutex_lock(&plans_lock);
+	plan->users = 1;
+	plan->next = plans;
+	plans = plan;
+	trim_plans();
+	pthread_mutex_unlock(&plans_lock);
+
+	return (plan);
+}
+
+static void release_plan(struct owon_plan *plan) {
+
+	pthread_mutex_lock(&plans_lock);
+	plan->users--;
+	trim_plans();
+	pthread_mutex_unlock(&plans_lock);
+}
+
+// Get a window of a plan, made on first use
+static const double *get_window(struct owon_plan *plan,
+		const unsigned window) {
+
+	const double *taper;
+
+	pthread_mutex_lock(&plans_lock);
+	if (!plan->window[window]) {
+		double *values = malloc(sizeof(double) * plan->samples);
+		double gain = 0;
+		uint32_t i;
+
+		for (i = 0; values && i < plan->samples; i++) {
+			double x = 2 * PI * i / plan->samples;
+			switch (window) {
+			case OWON_WINDOW_HANN:
+				values[i] = 0.5 - 0.5 * cos(x);
+				break;
+			case OWON_WINDOW_BLACKMAN:
+				values[i] = 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+				break;
+			case OWON_WINDOW_FLATTOP:
+				values[i] = 0.21557895 - 0.41663158 * cos(x)
+						+ 0.277263158 * cos(2 * x) - 0.083578947 * cos(3 * x)
+						+ 0.006947368 * cos(4 * x);
+				break;
+			default:
+				values[i] = 1;
+				break;
+			}
+			gain += values[i];
+		}
+		plan->window[window] = values;
+		plan->gain[window] = gain;
+	}
+	taper = plan->window[window];
+	pthread_mutex_unlock(&plans_lock);
+
+	return (taper);
+}
+
+/**
+ * Find the spectrum of a channel
+ *
+ * Plans for each capture length are cached and shared between spectra,
+ * buffers are reused between captures.\n
+ * Magnitudes are corrected for the window gain, so a sine wave at a bin
+ * frequency shows its peak amplitude. Averages are of power, and restart
+ * when the capture length or window changes.
+ *
+ * @param spectrum	Zero initialised or previously used spectrum
+ * @param channel	Channel of a decoded capture
+ * @param window	OWON_WINDOW_
+ * @param flags		OWON_SPECTRUM_ flags
+ * @return
+ * 				- 0 Success
+ * 				- >0 OWON_ERROR error
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_spectrum(OWON_SPECTRUM_T *spectrum,
+		const OWON_CHANNEL_T *channel, const unsigned window,
+		const unsigned flags) {
+
+	uint32_t samples = channel->samples;
+	struct owon_plan *plan;
+	const double *taper;
+	bool even = !(samples % 2);
+	uint32_t bins = samples / 2 + 1;
+	uint32_t i;
+
+	if (!samples || !channel->data || window >= OWON_WINDOWS)
+		return (OWON_ERROR_FORMAT);
+
+	if (!spectrum->plan || spectrum->plan->samples != samples) {
+		if (spectrum->plan)
+			release_plan(spectrum->plan);
+		spectrum->plan = acquire_plan(samples);
+		spectrum->averages = 0;
+	}
+	plan = spectrum->plan;
+	if (plan) {
+		spectrum->magnitude = reserve(spectrum->magnitude,
+				&spectrum->magnitude_size, sizeof(double) * bins);
+		spectrum->power = reserve(spectrum->power, &spectrum->power_size,
+				sizeof(double) * bins);
+		spectrum->work = reserve(spectrum->work, &spectrum->work_size,
+				sizeof(double) * 2
+						* (plan->size + (plan->chirp ? plan->length : 0)));
+		if (flags & OWON_SPECTRUM_PHASE)
+			spectrum->phase = reserve(spectrum->phase, &spectrum->phase_size,
+					sizeof(double) * bins);
+	}
+	if (!plan || !spectrum->magnitude || !spectrum->power || !spectrum->work
+			|| ((flags & OWON_SPECTRUM_PHASE) && !spectrum->phase)
+			|| !(taper = get_window(plan, window))) {
+		error("Failed to allocate spectrum memory");
+		spectrum->averages = 0;
+		return (LIBUSB_ERROR_NO_MEM);
+	}
+
+	if (!(flags & OWON_SPECTRUM_AVERAGE) || window != spectrum->window)
+		spectrum->averages = 0;
+
+	// Pack the windowed samples, pairs as complex values if even
+	double *re = spectrum->work;
+	double *im = spectrum->work + plan->size;
+	const int16_t *data = channel->data;
+	for (i = 0; i < plan->size; i++) {
+		if (even) {
+			re[i] = data[2 * i] * taper[2 * i];
+			im[i] = data[2 * i + 1] * taper[2 * i + 1];
+		} else {
+			re[i] = data[i] * taper[i];
+			im[i] = 0;
+		}
+	}
+
+	if (plan->chirp)
+		transform_bluestein(plan, re, im, spectrum->work + 2 * plan->size);
+	else
+		transform_radix2(plan, re, im);
+
+	double factor = channel->scale / plan->gain[window];
+	unsigned averages = spectrum->averages + 1;
+	for (i = 0; i < bins; i++) {
+		double x_re, x_im;
+
+		if (even) {
+			// Separate the transforms of the even and odd samples
+			uint32_t k = i % plan->size;
+			uint32_t j = (plan->size - i) % plan->size;
+			double e_re = (re[k] + re[j]) / 2;
+			double e_im = (im[k] - im[j]) / 2;
+			double o_re = (im[k] + im[j]) / 2;
+			double o_im = (re[j] - re[k]) / 2;
+			double w_re = plan->split[i];
+			double w_im = plan->split[plan->size + 1 + i];
+			x_re = e_re + w_re * o_re - w_im * o_im;
+			x_im = e_im + w_re * o_im + w_im * o_re;
+		} else {
+			x_re = re[i];
+			x_im = im[i];
+		}
+
+		// Both sides of the spectrum, except DC and Nyquist
+		double amplitude = sqrt(x_re * x_re + x_im * x_im) * factor;
+		if (i && !(even && i == bins - 1))
+			amplitude *= 2;
+
+		if (spectrum->averages)
+			spectrum->power[i] += amplitude * amplitude;
+		else
+			spectrum->power[i] = amplitude * amplitude;
+		spectrum->magnitude[i] = sqrt(spectrum->power[i] / averages);
+		if (flags & OWON_SPECTRUM_PHASE)
+			spectrum->phase[i] = atan2(x_im, x_re);
+	}
+
+	spectrum->samples = samples;
+	spectrum->bins = bins;
+	spectrum->resolution = channel->sample_rate / samples;
+	spectrum->window = window;
+	spectrum->averages = averages;
+
+	return (0);
+}
+
+/**
+ * Free the buffers of a spectrum
+ *
+ * @param spectrum	Spectrum to free
+ *
+ */
+LIBOWONPDS_EXPORT void owon_spectrum_free(OWON_SPECTRUM_T *spectrum) {
+
+	if (spectrum->plan)
+		release_plan(spectrum->plan);
+	free(spectrum->magnitude);
+	free(spectrum->phase);
+	free(spectrum->power);
+	free(spectrum->work);
+	memset(spectrum, 0, sizeof(OWON_SPECTRUM_T));
+}
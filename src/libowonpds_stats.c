@@ -0,0 +1,139 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+#define NS_PER_MS 1000000
+
+// Start time of a stage, or 0 if statistics are off
+uint64_t stats_time(const OWON_SCOPE_T *scope) {
+
+	if (scope->options & OWON_OPT_STATS)
+		return (owon_time());
+
+	return (0);
+}
+
+// Start a capture, clearing the stage times of the previous one
+void stats_begin(OWON_SCOPE_T *scope) {
+
+	if (scope->options & OWON_OPT_STATS)
+		memset(scope->stats.last, 0, sizeof(scope->stats.last));
+}
+
+// Add time to a stage
+void stats_add(OWON_SCOPE_T *scope, const unsigned stage, const uint64_t time) {
+
+	scope->stats.last[stage] += time;
+	scope->stats.total[stage] += time;
+}
+
+// End a stage started at stats_time()
+void stats_stage(OWON_SCOPE_T *scope, const unsigned stage,
+		const uint64_t start) {
+
+	if (start)
+		stats_add(scope, stage, owon_time() - start);
+}
+
+// Count the result of a transfer
+void stats_transfer(OWON_SCOPE_T *scope, const int error_code,
+		const int transferred) {
+
+	if (!(scope->options & OWON_OPT_STATS))
+		return;
+
+	if (transferred > 0)
+		scope->stats.bytes += (uint64_t) transferred;
+	if (error_code == LIBUSB_ERROR_TIMEOUT)
+		scope->stats.timeouts++;
+	else if (error_code < 0)
+		scope->stats.errors++;
+}
+
+// Count a decoded capture requested at timestamp
+void stats_capture(OWON_SCOPE_T *scope, const uint64_t timestamp) {
+
+	if (!(scope->options & OWON_OPT_STATS))
+		return;
+
+	uint64_t latency = owon_time() - timestamp;
+	uint64_t ms = latency / NS_PER_MS;
+	unsigned bin = 0;
+
+	while (ms && bin < OWON_HISTOGRAM_BINS - 1) {
+		ms >>= 1;
+		bin++;
+	}
+
+	scope->stats.latency = latency;
+	scope->stats.captures++;
+	scope->stats.histogram[bin]++;
+}
+
+// Move the decode times of a capture decoded in a separate struct
+void stats_merge(OWON_SCOPE_T *scope, OWON_SCOPE_T *capture) {
+
+	unsigned i;
+
+	if (!(scope->options & OWON_OPT_STATS))
+		return;
+
+	for (i = OWON_STAGE_DECODE; i < OWON_STAGES; i++) {
+		stats_add(scope, i, capture->stats.last[i]);
+		capture->stats.last[i] = 0;
+	}
+}
+
+/**
+ * Get the capture timings and counters
+ *
+ * Statistics are collected while OWON_OPT_STATS is set in scope->options.
+ * While streaming the values are updated by the acquisition thread, and
+ * may be read mid-update.
+ *
+ * @param scope		Scope structure
+ * @param stats		Copy of the statistics
+ *
+ */
+LIBOWONPDS_EXPORT void owon_get_stats(const OWON_SCOPE_T *scope,
+		OWON_STATS_T *stats) {
+
+	memcpy(stats, &scope->stats, sizeof(OWON_STATS_T));
+}
+
+/**
+ * Clear the capture timings and counters
+ *
+ * @param scope		Scope structure
+ *
+ */
+LIBOWONPDS_EXPORT void owon_reset_stats(OWON_SCOPE_T *scope) {
+
+	memset(&scope->stats, 0, sizeof(OWON_STATS_T));
+}
@@ -0,0 +1,255 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "libowonpds.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds_internal.h"
+
+// Time to wait for the consumer when the ring is full (ms)
+#define WAIT_FULL 1
+// Time to wait for the producer when the ring is empty (ms)
+#define WAIT_EMPTY 1
+
+#define NS_PER_MS 1000000
+
+// Background acquisition state
+struct owon_stream {
+	pthread_t thread;
+	OWON_SCOPE_T *slots;	// Ring of captures
+	unsigned size;			// Number of slots
+	unsigned head;			// Next slot to fill (producer)
+	unsigned tail;			// Oldest filled slot (consumer)
+	bool held;				// Consumer holds the tail slot
+	unsigned running;		// Thread is acquiring
+	unsigned stop;			// Thread has been asked to stop
+	int error_code;			// Error that stopped the thread
+};
+
+// Acquisition thread, the single producer
+static void *stream_thread(void *arg) {
+
+	OWON_SCOPE_T *scope = arg;
+	struct owon_stream *stream = scope->stream;
+	int error_code = LIBUSB_SUCCESS;
+
+	while (!ATOMIC_LOAD(&stream->stop)) {
+		unsigned head = stream->head;
+
+		// Wait for the consumer to free a slot
+		if (head - ATOMIC_LOAD(&stream->tail) >= stream->size) {
+			sleep_ms(WAIT_FULL);
+			continue;
+		}
+
+		OWON_SCOPE_T *capture = &stream->slots[head % stream->size];
+		error_code = read_capture(scope, capture);
+		stats_merge(scope, capture);
+		if (error_code == LIBUSB_SUCCESS)
+			stats_capture(scope, capture->timestamp);
+
+		if (error_code == LIBUSB_SUCCESS)
+			ATOMIC_STORE(&stream->head, head + 1);
+		else if (error_code != LIBUSB_ERROR_TIMEOUT
+				&& error_code != OWON_ERROR_FORMAT)
+			break;
+	}
+
+	if (error_code == LIBUSB_ERROR_TIMEOUT || error_code == OWON_ERROR_FORMAT)
+		error_code = LIBUSB_SUCCESS;
+	stream->error_code = error_code;
+	ATOMIC_STORE(&stream->running, 0);
+
+	return (NULL);
+}
+
+/**
+ * Start capturing on a background thread
+ *
+ * Captures are decoded into a ring and retrieved with owon_try_pop().
+ * When the ring is full the thread waits, so the device is polled no
+ * faster than captures are consumed.\n
+ * owon_read() must not be used on the scope until
+ * owon_stop_streaming() is called.
+ *
+ * @param scope 		Initialised scope struct
+ * @param ring_depth	Number of captures that can be queued
+ * @return
+ * 				- 0 Success
+ * 				- <0 libusb error
+ *
+ */
+LIBOWONPDS_EXPORT int owon_start_streaming(OWON_SCOPE_T *scope,
+		const unsigned ring_depth) {
+
+	struct owon_stream *stream;
+	unsigned i;
+
+	if (!is_open(scope))
+		return (LIBUSB_ERROR_NO_DEVICE);
+	if (scope->stream || ring_depth == 0)
+		return (LIBUSB_ERROR_INVALID_PARAM);
+
+	stream = calloc(1, sizeof(struct owon_stream));
+	if (!stream)
+		return (LIBUSB_ERROR_NO_MEM);
+
+	// One extra slot for the capture held by the consumer
+	stream->size = ring_depth + 1;
+	stream->slots = calloc(stream->size, sizeof(OWON_SCOPE_T));
+	if (!stream->slots) {
+		free(stream);
+		return (LIBUSB_ERROR_NO_MEM);
+	}
+	for (i = 0; i < stream->size; i++) {
+		memcpy(stream->slots[i].manufacturer, scope->manufacturer,
+				sizeof(scope->manufacturer));
+		memcpy(stream->slots[i].product, scope->product,
+				sizeof(scope->product));
+		stream->slots[i].options = scope->options;
+	}
+
+	// Slots are new, none hold the channels of the last capture
+	dedup_detach(scope);
+
+	stream->running = 1;
+	scope->stream = stream;
+	if (pthread_create(&stream->thread, NULL, stream_thread, scope) != 0) {
+		scope->stream = NULL;
+		free(stream->slots);
+		free(stream);
+		error("Failed to create acquisition thread");
+		return (LIBUSB_ERROR_OTHER);
+	}
+
+	return (LIBUSB_SUCCESS);
+}
+
+/**
+ * Get the oldest capture from the background thread
+ *
+ * Does not block. The capture remains valid until owon_try_pop() returns
+ * another capture, or owon_stop_streaming() is called.
+ *
+ * @param scope 	Streaming scope struct
+ * @param capture	Set to the capture, or NULL if none are queued
+ * @return
+ * 				- 0 Success
+ * 				- <0 libusb error that stopped the acquisition thread
+ *
+ */
+LIBOWONPDS_EXPORT int owon_try_pop(OWON_SCOPE_T *scope,
+		OWON_SCOPE_T **capture) {
+
+	struct owon_stream *stream = scope->stream;
+	unsigned next;
+
+	*capture = NULL;
+	if (!stream)
+		return (LIBUSB_ERROR_INVALID_PARAM);
+
+	next = stream->tail;
+	if (stream->held)
+		next++;
+
+	if (ATOMIC_LOAD(&stream->head) != next) {
+		// Release the previous capture and hold the next
+		stream->held = true;
+		ATOMIC_STORE(&stream->tail, next);
+		*capture = &stream->slots[next % stream->size];
+	} else if (!ATOMIC_LOAD(&stream->running))
+		return (stream->error_code);
+
+	return (LIBUSB_SUCCESS);
+}
+
+/**
+ * Wait for the oldest capture from the background thread
+ *
+ * As owon_try_pop(), but waits up to timeout for a capture to be queued.
+ * owon_stop_streaming() must not be called while waiting.
+ *
+ * @param scope 	Streaming scope struct
+ * @param capture	Set to the capture, or NULL if none arrived in time
+ * @param timeout	Maximum time to wait (ms)
+ * @return
+ * 				- 0 Success
+ * 				- <0 libusb error that stopped the acquisition thread
+ *
+ */
+LIBOWONPDS_EXPORT int owon_pop(OWON_SCOPE_T *scope, OWON_SCOPE_T **capture,
+		const unsigned timeout) {
+
+	uint64_t end = owon_time() + (uint64_t) timeout * NS_PER_MS;
+	int error_code;
+
+	for (;;) {
+		error_code = owon_try_pop(scope, capture);
+		if (*capture || error_code != LIBUSB_SUCCESS)
+			break;
+		// Nothing more will arrive
+		if (!ATOMIC_LOAD(&scope->stream->running) || owon_time() >= end)
+			break;
+		sleep_ms(WAIT_EMPTY);
+	}
+
+	return (error_code);
+}
+
+/**
+ * Stop capturing on the background thread
+ *
+ * Waits for the capture in progress and frees any queued captures.
+ *
+ * @param scope 	Streaming scope struct
+ * @return
+ * 				- 0 Success
+ * 				- <0 libusb error that stopped the acquisition thread
+ *
+ */
+LIBOWONPDS_EXPORT int owon_stop_streaming(OWON_SCOPE_T *scope) {
+
+	struct owon_stream *stream = scope->stream;
+	int error_code;
+	unsigned i;
+
+	if (!stream)
+		return (LIBUSB_SUCCESS);
+
+	ATOMIC_STORE(&stream->stop, 1);
+	pthread_join(stream->thread, NULL);
+	error_code = stream->error_code;
+
+	for (i = 0; i < stream->size; i++)
+		owon_free(&stream->slots[i]);
+	free(stream->slots);
+	free(stream);
+	scope->stream = NULL;
+
+	return (error_code);
+}
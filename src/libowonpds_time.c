@@ -0,0 +1,108 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "libowonpds.h"
+
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "libowonpds_internal.h"
+
+/**
+ * Get the time from a monotonic clock
+ *
+ * Capture timestamps use this clock, so captures from different
+ * scopes in the same process can be aligned.
+ *
+ * @return Time (ns) from an arbitrary start point
+ *
+ */
+LIBOWONPDS_EXPORT uint64_t owon_time(void) {
+
+#if defined(_WIN32)
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return ((uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+			+ (uint64_t) (counter.QuadPart % frequency.QuadPart)
+					* 1000000000ULL / (uint64_t) frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec);
+#endif
+}
+
+// Get the time from the real time clock (ns since 1970 UTC)
+uint64_t wall_time(void) {
+
+#if defined(_WIN32)
+	FILETIME now;
+	ULARGE_INTEGER ticks;
+	GetSystemTimeAsFileTime(&now);
+	ticks.LowPart = now.dwLowDateTime;
+	ticks.HighPart = now.dwHighDateTime;
+	// 100ns ticks since 1601
+	return ((ticks.QuadPart - 116444736000000000ULL) * 100);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ((uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec);
+#endif
+}
+
+// Sleep for a number of milliseconds
+void sleep_ms(const unsigned ms) {
+
+#if defined(_WIN32)
+	Sleep(ms);
+#else
+	struct timespec delay;
+	delay.tv_sec = ms / 1000;
+	delay.tv_nsec = (long) (ms % 1000) * 1000000L;
+	nanosleep(&delay, NULL);
+#endif
+}
+
+// Sleep until a time from owon_time()
+void sleep_until(const uint64_t time) {
+
+	uint64_t now = owon_time();
+
+	if (time <= now)
+		return;
+#if defined(_WIN32)
+	Sleep((DWORD) ((time - now + 999999) / 1000000));
+#else
+	struct timespec delay;
+	delay.tv_sec = (time_t) ((time - now) / 1000000000ULL);
+	delay.tv_nsec = (long) ((time - now) % 1000000000ULL);
+	nanosleep(&delay, NULL);
+#endif
+}
@@ -22,24 +22,143 @@
  *
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <libusb.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
 
 #include "libowonpds.h"
+#include "libowonpds_archive.h"
 #include "libowonpds_helper.h"
 
 #define EXT_CSV ".csv"
 #define EXT_PNG ".png"
 
+#define NS_PER_MS 1000000ULL
+#define BYTES_PER_MB (1024ULL * 1024ULL)
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int signal_number) {
+
+	(void) signal_number;
+	stop = 1;
+}
+
+// Wait until a time from owon_time()
+static void wait_until(const uint64_t time) {
+
+	uint64_t now = owon_time();
+
+	if (now >= time)
+		return;
+#if defined(_WIN32)
+	Sleep((DWORD) ((time - now) / NS_PER_MS));
+#else
+	struct timespec delay;
+	delay.tv_sec = (time_t) ((time - now) / 1000000000ULL);
+	delay.tv_nsec = (long) ((time - now) % 1000000000ULL);
+	nanosleep(&delay, NULL);
+#endif
+}
+
+// Capture continuously into an archive until count captures (0 for no
+// limit) or interrupted
+static int record(OWON_SCOPE_T *scope, const char *directory,
+		const unsigned interval, const unsigned count,
+		const unsigned segment_size, const unsigned sync,
+		const unsigned flags) {
+
+	OWON_ARCHIVE_T archive;
+	unsigned captures = 0;
+	unsigned timeouts = 0;
+	bool reconnected = false;
+	uint64_t next = owon_time();
+	int error_code;
+
+	error_code = owon_archive_open(&archive, directory,
+			segment_size * BYTES_PER_MB, sync, flags);
+	if (error_code) {
+		fprintf(stderr, "Could not open archive %s\n", directory);
+		return (error_code);
+	}
+
+	fprintf(stdout, "Recording to %s, Ctrl-C to stop\n", directory);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	while (!stop && (!count || captures < count)) {
+		wait_until(next);
+		next += (uint64_t) interval * NS_PER_MS;
+
+		error_code = owon_read(scope);
+		if (error_code == LIBUSB_ERROR_TIMEOUT
+				|| error_code == OWON_ERROR_FORMAT) {
+			timeouts++;
+			error_code = LIBUSB_SUCCESS;
+			continue;
+		}
+		// Reopen once after a USB error, e.g. the scope rebooting
+		if (error_code < 0 && !reconnected
+				&& owon_reconnect(scope) == LIBUSB_SUCCESS) {
+			reconnected = true;
+			timeouts++;
+			error_code = LIBUSB_SUCCESS;
+			continue;
+		}
+		if (error_code != LIBUSB_SUCCESS)
+			break;
+		reconnected = false;
+
+		error_code = owon_archive_write(&archive, scope);
+		if (error_code) {
+			fprintf(stderr, "Could not write to archive\n");
+			break;
+		}
+		captures++;
+
+		// Don't try to catch up after a slow capture
+		if (next < owon_time())
+			next = owon_time();
+	}
+
+	if (owon_archive_close(&archive) && !error_code) {
+		fprintf(stderr, "Could not write to archive\n");
+		error_code = OWON_ERROR_FORMAT;
+	}
+	fprintf(stdout, "Recorded %u captures (%u failed reads) in %s\n",
+			captures, timeouts, directory);
+
+	return (error_code);
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr, "Usage: %s [--serial SN] [filename]\n", name);
+	fprintf(stderr, "       %s [--serial SN] --record DIR [--interval MS]"
+			" [--count N] [--segment MB] [--sync N] [--pack]\n", name);
+}
+
 /**
  * Get data from a scope
  *
  * Retrieves information from the scope.\n
  * If a filename is given (without an extension) the captured data will
- * be saved to either a CSV or PNG file.
+ * be saved to either a CSV or PNG file.\n
+ * With --record captures are taken continuously into an archive
+ * directory, every --interval milliseconds (0 for as fast as possible)
+ * until --count captures are taken or interrupted. Segments are started
+ * every --segment MB and synced every --sync captures, --pack packs the
+ * samples losslessly.\n
+ * --serial opens the scope with that serial number, rather than the first.
  *
  * @return
  * 				- 0 Success
@@ -49,11 +168,56 @@
 int main(int argc, char *argv[]) {
 
 	OWON_SCOPE_T scope;
+	const char *filename = NULL;
+	const char *directory = NULL;
+	OWON_SELECT_T select;
+	unsigned interval = 0;
+	unsigned count = 0;
+	unsigned segment_size = 0;
+	unsigned sync = 0;
+	unsigned flags = 0;
 	int error_code;
+	int i;
+
+	memset(&select, 0, sizeof(select));
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			directory = argv[++i];
+		else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+			interval = (unsigned) strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+			count = (unsigned) strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--segment") == 0 && i + 1 < argc)
+			segment_size = (unsigned) strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc)
+			sync = (unsigned) strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--serial") == 0 && i + 1 < argc)
+			select.serial = argv[++i];
+		else if (strcmp(argv[i], "--pack") == 0)
+			flags |= OWON_ARCHIVE_PACK;
+		else if (argv[i][0] != '-' && !filename)
+			filename = argv[i];
+		else {
+			usage(argv[0]);
+			return (1);
+		}
+	}
 
 	fprintf(stdout, "owonpds utility (%s)\n\n", owon_version());
 
-	error_code = owon_open(&scope, 0);
+	error_code = owon_open_select(&scope, &select);
+	if (error_code == LIBUSB_SUCCESS && directory) {
+		// Keep the samples as sent, only the raw capture is recorded
+		scope.options |= OWON_OPT_RAW;
+		error_code = record(&scope, directory, interval, count,
+				segment_size, sync, flags);
+		owon_close(&scope);
+
+		if (error_code < 0)
+			fprintf(stderr, "USB error\n");
+
+		return (error_code);
+	}
 	if (error_code == LIBUSB_SUCCESS) {
 		error_code = owon_read(&scope);
 
@@ -82,18 +246,19 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	if (argc == 2) {
-		size_t length = strlen(argv[1]);
-		char *filename = malloc(length + 5);
-		if (filename) {
-			memcpy(filename, argv[1], length);
+	if (filename && error_code == LIBUSB_SUCCESS) {
+		size_t length = strlen(filename);
+		char *name = malloc(length + 5);
+		if (name) {
+			memcpy(name, filename, length);
 			if (scope.type == OWON_TYPE_VECTOR) {
-				memcpy(&filename[length], EXT_CSV, sizeof(EXT_CSV));
-				owon_write_csv(&scope, filename, true);
+				memcpy(&name[length], EXT_CSV, sizeof(EXT_CSV));
+				owon_write_csv(&scope, name, true);
 			} else {
-				memcpy(&filename[length], EXT_PNG, sizeof(EXT_PNG));
-				owon_write_png(&scope, filename);
+				memcpy(&name[length], EXT_PNG, sizeof(EXT_PNG));
+				owon_write_png(&scope, name);
 			}
+			free(name);
 		}
 	}
 
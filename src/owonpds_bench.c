@@ -0,0 +1,498 @@
+/*
+ * LibOwonPds
+ *
+ * A userspace driver of Owon PDS oscilloscopes
+ *
+ * http://eartoearoak.com/software/libowonpds
+ *
+ * Copyright 2015 Al Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libowonpds.h"
+#include "libowonpds_helper.h"
+#include "libowonpds_internal.h"
+
+#define ITERATIONS 20				// Default timed runs of each case
+#define FILE_CSV "owonpds_bench.csv"
+#define FILE_PNG "owonpds_bench.png"
+#define CHECK_LENGTH 300			// Longest packed length checked
+#define CHECK_GUARD 0xA5			// Fill after the packed bound
+
+static const char VARIANTS[] = { 'V', 'W', 'X' };
+static const unsigned CHANNELS[] = { 1, 2, 4, 6 };
+static const uint32_t DEPTHS[] = { 5000, 100000, 1000000 };
+
+// Result of a benchmark case
+typedef struct {
+	const char *name;
+	unsigned iterations;
+	uint64_t *times;
+	uint64_t samples;
+	uint64_t bytes;
+} BENCH_T;
+
+static int compare_time(const void *a, const void *b) {
+
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return ((x > y) - (x < y));
+}
+
+static double percentile(const BENCH_T *bench, const double fraction) {
+
+	unsigned i = (unsigned) (fraction * (bench->iterations - 1) + 0.5);
+
+	return ((double) bench->times[i] / 1e3);
+}
+
+// Print the percentile latencies and throughput of a case
+static void report(BENCH_T *bench) {
+
+	uint64_t total = 0;
+	unsigned i;
+
+	qsort(bench->times, bench->iterations, sizeof(uint64_t), compare_time);
+	for (i = 0; i < bench->iterations; i++)
+		total += bench->times[i];
+	if (!total)
+		total = 1;
+
+	double seconds = (double) total / 1e9;
+	fprintf(stdout, "%-28s %10.1f %10.1f %10.1f %10.1f %12.2f %10.1f\n",
+			bench->name, percentile(bench, 0.5), percentile(bench, 0.9),
+			percentile(bench, 0.99), percentile(bench, 1),
+			(double) (bench->samples * bench->iterations) / seconds / 1e6,
+			(double) (bench->bytes * bench->iterations) / seconds / 1e6);
+}
+
+// Samples to check packing with, each pattern at every length
+static void check_pattern(int16_t *samples, const unsigned pattern,
+		const uint32_t count) {
+
+	uint32_t state = 1;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		state = state * 1664525u + 1013904223u;
+		switch (pattern) {
+		case 0:
+			// Constant, packed at width 0
+			samples[i] = -1234;
+			break;
+		case 1:
+			// Steps of INT16_MIN, the widest difference
+			samples[i] = (i & 1) ? INT16_MIN : 0;
+			break;
+		case 2:
+			// Steps of INT16_MAX
+			samples[i] = (int16_t) (uint16_t) (i * INT16_MAX);
+			break;
+		case 3:
+			// Between the extremes, wrapping to a step of 1
+			samples[i] = (i & 1) ? INT16_MAX : INT16_MIN;
+			break;
+		case 4:
+			// Random, narrower in later blocks
+			samples[i] = (int16_t) (state >> 16 >> (i / 128 % 16));
+			break;
+		default:
+			samples[i] = (int16_t) (state >> 16);
+			break;
+		}
+	}
+}
+
+// Check samples unpack to those packed, at lengths either side of the
+// block and group sizes and with the extreme differences
+static bool check_codec(void) {
+
+	int16_t samples[CHECK_LENGTH];
+	int16_t unpacked[CHECK_LENGTH];
+	size_t bound = owon_pack_bound(CHECK_LENGTH);
+	unsigned char *packed = malloc(bound + 16);
+	uint32_t count;
+	unsigned pattern;
+	bool passed = true;
+
+	if (!packed) {
+		error("Failed to allocate packed samples");
+		return (false);
+	}
+
+	for (pattern = 0; pattern < 6 && passed; pattern++)
+		for (count = 0; count <= CHECK_LENGTH && passed; count++) {
+			size_t limit = owon_pack_bound(count);
+			size_t length;
+			size_t i;
+
+			check_pattern(samples, pattern, count);
+			memset(packed, CHECK_GUARD, bound + 16);
+			memset(unpacked, 0, sizeof(unpacked));
+
+			length = owon_pack_samples(packed, samples, count);
+			for (i = limit; i < bound + 16; i++)
+				if (packed[i] != CHECK_GUARD)
+					passed = false;
+
+			if (!passed || length > limit
+					|| owon_unpack_samples(unpacked, count, packed, length)
+					|| memcmp(samples, unpacked, sizeof(int16_t) * count)
+					|| (count
+							&& owon_unpack_samples(unpacked, count, packed,
+									length - 1) != OWON_ERROR_FORMAT)) {
+				fprintf(stderr,
+						"Packed samples do not round trip (pattern %u, %u samples)\n",
+						pattern, count);
+				passed = false;
+			}
+		}
+
+	free(packed);
+
+	return (passed);
+}
+
+static bool selected(const char *name, const char *filter) {
+
+	return (!filter || strstr(name, filter));
+}
+
+static void bench_vector(const char variant, const unsigned channels,
+		const uint32_t samples, const unsigned iterations,
+		const char *filter, uint64_t *times) {
+
+	OWON_SCOPE_T scope;
+	BENCH_T bench;
+	char name[64];
+	size_t length;
+	unsigned char *raw;
+	unsigned i, j;
+
+	raw = generate_vector(variant, channels, samples, 0, &length);
+	if (!raw) {
+		error("Failed to allocate capture");
+		return;
+	}
+
+	memset(&scope, 0, sizeof(scope));
+	scope.options = OWON_OPT_RAW;
+	scope.file_length = (uint32_t) (length - OWON_HEADER_SIZE);
+	decode_channel(&scope, raw + OWON_HEADER_SIZE);
+
+	bench.iterations = iterations;
+	bench.times = times;
+	bench.samples = (uint64_t) channels * samples;
+	bench.bytes = length - OWON_HEADER_SIZE;
+	bench.name = name;
+
+	snprintf(name, sizeof(name), "decode %c %uch %u", variant, channels,
+			samples);
+	if (selected(name, filter)) {
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			decode_channel(&scope, raw + OWON_HEADER_SIZE);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+	}
+
+	// Checksum of an unchanged capture (OWON_OPT_DEDUP)
+	snprintf(name, sizeof(name), "crc %c %uch %u", variant, channels,
+			samples);
+	if (selected(name, filter)) {
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			simd_kernels()->crc(0, raw, length);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+	}
+
+	snprintf(name, sizeof(name), "scale %c %uch %u", variant, channels,
+			samples);
+	if (selected(name, filter)) {
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			for (j = 0; j < scope.channel_count; j++)
+				scale_vector(&scope.channel[j]);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+	}
+
+	snprintf(name, sizeof(name), "measure %c %uch %u", variant, channels,
+			samples);
+	if (selected(name, filter)) {
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			for (j = 0; j < scope.channel_count; j++)
+				measure_channel(&scope.channel[j]);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+	}
+
+	// Buffers are allocated by the first capture, before timing
+	snprintf(name, sizeof(name), "accumulate %c %uch %u", variant, channels,
+			samples);
+	if (selected(name, filter)) {
+		OWON_ACCUM_T accum;
+		memset(&accum, 0, sizeof(accum));
+		owon_accum_add(&accum, &scope);
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			owon_accum_add(&accum, &scope);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+		owon_accum_free(&accum);
+	}
+
+	// Plans are made before timing, as by a running analyser
+	snprintf(name, sizeof(name), "spectrum %c %uch %u", variant, channels,
+			samples);
+	if (selected(name, filter)) {
+		OWON_SPECTRUM_T spectrum;
+		memset(&spectrum, 0, sizeof(spectrum));
+		owon_spectrum(&spectrum, &scope.channel[0], OWON_WINDOW_HANN, 0);
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			for (j = 0; j < scope.channel_count; j++)
+				owon_spectrum(&spectrum, &scope.channel[j], OWON_WINDOW_HANN,
+						0);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+		owon_spectrum_free(&spectrum);
+	}
+
+	// Each channel packed to, and unpacked from, its own region
+	size_t bound = owon_pack_bound(samples);
+	unsigned char *packed = malloc(bound * channels);
+	int16_t *unpacked = malloc(sizeof(int16_t) * samples);
+	size_t packed_length[OWON_MAX_CHANNELS];
+	if (packed && unpacked) {
+		for (j = 0; j < scope.channel_count; j++)
+			packed_length[j] = owon_pack_samples(packed + j * bound,
+					scope.channel[j].data, scope.channel[j].samples);
+
+		snprintf(name, sizeof(name), "pack %c %uch %u", variant, channels,
+				samples);
+		if (selected(name, filter)) {
+			for (i = 0; i < iterations; i++) {
+				uint64_t start = owon_time();
+				for (j = 0; j < scope.channel_count; j++)
+					owon_pack_samples(packed + j * bound,
+							scope.channel[j].data, scope.channel[j].samples);
+				times[i] = owon_time() - start;
+			}
+			report(&bench);
+		}
+
+		snprintf(name, sizeof(name), "unpack %c %uch %u", variant, channels,
+				samples);
+		if (selected(name, filter)) {
+			for (i = 0; i < iterations; i++) {
+				uint64_t start = owon_time();
+				for (j = 0; j < scope.channel_count; j++)
+					owon_unpack_samples(unpacked, scope.channel[j].samples,
+							packed + j * bound, packed_length[j]);
+				times[i] = owon_time() - start;
+			}
+			report(&bench);
+		}
+	} else
+		error("Failed to allocate packed samples");
+	free(packed);
+	free(unpacked);
+
+	// Exports are slow, only time one variant
+	snprintf(name, sizeof(name), "csv %c %uch %u", variant, channels,
+			samples);
+	if (variant == 'V' && selected(name, filter)) {
+		unsigned runs = samples >= 1000000 ? 1 : iterations;
+		bench.iterations = runs;
+		for (i = 0; i < runs; i++) {
+			uint64_t start = owon_time();
+			owon_write_csv(&scope, FILE_CSV, false);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+		remove(FILE_CSV);
+	}
+
+	owon_free(&scope);
+	free(raw);
+}
+
+// Convert a bitmap to top down RGB rows
+static void bitmap_rgb(unsigned char *rgb, const OWON_SCOPE_T *scope) {
+
+	unsigned width = scope->bitmap_width;
+	unsigned i, j;
+
+	for (i = 0; i < scope->bitmap_height; i++) {
+		const unsigned char *pixel = scope->bitmap
+				+ (ptrdiff_t) i * scope->bitmap_stride;
+
+		for (j = 0; j < width; j++) {
+			rgb[j * 3] = pixel[j * 3 + 2];
+			rgb[j * 3 + 1] = pixel[j * 3 + 1];
+			rgb[j * 3 + 2] = pixel[j * 3];
+		}
+		rgb += (size_t) width * 3;
+	}
+}
+
+static void bench_bitmap(const unsigned iterations, const char *filter,
+		uint64_t *times) {
+
+	OWON_SCOPE_T scope;
+	OWON_PNG_T fast = OWON_PNG_FAST;
+	BENCH_T bench;
+	size_t length;
+	unsigned char *raw;
+	unsigned i;
+
+	raw = generate_bitmap(&length);
+	if (!raw) {
+		error("Failed to allocate capture");
+		return;
+	}
+
+	memset(&scope, 0, sizeof(scope));
+	scope.file_length = (uint32_t) (length - OWON_HEADER_SIZE);
+	decode_bitmap(&scope, raw + OWON_HEADER_SIZE);
+
+	bench.iterations = iterations;
+	bench.times = times;
+	bench.samples = (uint64_t) OWON_BITMAP_WIDTH * OWON_BITMAP_HEIGHT;
+	bench.bytes = length - OWON_HEADER_SIZE;
+
+	// Decoding only points at the rows, so time the conversion to a top
+	// down RGB image (as for a PPM file or a display) with it
+	bench.name = "decode bitmap RGB";
+	if (selected(bench.name, filter)) {
+		size_t row = (size_t) OWON_BITMAP_WIDTH * OWON_BITMAP_CHANNELS;
+		unsigned char *rgb = malloc(row * OWON_BITMAP_HEIGHT);
+		if (rgb) {
+			for (i = 0; i < iterations; i++) {
+				uint64_t start = owon_time();
+				decode_bitmap(&scope, raw + OWON_HEADER_SIZE);
+				bitmap_rgb(rgb, &scope);
+				times[i] = owon_time() - start;
+			}
+			report(&bench);
+		} else
+			error("Failed to allocate image");
+		free(rgb);
+	}
+
+	bench.name = "png default";
+	if (selected(bench.name, filter)) {
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			owon_write_png(&scope, FILE_PNG);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+	}
+
+	bench.name = "png fast";
+	if (selected(bench.name, filter)) {
+		for (i = 0; i < iterations; i++) {
+			uint64_t start = owon_time();
+			owon_write_png_ex(&scope, FILE_PNG, &fast);
+			times[i] = owon_time() - start;
+		}
+		report(&bench);
+	}
+	remove(FILE_PNG);
+
+	owon_free(&scope);
+	free(raw);
+}
+
+/**
+ * Benchmark the library with synthetic captures
+ *
+ * owonpds_bench [-n iterations] [filter]
+ *
+ * Cases with names containing filter are run, for example "decode V" or
+ * "png". Throughput is given per pixel for bitmaps, MB/s is of the
+ * capture payload. Packing is checked to round trip before timing.
+ *
+ * @return
+ * 				- 0 Success
+ * 				- 1 Bad arguments
+ * 				- 2 Packed samples do not round trip
+ */
+int main(int argc, char *argv[]) {
+
+	unsigned iterations = ITERATIONS;
+	const char *filter = NULL;
+	uint64_t *times;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = (unsigned) strtoul(argv[++i], NULL, 10);
+		else if (argv[i][0] != '-')
+			filter = argv[i];
+		else {
+			fprintf(stderr, "Usage: %s [-n iterations] [filter]\n", argv[0]);
+			return (1);
+		}
+	}
+	if (!iterations)
+		iterations = 1;
+
+	if (!check_codec())
+		return (2);
+
+	times = malloc(sizeof(uint64_t) * iterations);
+	if (!times) {
+		error("Failed to allocate results");
+		return (1);
+	}
+
+	fprintf(stdout, "owonpds benchmark (%s, %s kernels)\n\n", owon_version(),
+			simd_kernels()->name);
+	fprintf(stdout, "%-28s %10s %10s %10s %10s %12s %10s\n", "Case",
+			"p50 (us)", "p90 (us)", "p99 (us)", "max (us)", "Msamples/s",
+			"MB/s");
+
+	size_t v, c, d;
+	for (v = 0; v < sizeof(VARIANTS); v++)
+		for (c = 0; c < sizeof(CHANNELS) / sizeof(CHANNELS[0]); c++)
+			for (d = 0; d < sizeof(DEPTHS) / sizeof(DEPTHS[0]); d++)
+				bench_vector(VARIANTS[v], CHANNELS[c], DEPTHS[d], iterations,
+						filter, times);
+	bench_bitmap(iterations, filter, times);
+
+	free(times);
+
+	return (0);
+}
@@ -25,46 +25,244 @@
 
 
 import copy
+import threading
 from ctypes import *
 from ctypes.util import find_library
 
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
 # Defines from of libowonpds.h
 OWON_MAX_CHANNELS = 6
+OWON_MAX_DEVICES = 16
 OWON_DESC_NAME_LEN = 50
 OWON_SCOPE_NAME_LEN = 6
 OWON_CHANNEL_NAME_LEN = 3
 
-## OwonPds
+OWON_OPT_RAW = 0x01
+OWON_OPT_STATS = 0x02
+OWON_OPT_MEASURE = 0x04
+OWON_OPT_DEDUP = 0x08
 
+OWON_TYPE_VECTOR = 0
+OWON_TYPE_BITMAP = 1
 
-## Wraps the LibOwonPds driver
-class OwonPds(object):
+OWON_STAGES = 7
+OWON_HISTOGRAM_BINS = 16
 
-    ## Initialise the scope object
-    # @param param: index    Device index
-    # @return Scope object
-    def __init__(self, index=0):
+OWON_PYRAMID_LEVELS = 32
+OWON_PYRAMID_MEAN = 0x01
 
-        self._index = index
-        self._version = owon_version()
-        self._scope = Scope()
+OWON_WINDOW_RECT = 0
+OWON_WINDOW_HANN = 1
+OWON_WINDOW_BLACKMAN = 2
+OWON_WINDOW_FLATTOP = 3
+
+OWON_SPECTRUM_AVERAGE = 0x01
+OWON_SPECTRUM_PHASE = 0x02
+
+OWON_ACCUM_MEAN = 0
+OWON_ACCUM_AVERAGE = 1
+OWON_ACCUM_MIN = 2
+OWON_ACCUM_MAX = 3
+OWON_ACCUM_PEAK = 4
+OWON_ACCUM_VIEWS = 5
+OWON_ACCUM_ALPHA = 0.0625
+
+# Defines from of libowonpds_helper.h
+OWON_PNG_LEVEL_DEFAULT = -1
+OWON_PNG_FILTER_DEFAULT = 0x00
+OWON_PNG_FILTER_NONE = 0x08
+OWON_PNG_FILTER_ALL = 0xF8
+OWON_PNG_STRATEGY_DEFAULT = 0
+OWON_PNG_STRATEGY_RLE = 3
+
+OWON_BIN_PACK = 0x01
+
+## ScopeData
+
+
+## Access to captured data
+#
+# With NumPy installed get_bitmap(), get_vector() and get_samples() return
+# arrays that share the library's buffers, nothing is copied.
+# The buffers are reused, so an array is only valid until the next
+# read(), read_async() capture, decode_buffer(), load_raw(), map_bin(),
+# unmap_bin(), free() or close() of the OwonPds object, or for a Capture
+# until the next try_pop() or stop_streaming(). Use array.copy() to keep
+# the data.
+# Without NumPy copies are returned as lists.
+class ScopeData(object):
+
+    ## Initialise the data object
+    # @param param: scope    Scope structure holding the data
+    def __init__(self, scope):
+        self._scope = scope
 
     ## Get scope data structure
     # @return Scope data structure
     def get_scope(self):
         return self._scope
 
+    ## Get bitmap data
+    # @returns Height x width x 3 array of BGR values, top row first
+    #          (without NumPy a copy of successive BGR values)
+    def get_bitmap(self):
+        bitmap = []
+        if self._scope.type == 1 and self._scope.bitmap:
+            height = self._scope.bitmapHeight
+            stride = self._scope.bitmapStride
+            size = self._scope.bitmapWidth * self._scope.bitmapChannels
+            top = cast(self._scope.bitmap, c_void_p).value
+            if numpy is not None:
+                # Rows may run backwards through the buffer
+                base = top + min(0, stride * (height - 1))
+                length = abs(stride) * (height - 1) + size
+                buffer = (c_ubyte * length).from_address(base)
+                bitmap = numpy.ndarray((height, self._scope.bitmapWidth,
+                                        self._scope.bitmapChannels),
+                                       numpy.uint8, buffer, top - base,
+                                       (stride, self._scope.bitmapChannels, 1))
+            else:
+                rows = [string_at(top + row * stride, size)
+                        for row in range(height)]
+                bitmap = b''.join(rows)
+        return bitmap
+
+    ## Get vector data for a channel
+    # @param channel Channel to retrieve
+    # @returns Array of levels (V)
+    def get_vector(self, channel):
+
+        vector = []
+        if self._scope.type == 0 and channel < self._scope.channelCount:
+            size = self._scope.channels[channel].samples
+            levels = owon_get_vector(byref(self._scope.channels[channel]))
+            if levels:
+                if numpy is not None:
+                    vector = numpy.ctypeslib.as_array(levels, (size,))
+                else:
+                    vector = copy.copy(levels[:size])
+        return vector
+
+    ## Get the raw samples for a channel
+    # @param channel Channel to retrieve
+    # @returns Array of samples (multiply by the channel scale for volts)
+    def get_samples(self, channel):
+
+        samples = []
+        if self._scope.type == 0 and channel < self._scope.channelCount:
+            size = self._scope.channels[channel].samples
+            data = self._scope.channels[channel].data
+            if data:
+                if numpy is not None:
+                    samples = numpy.ctypeslib.as_array(data, (size,))
+                else:
+                    samples = copy.copy(data[:size])
+        return samples
+
+    ## Get the measurements of a channel
+    # (made while decoding with OWON_OPT_MEASURE, otherwise now)
+    # @param channel Channel to measure
+    # @returns Measure structure, or None
+    def get_measure(self, channel):
+        if self._scope.type != 0 or channel >= self._scope.channelCount:
+            return None
+        data = self._scope.channels[channel]
+        if not data.measure.valid and owon_measure(byref(data)) != 0:
+            return None
+        return data.measure
+
+    ## Get a copy of vector data for all channels
+    # @param dtype NumPy type of the levels, numpy.float32 is converted
+    #              directly from the samples
+    # @returns Channels x samples array of levels (V), shorter channels
+    #          are padded with NaN (without NumPy a list of lists)
+    def get_vectors(self, dtype=None):
+        if numpy is None:
+            vectors = []
+            for channel in range(self._scope.channelCount):
+                vectors.append(self.get_vector(channel))
+            return vectors
+
+        dtype = numpy.dtype(dtype or numpy.float64)
+        count = self._scope.channelCount if self._scope.type == 0 else 0
+        channels = self._scope.channels
+        length = max([channels[i].samples for i in range(count)] or [0])
+        vectors = numpy.empty((count, length), dtype)
+        for i in range(count):
+            size = channels[i].samples
+            if dtype == numpy.float32 and channels[i].data:
+                owon_convert_float(byref(channels[i]),
+                                   vectors[i].ctypes.data_as(POINTER(c_float)))
+            else:
+                vectors[i, :size] = self.get_vector(i)
+            vectors[i, size:] = numpy.nan
+        return vectors
+
+
+## Capture
+
+
+## A capture taken from the background thread
+# (valid until try_pop() returns another capture or stop_streaming())
+class Capture(ScopeData):
+    pass
+
+
+## OwonPds
+
+
+## Wraps the LibOwonPds driver
+class OwonPds(ScopeData):
+
+    ## Initialise the scope object
+    # @param param: index    Device index, of the scopes matching
+    # @param param: bus      USB bus number, 0 for any
+    # @param param: port     USB port number, 0 for any
+    # @param param: serial   Serial number, None for any
+    # @return Scope object
+    def __init__(self, index=0, bus=0, port=0, serial=None):
+        ScopeData.__init__(self, Scope())
+
+        self._select = Select(bus, port, serial, index)
+        self._version = owon_version()
+
     ## Get the library version
     # @return Version string
     def get_version(self):
         return self._version
 
+    ## Set capture options
+    # @param options OWON_OPT_ flags
+    def set_options(self, options):
+        self._scope.options = options
+
     ## Open communication with the scope
     # @return
     #            - 0 Success
     #            - <0 libusb error
     def open(self):
-        return owon_open(byref(self._scope), self._index)
+        return owon_open_select(byref(self._scope), byref(self._select))
+
+    ## Reopen the scope after an error, stops streaming
+    # @return
+    #            - 0 Success
+    #            - <0 libusb error
+    def reconnect(self):
+        return owon_reconnect(byref(self._scope))
+
+    ## Open a simulated scope instead
+    # @param sim: Sim structure, the defaults if None
+    # @return
+    #            - 0 Success
+    #            - <0 libusb error
+    def open_sim(self, sim=None):
+        if sim is None:
+            sim = Sim()
+        return owon_open_sim(byref(self._scope), byref(sim))
 
     ## Read from the scope
     # @return
@@ -73,7 +271,80 @@ class OwonPds(object):
     def read(self):
         return owon_read(byref(self._scope))
 
-    ## Free allocated channel/bitmap data
+    ## Continuously read from the scope
+    # The next capture is requested while the previous one is decoded
+    # @param callback Called with this object after each capture,
+    #                 return True to stop
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 libusb error
+    def read_async(self, callback):
+        def on_capture(_scope, _context):
+            return 1 if callback(self) else 0
+
+        return owon_read_async(byref(self._scope), OWON_CALLBACK(on_capture),
+                               None)
+
+    ## Start capturing on a background thread
+    # @param depth Number of captures that can be queued
+    # @return
+    #            - 0 Success
+    #            - <0 libusb error
+    def start_streaming(self, depth=2):
+        return owon_start_streaming(byref(self._scope), depth)
+
+    ## Get the oldest capture from the background thread
+    # @return (error, Capture or None)
+    def try_pop(self):
+        capture = POINTER(Scope)()
+        error = owon_try_pop(byref(self._scope), byref(capture))
+        if capture:
+            return error, Capture(capture.contents)
+        return error, None
+
+    ## Wait for the oldest capture from the background thread
+    # The GIL is released while waiting
+    # @param timeout Maximum time to wait (s), None to wait until a capture
+    #                arrives or capturing stops
+    # @return (error, Capture or None)
+    def pop(self, timeout=None):
+        capture = POINTER(Scope)()
+        while True:
+            wait = Reader.POLL if timeout is None else min(timeout, Reader.POLL)
+            error = owon_pop(byref(self._scope), byref(capture),
+                             int(wait * 1000))
+            if capture or error != 0:
+                break
+            if timeout is not None:
+                timeout -= wait
+                if timeout <= 0:
+                    break
+        if capture:
+            return error, Capture(capture.contents)
+        return error, None
+
+    ## Stop capturing on the background thread
+    # @return
+    #            - 0 Success
+    #            - <0 libusb error
+    def stop_streaming(self):
+        return owon_stop_streaming(byref(self._scope))
+
+    ## Get capture timings and counters
+    # (collected while OWON_OPT_STATS is set)
+    # @return Stats structure
+    def get_stats(self):
+        stats = Stats()
+        owon_get_stats(byref(self._scope), byref(stats))
+        return stats
+
+    ## Clear capture timings and counters
+    def reset_stats(self):
+        owon_reset_stats(byref(self._scope))
+
+    ## Free channel/bitmap data
+    # (buffers are otherwise reused between reads)
     def free(self):
         owon_free(byref(self._scope))
 
@@ -81,34 +352,391 @@ class OwonPds(object):
     def close(self):
         owon_close(byref(self._scope))
 
-    ## Get a copy of bitmap data
-    # @returns Array of successive RGB values
-    def get_bitmap(self):
-        bitmap = []
-        if self._scope.type == 1:
-            size = self._scope.bitmapWidth * self._scope.bitmapHeight * self._scope.bitmapChannels
-            bitmap = copy.copy(self._scope.bitmap[:size])
-        return bitmap
+    ## Decode a raw capture without a device
+    # @param buffer Raw capture (header and payload)
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    def decode_buffer(self, buffer):
+        return owon_decode_buffer(byref(self._scope), buffer, len(buffer))
 
-    ## Get a copy of vector data for a channel
-    # @param channel Channel to retrieve
-    # @returns Array of vectors
-    def get_vector(self, channel):
+    ## Write the last raw capture to a file
+    # @param filename Filename
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 errno error
+    def write_raw(self, filename):
+        return owon_write_raw(byref(self._scope), filename)
+
+    ## Load and decode a raw capture file
+    # @param filename Filename
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 errno error
+    def load_raw(self, filename):
+        return owon_load_raw(byref(self._scope), filename)
+
+    ## Write the bitmap to a PNG file
+    # @param filename Filename
+    # @param options PngOptions, None for the defaults
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 errno error
+    def write_png(self, filename, options=None):
+        return owon_write_png_ex(byref(self._scope), filename,
+                                 byref(options) if options else None)
+
+    ## Write the bitmap to a BMP file, as sent by the scope
+    # @param filename Filename
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 errno error
+    def write_bmp(self, filename):
+        return owon_write_bmp(byref(self._scope), filename)
+
+    ## Write the bitmap to a PPM file
+    # @param filename Filename
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 errno error
+    def write_ppm(self, filename):
+        return owon_write_ppm(byref(self._scope), filename)
+
+    ## Write the channel data to a binary capture file
+    # @param filename Filename
+    # @param pack Pack the samples losslessly
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 errno error
+    def write_bin(self, filename, pack=False):
+        flags = OWON_BIN_PACK if pack else 0
+        return owon_write_bin_ex(byref(self._scope), filename, flags)
+
+    ## Map a binary capture file, the samples are used in place
+    # (valid until unmap_bin())
+    # @param filename Filename
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 errno error
+    def map_bin(self, filename):
+        return owon_map_bin(byref(self._scope), filename)
+
+    ## Unmap a binary capture file
+    def unmap_bin(self):
+        owon_unmap_bin(byref(self._scope))
+
+
+## Reader
+
+
+## Delivers captures from the background thread without blocking
+# Acquisition and decoding run in the library, waiting for a capture
+# releases the GIL so the UI and other Python threads keep running.
+# Only one of a callback, get() or get_future() should be used.
+class Reader(object):
+    # Longest wait in the library, so stopping is prompt (s)
+    POLL = 0.1
+
+    ## Initialise the reader
+    # @param scope Opened OwonPds object
+    # @param callback Called on the reader thread as callback(error, capture)
+    #                 for each capture (valid until it returns), and once
+    #                 with an error if capturing fails. None to use get()
+    # @param depth Number of captures that can be queued
+    def __init__(self, scope, callback=None, depth=2):
+        self._scope = scope
+        self._callback = callback
+        self._depth = depth
+        self._thread = None
+        self._stop = threading.Event()
+
+    ## Start capturing
+    # @return
+    #            - 0 Success
+    #            - <0 libusb error
+    def start(self):
+        error = self._scope.start_streaming(self._depth)
+        if error == 0 and self._callback is not None:
+            self._stop.clear()
+            self._thread = threading.Thread(target=self.__run)
+            self._thread.daemon = True
+            self._thread.start()
+        return error
+
+    ## Wait for the next capture
+    # (valid until the next get() or stop())
+    # @param timeout Maximum time to wait (s), None to wait indefinitely
+    # @return (error, Capture or None)
+    def get(self, timeout=None):
+        return self._scope.pop(timeout)
+
+    ## Wait for the next capture from asyncio
+    # (valid until the next get_future() or stop())
+    # @param loop Event loop, None for the current loop
+    # @param timeout Maximum time to wait (s), None to wait indefinitely
+    # @return Awaitable future of (error, Capture or None)
+    def get_future(self, loop=None, timeout=None):
+        if loop is None:
+            import asyncio
+            loop = asyncio.get_event_loop()
+        return loop.run_in_executor(None, self._scope.pop, timeout)
+
+    ## Stop capturing
+    # @return
+    #            - 0 Success
+    #            - <0 libusb error that stopped capturing
+    def stop(self):
+        if self._thread is not None:
+            self._stop.set()
+            if self._thread is not threading.current_thread():
+                self._thread.join()
+            self._thread = None
+        return self._scope.stop_streaming()
+
+    def __run(self):
+        while not self._stop.is_set():
+            error, capture = self._scope.pop(Reader.POLL)
+            if error != 0:
+                self._callback(error, None)
+                break
+            if capture is not None:
+                self._callback(error, capture)
+
+
+## OwonPdsGroup
+
+
+## Wraps every attached scope, read in parallel
+class OwonPdsGroup(object):
+
+    ## Initialise the group object
+    def __init__(self):
+        self._group = Group()
 
+    ## Open every attached scope
+    # @return
+    #            - 0 Success
+    #            - <0 libusb error
+    def open(self):
+        return owon_open_all(byref(self._group))
+
+    ## Read from every scope in parallel
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 libusb error
+    def read(self):
+        return owon_read_all(byref(self._group))
+
+    ## Close every scope
+    def close(self):
+        owon_close_all(byref(self._group))
+
+    ## Get the number of scopes opened
+    # @return Scope count
+    def get_count(self):
+        return self._group.count
+
+    ## Get the data of a scope
+    # @param index Scope index
+    # @return ScopeData object
+    def get_scope(self, index):
+        return ScopeData(self._group.scopes[index])
+
+
+## Envelope
+
+
+## Min/max decimation pyramid of a channel, for drawing long captures
+class Envelope(object):
+
+    ## Initialise the envelope
+    def __init__(self):
+        self._pyramid = Pyramid()
+
+    def __del__(self):
+        self.free()
+
+    ## Build the pyramid of a channel, rebuild after each capture
+    # @param channel Channel structure
+    # @param mean Also allow means to be queried
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 libusb error
+    def build(self, channel, mean=False):
+        return owon_pyramid_build(byref(self._pyramid), byref(channel),
+                                  OWON_PYRAMID_MEAN if mean else 0)
+
+    ## Get the envelope as display columns
+    # @param columns Number of columns
+    # @param start Time of the first column (s)
+    # @param end Time of the end of the last column (s)
+    # @param mean Also return the mean of each column
+    # @return (minimums, maximums, means or None) in volts,
+    #         NaN outside the capture
+    def query(self, columns, start, end, mean=False):
+        minimums = (c_double * columns)()
+        maximums = (c_double * columns)()
+        means = (c_double * columns)() if mean else None
+        owon_pyramid_query(byref(self._pyramid), start, end, columns,
+                           minimums, maximums, means)
+        return minimums, maximums, means
+
+    ## Free the pyramid
+    def free(self):
+        if owon_pyramid_free is not None:
+            owon_pyramid_free(byref(self._pyramid))
+
+
+## Analyser
+
+
+## Spectrum of a channel
+class Analyser(object):
+
+    ## Initialise the analyser
+    def __init__(self):
+        self._spectrum = Spectrum()
+
+    def __del__(self):
+        self.free()
+
+    ## Find the spectrum of a channel
+    # @param channel Channel structure
+    # @param window OWON_WINDOW_ window
+    # @param average Average with the previous spectra
+    # @param phase Also find the phase
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 libusb error
+    def compute(self, channel, window=OWON_WINDOW_HANN, average=False,
+                phase=False):
+        flags = 0
+        if average:
+            flags |= OWON_SPECTRUM_AVERAGE
+        if phase:
+            flags |= OWON_SPECTRUM_PHASE
+        return owon_spectrum(byref(self._spectrum), byref(channel), window,
+                             flags)
+
+    ## Get the bin spacing
+    # @return Bin spacing (Hz)
+    def get_resolution(self):
+        return self._spectrum.resolution
+
+    ## Get the number of spectra averaged
+    # @return Spectra averaged
+    def get_averages(self):
+        return self._spectrum.averages
+
+    ## Get the magnitude of each bin
+    # (a view of the library's buffer with NumPy, valid until the next
+    # compute() or free())
+    # @return Peak amplitude of each bin (V)
+    def get_magnitude(self):
+        return self.__get_bins(self._spectrum.magnitude)
+
+    ## Get the phase of each bin, if computed with phase
+    # @return Phase of each bin (rad)
+    def get_phase(self):
+        return self.__get_bins(self._spectrum.phase)
+
+    ## Free the spectrum
+    def free(self):
+        if owon_spectrum_free is not None:
+            owon_spectrum_free(byref(self._spectrum))
+
+    def __get_bins(self, values):
+        bins = self._spectrum.bins
+        if not values or not bins:
+            return []
+        if numpy is not None:
+            return numpy.ctypeslib.as_array(values, (bins,))
+        return values[:bins]
+
+
+## Accumulator
+
+
+## Mean, average, envelope and peak hold of successive captures
+class Accumulator(object):
+
+    ## Initialise the accumulator
+    # @param alpha Weight of each capture in the exponential average
+    def __init__(self, alpha=OWON_ACCUM_ALPHA):
+        self._accum = Accum()
+        self._accum.alpha = alpha
+
+    def __del__(self):
+        self.free()
+
+    ## Add a capture, restarting if the channel settings changed
+    # @param data ScopeData (or OwonPds) object holding the capture
+    # @return
+    #            - 0 Success
+    #            - >0 OWON_ERROR error
+    #            - <0 libusb error
+    def add(self, data):
+        return owon_accum_add(byref(self._accum), byref(data.get_scope()))
+
+    ## Get the number of captures accumulated
+    # @return Captures accumulated
+    def get_count(self):
+        return self._accum.count
+
+    ## Get a view of a channel
+    # (a view of the library's buffer with NumPy, valid until the next
+    # add(), reset() or free())
+    # @param channel Channel to retrieve
+    # @param view OWON_ACCUM_ view
+    # @returns Array of levels (V)
+    def get_vector(self, channel, view=OWON_ACCUM_MEAN):
         vector = []
-        if self._scope.type == 0 and channel < self._scope.channelCount:
-            size = self._scope.channels[channel].samples
-            vector = copy.copy(self._scope.channels[channel].vector[:size])
+        accumulated = owon_accum_view(byref(self._accum), channel, view)
+        if accumulated:
+            size = accumulated.contents.samples
+            levels = owon_get_vector(accumulated)
+            if levels:
+                if numpy is not None:
+                    vector = numpy.ctypeslib.as_array(levels, (size,))
+                else:
+                    vector = copy.copy(levels[:size])
         return vector
 
-    ## Get a copy of vector data for all channels
-    # @returns 2D array of vectors
-    def get_vectors(self):
-        vectors = []
-        for channel in range(self._scope.channelCount):
-            vectors.append(self.get_vector(channel))
+    ## Discard the captures accumulated
+    def reset(self):
+        owon_accum_reset(byref(self._accum))
 
-        return vectors
+    ## Free the accumulator
+    def free(self):
+        if owon_accum_free is not None:
+            owon_accum_free(byref(self._accum))
+
+
+## Measurements structure
+# (see @ref OWON_MEASURE_T)
+class Measure(Structure):
+    _fields_ = [('min', c_double),
+                ('max', c_double),
+                ('vpp', c_double),
+                ('mean', c_double),
+                ('rms', c_double),
+                ('frequency', c_double),
+                ('period', c_double),
+                ('rise', c_double),
+                ('fall', c_double),
+                ('duty', c_double),
+                ('cycles', c_uint),
+                ('valid', c_bool)]
 
 
 ## Channel structure
@@ -122,7 +750,104 @@ class Channel(Structure):
                 ('offset', c_double),
                 ('sensitivity', c_double),
                 ('attenuation', c_uint),
-                ('vector', POINTER(c_double))]
+                ('vector', POINTER(c_double)),
+                ('_vectorSize', c_size_t),
+                ('data', POINTER(c_int16)),
+                ('_dataSize', c_size_t),
+                ('scale', c_double),
+                ('converted', c_bool),
+                ('measure', Measure)]
+
+
+## Statistics structure
+# (see @ref OWON_STATS_T)
+class Stats(Structure):
+    _fields_ = [('last', c_uint64 * OWON_STAGES),
+                ('total', c_uint64 * OWON_STAGES),
+                ('latency', c_uint64),
+                ('captures', c_uint64),
+                ('bytes', c_uint64),
+                ('timeouts', c_uint64),
+                ('errors', c_uint64),
+                ('histogram', c_uint64 * OWON_HISTOGRAM_BINS)]
+
+
+## Pyramid structure
+# (see @ref OWON_PYRAMID_T)
+class Pyramid(Structure):
+    _fields_ = [('samples', c_uint32),
+                ('levels', c_uint),
+                ('offset', c_uint32 * OWON_PYRAMID_LEVELS),
+                ('length', c_uint32 * OWON_PYRAMID_LEVELS),
+                ('_min', POINTER(c_int16)),
+                ('_minSize', c_size_t),
+                ('_max', POINTER(c_int16)),
+                ('_maxSize', c_size_t),
+                ('_sum', POINTER(c_int64)),
+                ('_sumSize', c_size_t),
+                ('_data', POINTER(c_int16)),
+                ('sampleRate', c_double),
+                ('scale', c_double),
+                ('flags', c_uint)]
+
+
+## Spectrum structure
+# (see @ref OWON_SPECTRUM_T)
+class Spectrum(Structure):
+    _fields_ = [('samples', c_uint32),
+                ('bins', c_uint32),
+                ('resolution', c_double),
+                ('window', c_uint),
+                ('averages', c_uint),
+                ('magnitude', POINTER(c_double)),
+                ('_magnitudeSize', c_size_t),
+                ('phase', POINTER(c_double)),
+                ('_phaseSize', c_size_t),
+                ('_power', POINTER(c_double)),
+                ('_powerSize', c_size_t),
+                ('_work', POINTER(c_double)),
+                ('_workSize', c_size_t),
+                ('_plan', c_void_p)]
+
+
+## Accumulator structure
+# (see @ref OWON_ACCUM_T)
+class Accum(Structure):
+    _fields_ = [('count', c_uint),
+                ('channelCount', c_uint),
+                ('alpha', c_double),
+                ('view', (Channel * OWON_ACCUM_VIEWS) * OWON_MAX_CHANNELS),
+                ('_sums', c_void_p * OWON_MAX_CHANNELS)]
+
+
+## Scope selection
+# (see @ref OWON_SELECT_T)
+class Select(Structure):
+    _fields_ = [('bus', c_uint8),
+                ('port', c_uint8),
+                ('serial', c_char_p),
+                ('index', c_uint)]
+
+
+## Simulated scope
+# (see @ref OWON_SIM_T)
+class Sim(Structure):
+    _fields_ = [('type', c_uint),
+                ('variant', c_char),
+                ('channels', c_uint),
+                ('samples', c_uint32),
+                ('latency', c_uint),
+                ('rate', c_uint),
+                ('timeouts', c_double),
+                ('errors', c_double),
+                ('truncated', c_double),
+                ('seed', c_uint32)]
+
+    def __init__(self, channels=2, samples=10000, latency=0, rate=0,
+                 timeouts=0, errors=0, truncated=0, seed=1,
+                 type=OWON_TYPE_VECTOR, variant=b'V'):
+        Structure.__init__(self, type, variant, channels, samples, latency,
+                           rate, timeouts, errors, truncated, seed)
 
 
 ## Scope structure
@@ -130,17 +855,63 @@ class Channel(Structure):
 class Scope(Structure):
     _fields_ = [('manufacturer', c_char * (OWON_DESC_NAME_LEN + 1)),
                 ('product', c_char * (OWON_DESC_NAME_LEN + 1)),
+                ('serial', c_char * (OWON_DESC_NAME_LEN + 1)),
+                ('bus', c_uint8),
+                ('port', c_uint8),
                 ('name', c_char * (OWON_SCOPE_NAME_LEN + 1)),
                 ('type', c_uint),
                 ('fileLength', c_uint32),
+                ('timestamp', c_uint64),
+                ('sequence', c_uint64),
+                ('crc', c_uint32),
+                ('unchanged', c_bool),
                 ('channelCount', c_uint),
-                ('channels', Channel * (OWON_MAX_CHANNELS + 1)),
+                ('channels', Channel * OWON_MAX_CHANNELS),
                 ('bitmapWidth', c_uint),
                 ('bitmapHeight', c_uint),
                 ('bitmapChannels', c_uint),
                 ('bitmap', POINTER(c_char)),
+                ('bitmapStride', c_int),
+                ('raw', POINTER(c_ubyte)),
+                ('rawLength', c_uint32),
+                ('_rawSize', c_size_t),
+                ('_map', c_void_p),
+                ('_mapLength', c_size_t),
+                ('options', c_uint),
+                ('stats', Stats),
                 ('_context', c_void_p),
-                ('_handle', c_void_p)]
+                ('_handle', c_void_p),
+                ('_device', c_void_p),
+                ('_link', c_void_p),
+                ('_dedup', c_void_p),
+                ('_stream', c_void_p)]
+
+
+## PNG encoding options
+# (see @ref OWON_PNG_T)
+class PngOptions(Structure):
+    _fields_ = [('level', c_int),
+                ('filters', c_uint),
+                ('strategy', c_int)]
+
+    def __init__(self, level=OWON_PNG_LEVEL_DEFAULT,
+                 filters=OWON_PNG_FILTER_DEFAULT,
+                 strategy=OWON_PNG_STRATEGY_DEFAULT):
+        Structure.__init__(self, level, filters, strategy)
+
+
+## Fast encoding of screenshots
+PNG_FAST = PngOptions(1, OWON_PNG_FILTER_NONE, OWON_PNG_STRATEGY_RLE)
+
+
+## Group structure
+# (see @ref OWON_GROUP_T)
+class Group(Structure):
+    _fields_ = [('_context', c_void_p),
+                ('count', c_uint),
+                ('scopes', Scope * OWON_MAX_DEVICES),
+                ('errors', c_int * OWON_MAX_DEVICES),
+                ('_workers', c_void_p)]
 
 
 def libowonpds_load():
@@ -174,14 +945,80 @@ owon_version = libowonpds.owon_version
 owon_version.argtypes = []
 owon_version.restype = c_char_p
 
+owon_time = libowonpds.owon_time
+owon_time.argtypes = []
+owon_time.restype = c_uint64
+
 owon_open = libowonpds.owon_open
 owon_open.argtypes = [POINTER(Scope), c_uint]
 owon_open.restype = c_int
 
+owon_open_select = libowonpds.owon_open_select
+owon_open_select.argtypes = [POINTER(Scope), POINTER(Select)]
+owon_open_select.restype = c_int
+
+owon_reconnect = libowonpds.owon_reconnect
+owon_reconnect.argtypes = [POINTER(Scope)]
+owon_reconnect.restype = c_int
+
+owon_open_sim = libowonpds.owon_open_sim
+owon_open_sim.argtypes = [POINTER(Scope), POINTER(Sim)]
+owon_open_sim.restype = c_int
+
+owon_release_devices = libowonpds.owon_release_devices
+owon_release_devices.argtypes = []
+owon_release_devices.restype = None
+
 owon_read = libowonpds.owon_read
 owon_read.argtypes = [POINTER(Scope)]
 owon_read.restype = c_int
 
+OWON_CALLBACK = CFUNCTYPE(c_int, POINTER(Scope), c_void_p)
+
+owon_read_async = libowonpds.owon_read_async
+owon_read_async.argtypes = [POINTER(Scope), OWON_CALLBACK, c_void_p]
+owon_read_async.restype = c_int
+
+owon_start_streaming = libowonpds.owon_start_streaming
+owon_start_streaming.argtypes = [POINTER(Scope), c_uint]
+owon_start_streaming.restype = c_int
+
+owon_try_pop = libowonpds.owon_try_pop
+owon_try_pop.argtypes = [POINTER(Scope), POINTER(POINTER(Scope))]
+owon_try_pop.restype = c_int
+
+owon_pop = libowonpds.owon_pop
+owon_pop.argtypes = [POINTER(Scope), POINTER(POINTER(Scope)), c_uint]
+owon_pop.restype = c_int
+
+owon_stop_streaming = libowonpds.owon_stop_streaming
+owon_stop_streaming.argtypes = [POINTER(Scope)]
+owon_stop_streaming.restype = c_int
+
+owon_decode_buffer = libowonpds.owon_decode_buffer
+owon_decode_buffer.argtypes = [POINTER(Scope), c_char_p, c_size_t]
+owon_decode_buffer.restype = c_int
+
+owon_get_vector = libowonpds.owon_get_vector
+owon_get_vector.argtypes = [POINTER(Channel)]
+owon_get_vector.restype = POINTER(c_double)
+
+owon_convert_float = libowonpds.owon_convert_float
+owon_convert_float.argtypes = [POINTER(Channel), POINTER(c_float)]
+owon_convert_float.restype = None
+
+owon_measure = libowonpds.owon_measure
+owon_measure.argtypes = [POINTER(Channel)]
+owon_measure.restype = c_int
+
+owon_get_stats = libowonpds.owon_get_stats
+owon_get_stats.argtypes = [POINTER(Scope), POINTER(Stats)]
+owon_get_stats.restype = None
+
+owon_reset_stats = libowonpds.owon_reset_stats
+owon_reset_stats.argtypes = [POINTER(Scope)]
+owon_reset_stats.restype = None
+
 owon_free = libowonpds.owon_free
 owon_free.argtypes = [POINTER(Scope)]
 owon_free.restype = None
@@ -190,14 +1027,110 @@ owon_close = libowonpds.owon_close
 owon_close.argtypes = [POINTER(Scope)]
 owon_close.restype = None
 
+owon_pyramid_build = libowonpds.owon_pyramid_build
+owon_pyramid_build.argtypes = [POINTER(Pyramid), POINTER(Channel), c_uint]
+owon_pyramid_build.restype = c_int
+
+owon_pyramid_query = libowonpds.owon_pyramid_query
+owon_pyramid_query.argtypes = [POINTER(Pyramid), c_double, c_double, c_uint,
+                               POINTER(c_double), POINTER(c_double),
+                               POINTER(c_double)]
+owon_pyramid_query.restype = c_int
+
+owon_pyramid_free = libowonpds.owon_pyramid_free
+owon_pyramid_free.argtypes = [POINTER(Pyramid)]
+owon_pyramid_free.restype = None
+
+owon_spectrum = libowonpds.owon_spectrum
+owon_spectrum.argtypes = [POINTER(Spectrum), POINTER(Channel), c_uint, c_uint]
+owon_spectrum.restype = c_int
+
+owon_spectrum_free = libowonpds.owon_spectrum_free
+owon_spectrum_free.argtypes = [POINTER(Spectrum)]
+owon_spectrum_free.restype = None
+
+owon_accum_add = libowonpds.owon_accum_add
+owon_accum_add.argtypes = [POINTER(Accum), POINTER(Scope)]
+owon_accum_add.restype = c_int
+
+owon_accum_view = libowonpds.owon_accum_view
+owon_accum_view.argtypes = [POINTER(Accum), c_uint, c_uint]
+owon_accum_view.restype = POINTER(Channel)
+
+owon_accum_reset = libowonpds.owon_accum_reset
+owon_accum_reset.argtypes = [POINTER(Accum)]
+owon_accum_reset.restype = None
+
+owon_accum_free = libowonpds.owon_accum_free
+owon_accum_free.argtypes = [POINTER(Accum)]
+owon_accum_free.restype = None
+
+owon_open_all = libowonpds.owon_open_all
+owon_open_all.argtypes = [POINTER(Group)]
+owon_open_all.restype = c_int
+
+owon_read_all = libowonpds.owon_read_all
+owon_read_all.argtypes = [POINTER(Group)]
+owon_read_all.restype = c_int
+
+owon_close_all = libowonpds.owon_close_all
+owon_close_all.argtypes = [POINTER(Group)]
+owon_close_all.restype = None
+
 # Helper functions
 owon_write_csv = libowonpds.owon_write_csv
 owon_write_csv.argtypes = [POINTER(Scope), c_char_p, c_bool]
 owon_write_csv.restype = None
 
+owon_write_csv_threaded = libowonpds.owon_write_csv_threaded
+owon_write_csv_threaded.argtypes = [POINTER(Scope), c_char_p, c_bool, c_uint]
+owon_write_csv_threaded.restype = c_int
+
 owon_write_png = libowonpds.owon_write_png
 owon_write_png.argtypes = [POINTER(Scope), c_char_p]
-owon_write_png.restype = None
+owon_write_png.restype = c_int
+
+owon_write_png_ex = libowonpds.owon_write_png_ex
+owon_write_png_ex.argtypes = [POINTER(Scope), c_char_p, POINTER(PngOptions)]
+owon_write_png_ex.restype = c_int
+
+owon_write_png_batch = libowonpds.owon_write_png_batch
+owon_write_png_batch.argtypes = [POINTER(POINTER(Scope)), POINTER(c_char_p),
+                                 c_uint, POINTER(PngOptions), c_uint,
+                                 POINTER(c_int)]
+owon_write_png_batch.restype = c_int
+
+owon_write_bmp = libowonpds.owon_write_bmp
+owon_write_bmp.argtypes = [POINTER(Scope), c_char_p]
+owon_write_bmp.restype = c_int
+
+owon_write_ppm = libowonpds.owon_write_ppm
+owon_write_ppm.argtypes = [POINTER(Scope), c_char_p]
+owon_write_ppm.restype = c_int
+
+owon_write_raw = libowonpds.owon_write_raw
+owon_write_raw.argtypes = [POINTER(Scope), c_char_p]
+owon_write_raw.restype = c_int
+
+owon_load_raw = libowonpds.owon_load_raw
+owon_load_raw.argtypes = [POINTER(Scope), c_char_p]
+owon_load_raw.restype = c_int
+
+owon_write_bin = libowonpds.owon_write_bin
+owon_write_bin.argtypes = [POINTER(Scope), c_char_p]
+owon_write_bin.restype = c_int
+
+owon_write_bin_ex = libowonpds.owon_write_bin_ex
+owon_write_bin_ex.argtypes = [POINTER(Scope), c_char_p, c_uint]
+owon_write_bin_ex.restype = c_int
+
+owon_map_bin = libowonpds.owon_map_bin
+owon_map_bin.argtypes = [POINTER(Scope), c_char_p]
+owon_map_bin.restype = c_int
+
+owon_unmap_bin = libowonpds.owon_unmap_bin
+owon_unmap_bin.argtypes = [POINTER(Scope)]
+owon_unmap_bin.restype = None
 
 if __name__ == '__main__':
     print 'Please run rtlsdr_scan.py'
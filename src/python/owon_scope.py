@@ -33,6 +33,7 @@ import libowonpds
 class FrameOscilloscope(wx.Frame):
     CHANNEL_COLORS = ['Red', 'Yellow', 'Sky Blue', 'Green']
     REFRESH_RATE = 7
+    RING_DEPTH = 2
 
     def __init__(self):
         wx.Frame.__init__(self, None, title='FrameOscilloscope')
@@ -69,6 +70,7 @@ class FrameOscilloscope(wx.Frame):
 
     def __on_close(self, _event):
         self._timer.Stop()
+        self._scope.stop_streaming()
         self._scope.close()
         self.Destroy()
 
@@ -97,22 +99,30 @@ class FrameOscilloscope(wx.Frame):
             self._controls.enable(True, False)
 
     def __capture_start(self):
-        self._controls.enable(False, True)
-        self.__update()
+        if self._scope.start_streaming(FrameOscilloscope.RING_DEPTH) != 0:
+            wx.MessageBox('Start failed', 'Error', wx.OK | wx.ICON_ERROR)
+        else:
+            self._controls.enable(False, True)
+            self.__update()
 
     def __capture_stop(self):
         self._controls.enable(True, False)
         self._timer.Stop()
+        # Captures are freed when streaming stops
+        self._crt.update(None)
+        self._scope.stop_streaming()
 
     def __update(self):
         timeStart = time.time()
-        if self._scope.read() != 0:
+        error, capture = self._scope.try_pop()
+        if error != 0:
             self.__capture_stop()
             wx.MessageBox('Read failed', 'Error', wx.OK | wx.ICON_ERROR)
         else:
-            self._crt.update(self._scope)
-            self._info.update(self._scope)
-            self._channels.update(self._scope)
+            if capture is not None:
+                self._crt.update(capture)
+                self._info.update(capture)
+                self._channels.update(capture)
             timeRefresh = self._refreshPeriod - (time.time() - timeStart)
             if timeRefresh < 0:
                 self._controls.spinRate.SetForegroundColour(wx.RED)
@@ -134,6 +144,8 @@ class PanelCrt(wx.Panel):
         wx.Panel.__init__(self, parent, size=(320, 256),
                           style=wx.FULL_REPAINT_ON_RESIZE | wx.BORDER_RAISED)
         self._scope = None
+        self._envelopes = [libowonpds.Envelope()
+                           for _i in range(libowonpds.OWON_MAX_CHANNELS)]
 
         try:
             self.SetBackgroundStyle(wx.BG_STYLE_PAINT)
@@ -183,30 +195,39 @@ class PanelCrt(wx.Panel):
             for j in range(data.channelCount):
                 channel = data.channels[j]
                 if channel.samples > 0:
-                    scaleX = float(width) / (channel.samples)
+                    # One vertical line per column, min to max, joined to
+                    # the previous column
+                    end = channel.samples / channel.sampleRate
+                    minimums, maximums, _means = \
+                        self._envelopes[j].query(width, 0, end)
                     scaleY = height / float(channel.sensitivity * PanelCrt.DIV_Y)
-                    lines = [[] for i in range(channel.samples)]
-                    level = channel.vector[0] + channel.offset
-                    y = (height / 2) - (level * scaleY)
-                    xLast = 0
-                    yLast = y
-                    for i in range(channel.samples):
-                        level = channel.vector[i] + channel.offset
-                        y = (height / 2) - (level * scaleY)
-                        x = i * scaleX
-                        lines[i] = (xLast, yLast, x, y)
-                        xLast = x
-                        yLast = y
+                    lines = []
+                    yLast = None
+                    for x in range(width):
+                        if math.isnan(minimums[x]):
+                            continue
+                        yMin = (height / 2) - ((maximums[x] + channel.offset) * scaleY)
+                        yMax = (height / 2) - ((minimums[x] + channel.offset) * scaleY)
+                        if yLast is not None:
+                            yMin = min(yMin, yLast)
+                            yMax = max(yMax, yLast)
+                        lines.append((x, yMin, x, yMax))
+                        yLast = (yMin + yMax) / 2
                     colour = FrameOscilloscope.CHANNEL_COLORS[j]
                     dc.SetPen(wx.Pen(colour, 2))
                     dc.DrawLineList(lines)
 
+                    scaleX = float(width) / (channel.samples)
                     x = channel.slow * channel.sampleRate * scaleX
                     dc.SetPen(wx.Pen(colour, 2))
                     dc.DrawLine(x, 0, x, height)
 
     def update(self, scope):
         self._scope = scope
+        if scope is not None:
+            data = scope.get_scope()
+            for j in range(data.channelCount):
+                self._envelopes[j].build(data.channels[j])
         self.Refresh()
 
 